@@ -1,5 +1,13 @@
 # Determine platform- and compiler-specific settings
 
+# C++11 is the minimum language level, a newer compiler default is kept
+# (the computed default is 98 for C++98):
+IF(NOT DEFINED CMAKE_CXX_STANDARD)
+  IF(NOT CMAKE_CXX_STANDARD_COMPUTED_DEFAULT OR CMAKE_CXX_STANDARD_COMPUTED_DEFAULT EQUAL 98 OR CMAKE_CXX_STANDARD_COMPUTED_DEFAULT LESS 11)
+    SET(CMAKE_CXX_STANDARD 11)
+  ENDIF()
+ENDIF()
+
 # compiler specific settings
 if (CMAKE_COMPILER_IS_GNUCC)
    # add some more general preprocessor defines (only for gcc)
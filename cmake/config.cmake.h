@@ -12,4 +12,9 @@
 #define PACKAGE_FIRMWARE "v@PXAR_FW_VERSION@"
 
 #define ETHERNET_INTERFACE "eth0"
+
+// Bulk reads in flight for the libusb USB interface:
+#define USB_READ_TRANSFERS @USB_READ_TRANSFERS@
+#define USB_READ_TRANSFER_SIZE @USB_READ_TRANSFER_SIZE@
+#define USB_LATENCY_TIMER @USB_LATENCY_TIMER@
 #endif
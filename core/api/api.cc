@@ -7,16 +7,28 @@
 #include "log.h"
 #include "timer.h"
 #include "helper.h"
+#include "thresholdfinder.h"
+#include "asyncscan.h"
 #include "dictionaries.h"
 #include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <cmath>
+#include <thread>
 #include "constants.h"
 #include "config.h"
 
 using namespace pxar;
 
 pxarCore::pxarCore(std::string usbId, std::string logLevel, bool do_Daq_MemReset) :
+  _async(NULL),
+  _asyncScan(NULL),
+  _monitor(NULL),
+  _loopCall(0),
+  _loopCalls(0),
+  _loopEvents(0),
+  _callEvents(0),
+  _callExpected(0),
   _daq_running(false),
   _daq_buffersize(DTB_SOURCE_BUFFER_SIZE),
   _daq_startstop_warning(false)
@@ -36,6 +48,8 @@ pxarCore::pxarCore(std::string usbId, std::string logLevel, bool do_Daq_MemReset
 }
 
 pxarCore::~pxarCore() {
+  // Cancel and finish pending asynchronous scans while the DUT is still around:
+  delete _async;
   delete _dut;
   delete _hal;
 }
@@ -425,7 +439,9 @@ bool pxarCore::programDUT() {
   // First thing to do: startup DUT power if not yet done
   _hal->Pon();
 
-  // Start programming the devices here!
+  // Start programming the devices here! All configuration is collected and
+  // sent to the testboard in one transfer:
+  rpcBatch batch(_hal);
 
   std::vector<tbmConfig> enabledTbms = _dut->getEnabledTbms();
   if(!enabledTbms.empty()) { LOG(logDEBUGAPI) << "Programming TBMs..."; }
@@ -447,6 +463,7 @@ bool pxarCore::programDUT() {
 
   // Also clear all calibrate signals:
   SetCalibrateBits(false);
+  batch.send();
 
   // The DUT is programmed, everything all right:
   _dut->_programmed = true;
@@ -573,6 +590,12 @@ void pxarCore::Poff() {
   _dut->_programmed = false;
 }
 
+void pxarCore::invalidateCache() {
+  LOG(logDEBUGAPI) << "Invalidating the cached DUT configuration, uploading everything again.";
+  _dut->trim_changed.clear();
+  _hal->invalidateCache();
+}
+
 void pxarCore::Pon() {
   // Power is turned on when programming the DUT.
   // Re-program the DUT after power has been switched on:
@@ -667,11 +690,22 @@ statistics pxarCore::getStatistics() {
   return _hal->daqStatistics();
 }
 
+registerStatistics pxarCore::getRegisterStatistics() {
+  LOG(logDEBUG) << "Fetched register cache statistics. Counters are being reset now.";
+  return _hal->registerStats();
+}
+
+rpcStatistics pxarCore::getRpcStatistics() {
+  LOG(logDEBUG) << "Fetched RPC call statistics. Counters are being reset now.";
+  return _hal->rpcStats();
+}
+
 
 // TEST functions
 
 bool pxarCore::setDAC(std::string dacName, uint8_t dacValue, uint8_t rocID) {
 
+  checkIdle();
   if(!status()) {return false;}
 
   // Get the register number and check the range from dictionary:
@@ -714,6 +748,7 @@ bool pxarCore::setDAC(std::string dacName, uint8_t dacValue, uint8_t rocID) {
 
 bool pxarCore::setDAC(std::string dacName, uint8_t dacValue) {
 
+  checkIdle();
   if(!status()) {return false;}
 
   // Get the register number and check the range from dictionary:
@@ -737,9 +772,11 @@ bool pxarCore::setDAC(std::string dacName, uint8_t dacValue) {
       LOG(logDEBUGAPI) << "DAC \"" << dacName << "\" updated with value " << static_cast<int>(dacValue);
     }
 
-    _hal->rocSetDAC(rocit->i2c_address,dacRegister,dacValue);
+    _hal->rocSetDAC(rocit->i2c_address,dacRegister,dacValue,false);
   }
 
+  // Send the DAC writes of all ROCs at once:
+  _hal->flushRegisters();
   return true;
 }
 
@@ -769,6 +806,7 @@ uint8_t pxarCore::getDACRange(std::string dacName) {
 
 bool pxarCore::setTbmReg(std::string regName, uint8_t regValue, uint8_t tbmid) {
 
+  checkIdle();
   if(!status()) {return 0;}
 
   // Get the register number and check the range from dictionary:
@@ -840,54 +878,15 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getPulseheightV
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getPulseheightVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
-
-  // Check DAC range
-  if(dacMin > dacMax) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dacMin;
-    dacMin = dacMax;
-    dacMax = temp;
-  }
-
-  // Get the register number and check the range from dictionary:
-  uint8_t dacRegister;
-  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+  // We want the pulse height back from the Map function, no internal flag needed.
+  scanSetup setup;
+  if(!setupDacScan(dacName, dacStep, dacMin, dacMax, flags, nTriggers, false, setup)) {
     return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
   }
 
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacScan;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacScan;
-
-  // We want the pulse height back from the Map function, no internal flag needed.
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dacRegister));
-  param.push_back(static_cast<int32_t>(dacMin));
-  param.push_back(static_cast<int32_t>(dacMax));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-  param.push_back(static_cast<int32_t>(dacStep));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, false, flags);
+  std::vector<Event> data = runScan(setup);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackDacScanData(data,dacStep,dacMin,dacMax,flags);
-
-  // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDacValue = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dacName);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << static_cast<int>(oldDacValue);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dacRegister,oldDacValue);
-  }
-
-  return result;
+  return repackDacScanData(data,dacStep,dacMin,dacMax,flags);
 }
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getEfficiencyVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
@@ -898,52 +897,14 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getEfficiencyVs
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getEfficiencyVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
-
-  // Check DAC range
-  if(dacMin > dacMax) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dacMin;
-    dacMin = dacMax;
-    dacMax = temp;
-  }
-
-  // Get the register number and check the range from dictionary:
-  uint8_t dacRegister;
-  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+  scanSetup setup;
+  if(!setupDacScan(dacName, dacStep, dacMin, dacMax, flags, nTriggers, true, setup)) {
     return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
   }
 
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacScan;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacScan;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dacRegister));
-  param.push_back(static_cast<int32_t>(dacMin));
-  param.push_back(static_cast<int32_t>(dacMax));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-  param.push_back(static_cast<int32_t>(dacStep));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, true, flags);
+  std::vector<Event> data = runScan(setup);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackDacScanData(data,dacStep,dacMin,dacMax,flags);
-
-  // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDacValue = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dacName);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << static_cast<int>(oldDacValue);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dacRegister,oldDacValue);
-  }
-
-  return result;
+  return repackDacScanData(data,dacStep,dacMin,dacMax,flags);
 }
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getThresholdVsDAC(std::string dacName, std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
@@ -962,76 +923,14 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getThresholdVsD
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::getThresholdVsDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t threshold, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
-
-  // Check DAC ranges
-  if(dac1min > dac1max) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dac1min;
-    dac1min = dac1max;
-    dac1max = temp;
-  }
-  if(dac2min > dac2max) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dac2min;
-    dac2min = dac2max;
-    dac2max = temp;
-  }
-
-  // Get the register number and check the range from dictionary:
-  uint8_t dac1register, dac2register;
-  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
-  }
-  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
-  }
-
-  // Check the threshold percentage level provided:
-  if(threshold == 0 || threshold > 100) {
-    LOG(logCRITICAL) << "Threshold level of " << static_cast<int>(threshold) << "% is not possible!";
+  scanSetup setup;
+  if(!setupThresholdVsDAC(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, threshold, flags, nTriggers, setup)) {
     return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
   }
 
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacDacScan;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacDacScan;
-  // In Principle these functions exist, but they would take years to run and fill up the buffer
-  HalMemFnRocSerial     rocfn        = NULL; // &hal::SingleRocAllPixelsDacDacScan;
-  HalMemFnRocParallel   multirocfn   = NULL; // &hal::MultiRocAllPixelsDacDacScan;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dac1register));
-  param.push_back(static_cast<int32_t>(dac1min));
-  param.push_back(static_cast<int32_t>(dac1max));
-  param.push_back(static_cast<int32_t>(dac2register));
-  param.push_back(static_cast<int32_t>(dac2min));
-  param.push_back(static_cast<int32_t>(dac2max));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-  param.push_back(static_cast<int32_t>(dac1step));
-  param.push_back(static_cast<int32_t>(dac2step));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, true, flags);
+  std::vector<Event> data = runScan(setup);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackThresholdDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,threshold,nTriggers,flags);
-
-  // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
-    uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
-  }
-
-  return result;
+  return repackThresholdDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,threshold,nTriggers,flags,repackThreads());
 }
 
 
@@ -1043,69 +942,24 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > pxar
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > pxarCore::getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
-
-  // Check DAC ranges
-  if(dac1min > dac1max) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dac1min;
-    dac1min = dac1max;
-    dac1max = temp;
-  }
-  if(dac2min > dac2max) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dac2min;
-    dac2min = dac2max;
-    dac2max = temp;
-  }
-
-  // Get the register number and check the range from dictionary:
-  uint8_t dac1register, dac2register;
-  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
-  }
-  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+  scanSetup setup;
+  if(!setupDacDacScan(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, false, setup)) {
     return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
   }
 
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacDacScan;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacDacScan;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacDacScan;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacDacScan;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dac1register));
-  param.push_back(static_cast<int32_t>(dac1min));
-  param.push_back(static_cast<int32_t>(dac1max));
-  param.push_back(static_cast<int32_t>(dac2register));
-  param.push_back(static_cast<int32_t>(dac2min));
-  param.push_back(static_cast<int32_t>(dac2max));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-  param.push_back(static_cast<int32_t>(dac1step));
-  param.push_back(static_cast<int32_t>(dac2step));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, false, flags);
+  std::vector<Event> data = runScan(setup);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result = repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags);
+  return repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags);
+}
 
-  // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
-    uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
-  }
+bool pxarCore::getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers, dacDacVisitor & visitor) {
 
-  return result;
+  scanSetup setup;
+  if(!setupDacDacScan(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, false, setup)) {
+    return false;
+  }
+  streamDacDacScan(setup, dac1step, dac1min, dac1max, dac2step, dac2min, dac2max, visitor);
+  return true;
 }
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > pxarCore::getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
@@ -1116,117 +970,44 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > pxar
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > pxarCore::getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
-
-  // Check DAC ranges
-  if(dac1min > dac1max) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dac1min;
-    dac1min = dac1max;
-    dac1max = temp;
-  }
-  if(dac2min > dac2max) {
-    // Swapping the range:
-    LOG(logWARNING) << "Swapping upper and lower bound.";
-    uint8_t temp = dac2min;
-    dac2min = dac2max;
-    dac2max = temp;
-  }
-
-  // Get the register number and check the range from dictionary:
-  uint8_t dac1register, dac2register;
-  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
-  }
-  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+  scanSetup setup;
+  if(!setupDacDacScan(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, true, setup)) {
     return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
   }
 
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacDacScan;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacDacScan;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacDacScan;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacDacScan;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dac1register));
-  param.push_back(static_cast<int32_t>(dac1min));
-  param.push_back(static_cast<int32_t>(dac1max));
-  param.push_back(static_cast<int32_t>(dac2register));
-  param.push_back(static_cast<int32_t>(dac2min));
-  param.push_back(static_cast<int32_t>(dac2max));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-  param.push_back(static_cast<int32_t>(dac1step));
-  param.push_back(static_cast<int32_t>(dac2step));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, true, flags);
+  std::vector<Event> data = runScan(setup);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result = repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags);
+  return repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags);
+}
 
-  // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
-    uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
-    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
-  }
+bool pxarCore::getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers, dacDacVisitor & visitor) {
 
-  return result;
+  scanSetup setup;
+  if(!setupDacDacScan(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, true, setup)) {
+    return false;
+  }
+  streamDacDacScan(setup, dac1step, dac1min, dac1max, dac2step, dac2min, dac2max, visitor);
+  return true;
 }
 
 std::vector<pixel> pxarCore::getPulseheightMap(uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector<pixel>();}
-
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelCalibrate;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelCalibrate;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsCalibrate;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsCalibrate;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, false, flags);
+  scanSetup setup;
+  if(!setupMapScan(flags, nTriggers, false, setup)) {return std::vector<pixel>();}
 
+  std::vector<Event> data = runScan(setup);
   // Repacking of all data segments into one long map vector:
-  std::vector<pixel> result = repackMapData(data, flags);
-
-  return result;
+  return repackMapData(data, flags);
 }
 
 std::vector<pixel> pxarCore::getEfficiencyMap(uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector<pixel>();}
-
-  // Setup the correct _hal calls for this test
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelCalibrate;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelCalibrate;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsCalibrate;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsCalibrate;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, true, flags);
+  scanSetup setup;
+  if(!setupMapScan(flags, nTriggers, true, setup)) {return std::vector<pixel>();}
 
+  std::vector<Event> data = runScan(setup);
   // Repacking of all data segments into one long map vector:
-  std::vector<pixel> result = repackMapData(data, flags);
-
-  return result;
+  return repackMapData(data, flags);
 }
 
 std::vector<pixel> pxarCore::getThresholdMap(std::string dacName, uint16_t flags, uint16_t nTriggers) {
@@ -1245,46 +1026,118 @@ std::vector<pixel> pxarCore::getThresholdMap(std::string dacName, uint8_t dacSte
 
 std::vector<pixel> pxarCore::getThresholdMap(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector<pixel>();}
+  scanSetup setup;
+  if(!setupThresholdMap(dacName, dacStep, dacMin, dacMax, threshold, flags, nTriggers, setup)) {return std::vector<pixel>();}
 
-  // Scan the maximum DAC range for threshold:
-  uint8_t dacRegister;
-  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
-    return std::vector<pixel>();
+  std::vector<Event> data = runScan(setup);
+  // Repacking of all data segments into one long map vector:
+  return repackThresholdMapData(data, dacStep, dacMin, dacMax, threshold, nTriggers, flags, repackThreads());
+}
+
+
+// Asynchronous test functions
+
+void pxarCore::setScanMonitor(scanMonitor * monitor) {
+  // The measurement thread reads the monitor while scans are running:
+  checkIdle();
+  _monitor = monitor;
+}
+
+scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > > pxarCore::getPulseheightVsDACAsync(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
+
+  asyncResult<std::vector< std::pair<uint8_t, std::vector<pixel> > > > * scan = new asyncResult<std::vector< std::pair<uint8_t, std::vector<pixel> > > >();
+  if(setupDacScan(dacName, dacStep, dacMin, dacMax, flags, nTriggers, false, scan->setup)) {
+    scan->repack = [=](std::vector<Event> & data) { return repackDacScanData(data,dacStep,dacMin,dacMax,flags); };
+    submitScan(scan);
+  }
+  else { scan->Finish(); }
+  return scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > >(scan);
+}
+
+scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > > pxarCore::getEfficiencyVsDACAsync(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
+
+  asyncResult<std::vector< std::pair<uint8_t, std::vector<pixel> > > > * scan = new asyncResult<std::vector< std::pair<uint8_t, std::vector<pixel> > > >();
+  if(setupDacScan(dacName, dacStep, dacMin, dacMax, flags, nTriggers, true, scan->setup)) {
+    scan->repack = [=](std::vector<Event> & data) { return repackDacScanData(data,dacStep,dacMin,dacMax,flags); };
+    submitScan(scan);
   }
+  else { scan->Finish(); }
+  return scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > >(scan);
+}
 
-  // Check the threshold percentage level provided:
-  if(threshold == 0 || threshold > 100) {
-    LOG(logCRITICAL) << "Threshold level of " << static_cast<int>(threshold) << "% is not possible!";
-    return std::vector<pixel>();
+scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > > pxarCore::getThresholdVsDACAsync(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t threshold, uint16_t flags, uint16_t nTriggers) {
+
+  asyncResult<std::vector< std::pair<uint8_t, std::vector<pixel> > > > * scan = new asyncResult<std::vector< std::pair<uint8_t, std::vector<pixel> > > >();
+  if(setupThresholdVsDAC(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, threshold, flags, nTriggers, scan->setup)) {
+    // The repacking runs alongside later scans, it must not read the DUT:
+    size_t nthreads = repackThreads();
+    scan->repack = [=](std::vector<Event> & data) { return repackThresholdDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,threshold,nTriggers,flags,nthreads); };
+    submitScan(scan);
   }
+  else { scan->Finish(); }
+  return scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > >(scan);
+}
 
-  // Setup the correct _hal calls for this test, a threshold map is a 1D dac scan:
-  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
-  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
-  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacScan;
-  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacScan;
+scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > > pxarCore::getPulseheightVsDACDACAsync(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dacRegister));
-  param.push_back(static_cast<int32_t>(dacMin));
-  param.push_back(static_cast<int32_t>(dacMax));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
-  param.push_back(static_cast<int32_t>(dacStep));
+  asyncResult<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > > * scan = new asyncResult<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >();
+  if(setupDacDacScan(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, false, scan->setup)) {
+    scan->repack = [=](std::vector<Event> & data) { return repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags); };
+    submitScan(scan);
+  }
+  else { scan->Finish(); }
+  return scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >(scan);
+}
 
-  // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, true, flags);
+scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > > pxarCore::getEfficiencyVsDACDACAsync(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
 
-  // Repacking of all data segments into one long map vector:
-  std::vector<pixel> result = repackThresholdMapData(data, dacStep, dacMin, dacMax, threshold, nTriggers, flags);
+  asyncResult<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > > * scan = new asyncResult<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >();
+  if(setupDacDacScan(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, true, scan->setup)) {
+    scan->repack = [=](std::vector<Event> & data) { return repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags); };
+    submitScan(scan);
+  }
+  else { scan->Finish(); }
+  return scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >(scan);
+}
 
-  return result;
+scanFuture<std::vector<pixel> > pxarCore::getPulseheightMapAsync(uint16_t flags, uint16_t nTriggers) {
+
+  asyncResult<std::vector<pixel> > * scan = new asyncResult<std::vector<pixel> >();
+  if(setupMapScan(flags, nTriggers, false, scan->setup)) {
+    scan->repack = [=](std::vector<Event> & data) { return repackMapData(data, flags); };
+    submitScan(scan);
+  }
+  else { scan->Finish(); }
+  return scanFuture<std::vector<pixel> >(scan);
+}
+
+scanFuture<std::vector<pixel> > pxarCore::getEfficiencyMapAsync(uint16_t flags, uint16_t nTriggers) {
+
+  asyncResult<std::vector<pixel> > * scan = new asyncResult<std::vector<pixel> >();
+  if(setupMapScan(flags, nTriggers, true, scan->setup)) {
+    scan->repack = [=](std::vector<Event> & data) { return repackMapData(data, flags); };
+    submitScan(scan);
+  }
+  else { scan->Finish(); }
+  return scanFuture<std::vector<pixel> >(scan);
+}
+
+scanFuture<std::vector<pixel> > pxarCore::getThresholdMapAsync(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers) {
+
+  asyncResult<std::vector<pixel> > * scan = new asyncResult<std::vector<pixel> >();
+  if(setupThresholdMap(dacName, dacStep, dacMin, dacMax, threshold, flags, nTriggers, scan->setup)) {
+    // The repacking runs alongside later scans, it must not read the DUT:
+    size_t nthreads = repackThreads();
+    scan->repack = [=](std::vector<Event> & data) { return repackThresholdMapData(data, dacStep, dacMin, dacMax, threshold, nTriggers, flags, nthreads); };
+    submitScan(scan);
+  }
+  else { scan->Finish(); }
+  return scanFuture<std::vector<pixel> >(scan);
 }
 
 std::vector<std::vector<uint16_t> > pxarCore::daqGetReadback() {
 
+  checkIdle();
   std::vector<std::vector<uint16_t> > values;
   if(!status()) { return values; }
 
@@ -1295,6 +1148,7 @@ std::vector<std::vector<uint16_t> > pxarCore::daqGetReadback() {
 
 std::vector<uint8_t> pxarCore::daqGetXORsum(uint8_t channel) {
 
+  checkIdle();
   std::vector<uint8_t> values;
   if(!status() || channel >= DTB_DAQ_CHANNELS) { return values; }
 
@@ -1320,6 +1174,7 @@ bool pxarCore::daqStart(const int buffersize, const bool init) {
 
 bool pxarCore::daqStart(const uint16_t flags, const int buffersize, const bool init) {
 
+  checkIdle();
   if(!status()) {return false;}
   if(daqStatus()) {return false;}
 
@@ -1512,6 +1367,7 @@ bool pxarCore::daqStatus(uint8_t & perFull) {
 
 uint16_t pxarCore::daqTrigger(uint32_t nTrig, uint16_t period) {
 
+  checkIdle();
   if(!daqStatus()) { return 0; }
   uint16_t inputperiod=period;
   // Pattern Generator loop doesn't work for delay periods smaller than
@@ -1530,6 +1386,7 @@ uint16_t pxarCore::daqTrigger(uint32_t nTrig, uint16_t period) {
 
 uint16_t pxarCore::daqTriggerLoop(uint16_t period) {
 
+  checkIdle();
   if(!daqStatus()) { return 0; }
   uint16_t inputperiod=period;
   // Pattern Generator loop doesn't work for delay periods smaller than
@@ -1579,6 +1436,14 @@ std::vector<Event> pxarCore::daqGetEventBuffer() {
   return _hal->daqAllEvents();
 }
 
+void pxarCore::daqGetEventBatch(eventBatch & batch) {
+
+  // Reading out all data from the DTB and decoding it into the flat batch storage.
+  // The HAL function throws pxar::DataNoEvent if nothing to be
+  // returned
+  _hal->daqAllEvents(batch);
+}
+
 Event pxarCore::daqGetEvent() {
 
   // Return the next decoded Event from the FIFO buffer.
@@ -1599,6 +1464,7 @@ bool pxarCore::daqStop() {
 
 bool pxarCore::daqStop(const bool init) {
 
+  checkIdle();
   if(!status()) {return false;}
   if(!_daq_running) {
     LOG(logINFO) << "No DAQ running, not executing daqStop command.";
@@ -1632,6 +1498,21 @@ bool pxarCore::daqStop(const bool init) {
 }
 
 
+void pxarCore::appendEvents(std::vector<Event> & data, std::vector<Event> & buffer, size_t calls) {
+
+  // First call with data: take over the buffer and reserve for all calls of the
+  // loop assuming they return the same number of Events:
+  if(data.empty()) {
+    data.swap(buffer);
+    data.reserve(data.size()*calls);
+  }
+  // Move the Events over instead of copying their pixel vectors:
+  else {
+    data.insert(data.end(), std::make_move_iterator(buffer.begin()), std::make_move_iterator(buffer.end()));
+  }
+  buffer.clear();
+}
+
 std::vector<Event> pxarCore::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, bool efficiency, uint16_t flags) {
 
   // Ensure the pattern generator trigger is active:
@@ -1685,38 +1566,29 @@ std::vector<Event> pxarCore::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPix
       LOG(logDEBUGAPI) << "\"The Loop\" contains one call to \'multirocfn\'";
 
       // execute call to HAL layer routine
+      loopProgress(0,1);
       data = CALL_MEMBER_FN(*_hal,multirocfn)(rocs_i2c, efficiency, param);
+      loopProgress(1,1);
     } // ROCs parallel
     // Otherwise call the Pixel Parallel function several times:
     else if (multipixelfn != NULL) {
 
       // Get one of the enabled ROCs:
       std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
-      std::vector<Event> rocdata = std::vector<Event>();
       std::vector<pixelConfig> enabledPixels = _dut->getEnabledPixels(enabledRocs.front());
 
       LOG(logDEBUGAPI) << "\"The Loop\" contains "
 		       << enabledPixels.size() << " calls to \'multipixelfn\'";
+      loopProgress(0, enabledPixels.size());
 
       for (std::vector<pixelConfig>::iterator px = enabledPixels.begin(); px != enabledPixels.end(); ++px) {
 	// execute call to HAL layer routine and store data in buffer
 	std::vector<Event> buffer = CALL_MEMBER_FN(*_hal,multipixelfn)(rocs_i2c, px->column(), px->row(), efficiency, param);
+	loopProgress(static_cast<size_t>(px - enabledPixels.begin()) + 1, enabledPixels.size());
 
-	// merge pixel data into roc data storage vector
-	if (rocdata.empty()){
-	  rocdata = buffer; // for first time call
-	} else {
-	  // Add buffer vector to the end of existing Event data:
-	  rocdata.reserve(rocdata.size() + buffer.size());
-	  rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
-	}
+	// move pixel data into main data storage vector
+	appendEvents(data, buffer, enabledPixels.size());
       } // pixel loop
-	// append rocdata to main data storage vector
-      if (data.empty()) data = rocdata;
-      else {
-	data.reserve(data.size() + rocdata.size());
-	data.insert(data.end(), rocdata.begin(), rocdata.end());
-      }
     } // Pixels parallel
   } // Parallel functions
 
@@ -1732,6 +1604,7 @@ std::vector<Event> pxarCore::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPix
       std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
 
       LOG(logDEBUGAPI) << "\"The Loop\" contains " << enabledRocs.size() << " calls to \'rocfn\'";
+      loopProgress(0, enabledRocs.size());
 
       for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit) {
 
@@ -1740,12 +1613,9 @@ std::vector<Event> pxarCore::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPix
 
 	// execute call to HAL layer routine and save returned data in buffer
 	std::vector<Event> rocdata = CALL_MEMBER_FN(*_hal,rocfn)(rocit->i2c_address, efficiency, param);
-	// append rocdata to main data storage vector
-        if (data.empty()) data = rocdata;
-	else {
-	  data.reserve(data.size() + rocdata.size());
-	  data.insert(data.end(), rocdata.begin(), rocdata.end());
-	}
+	loopProgress(static_cast<size_t>(rocit - enabledRocs.begin()) + 1, enabledRocs.size());
+	// move rocdata into main data storage vector
+	appendEvents(data, rocdata, enabledRocs.size());
       } // roc loop
     }
     else if (pixelfn != NULL) {
@@ -1757,31 +1627,21 @@ std::vector<Event> pxarCore::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPix
       LOG(logDEBUGAPI) << "\"The Loop\" contains " << enabledRocs.size() << " enabled ROCs.";
 
       for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-	std::vector<Event> rocdata = std::vector<Event>();
 	std::vector<pixelConfig> enabledPixels = _dut->getEnabledPixelsI2C(rocit->i2c_address);
 
 
 	LOG(logDEBUGAPI) << "\"The Loop\" for the current ROC contains " \
 			 << enabledPixels.size() << " calls to \'pixelfn\'";
+	loopProgress(static_cast<size_t>(rocit - enabledRocs.begin())*enabledPixels.size(), enabledRocs.size()*enabledPixels.size());
 
 	for (std::vector<pixelConfig>::iterator pixit = enabledPixels.begin(); pixit != enabledPixels.end(); ++pixit) {
 	  // execute call to HAL layer routine and store data in buffer
 	  std::vector<Event> buffer = CALL_MEMBER_FN(*_hal,pixelfn)(rocit->i2c_address, pixit->column(), pixit->row(), efficiency, param);
-	  // merge pixel data into roc data storage vector
-	  if (rocdata.empty()){
-	    rocdata = buffer; // for first time call
-	  } else {
-	    // Add buffer vector to the end of existing Event data:
-	    rocdata.reserve(rocdata.size() + buffer.size());
-	    rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
-	  }
+	  loopProgress(static_cast<size_t>(rocit - enabledRocs.begin())*enabledPixels.size() + static_cast<size_t>(pixit - enabledPixels.begin()) + 1,
+		       enabledRocs.size()*enabledPixels.size());
+	  // move pixel data into main data storage vector
+	  appendEvents(data, buffer, enabledRocs.size()*enabledPixels.size());
 	} // pixel loop
-	// append rocdata to main data storage vector
-        if (data.empty()) data = rocdata;
-	else {
-	  data.reserve(data.size() + rocdata.size());
-	  data.insert(data.end(), rocdata.begin(), rocdata.end());
-	}
       } // roc loop
     }// single pixel fnc
     else {
@@ -1797,7 +1657,7 @@ std::vector<Event> pxarCore::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPix
   } // single roc fnc
 
   // check that we ended up with data, otherwise print an error:
-  if (data.empty()){ LOG(logCRITICAL) << "NO DATA FROM TEST FUNCTION -- are any TBMs/ROCs/PIXs enabled?!"; }
+  if (data.empty() && !_hal->hasEventHandler()){ LOG(logCRITICAL) << "NO DATA FROM TEST FUNCTION -- are any TBMs/ROCs/PIXs enabled?!"; }
 
   // Test is over, mask the whole device again and clear leftover calibrate signals:
   MaskAndTrim(false);
@@ -1930,11 +1790,17 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > pxarCore::repackDacScanDa
   return result;
 }
 
-std::vector<pixel> pxarCore::repackThresholdMapData (std::vector<Event> &data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags) {
+size_t pxarCore::repackThreads() {
+  // One thread per enabled ROC, limited by the number of cores:
+  size_t ncores = std::thread::hardware_concurrency();
+  size_t nrocs = _dut->getNEnabledRocs();
+  if(ncores == 0) { ncores = 1; }
+  return (nrocs < ncores ? (nrocs > 0 ? nrocs : 1) : ncores);
+}
+
+std::vector<pixel> pxarCore::repackThresholdMapData (std::vector<Event> &data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags, size_t nthreads) {
 
   std::vector<pixel> result;
-  // Vector of pixels for which a threshold has already been found
-  std::vector<pixel> found;
 
   // Threshold is the the given efficiency level "thresholdlevel"
   // Using ceiling function to take higher threshold when in doubt.
@@ -1948,80 +1814,26 @@ std::vector<pixel> pxarCore::repackThresholdMapData (std::vector<Event> &data, u
   // First, pack the data as it would be a regular Dac Scan:
   std::vector<std::pair<uint8_t,std::vector<pixel> > > packed_dac = repackDacScanData(data, dacStep, dacMin, dacMax, flags);
 
-  // Efficiency map:
-  std::map<pixel,uint8_t> oldvalue;
-
-  // Then loop over all pixels and DAC settings, start from the back if we are looking for falling edge.
+  // Then loop over all DAC settings, start from the back if we are looking for falling edge.
   // This ensures that we end up having the correct edge, even if the efficiency suddenly changes from 0 to max.
-  std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it_start;
-  std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it_end;
-  int increase_op;
-  if((flags&FLAG_RISING_EDGE) != 0) { it_start = packed_dac.begin(); it_end = packed_dac.end(); increase_op = 1; }
-  else { it_start = packed_dac.end()-1; it_end = packed_dac.begin()-1; increase_op = -1;  }
-
-  for(std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it = it_start; it != it_end; it += increase_op) {
-    // For every DAC value, loop over all pixels:
-    for(std::vector<pixel>::iterator pixit = it->second.begin(); pixit != it->second.end(); ++pixit) {
-      // Check if for this pixel a threshold has been found already and we can skip the rest:
-      std::vector<pixel>::iterator px_found = std::find_if(found.begin(),
-							   found.end(),
-							   findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
-      if(px_found != found.end()) continue;
-
-      // Check if we have that particular pixel already in the result vector:
-      std::vector<pixel>::iterator px = std::find_if(result.begin(),
-						     result.end(),
-						     findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
-
-      // Pixel is known:
-      if(px != result.end()) {
-	// Calculate efficiency deltas and slope:
-	uint8_t delta_old = abs(oldvalue[*px] - threshold);
-	uint8_t delta_new = abs(static_cast<uint8_t>(pixit->value()) - threshold);
-	bool positive_slope = (static_cast<uint8_t>(pixit->value()) - oldvalue[*px] > 0 ? true : false);
-
-	// Check which value is closer to the threshold. Only if the slope is positive AND
-	// the new delta between value and threshold is *larger* then the old delta, we
-	// found the threshold. If slope is negative, we just have a ripple in the DAC's
-	// distribution:
-	if(positive_slope && !(delta_new < delta_old)) {
-	  found.push_back(*pixit);
-	  continue;
-	}
-
-	// No threshold found yet, update the DAC threshold value for the pixel:
-	px->setValue(it->first);
-	// Update the oldvalue map:
-	oldvalue[*px] = static_cast<uint8_t>(pixit->value());
-      }
-      // Pixel is new, just adding it:
-      else {
-        // If the pixel is above threshold at first appearance, the respective
-	// DAC value is set as its threshold:
-	if(pixit->value() >= threshold) { found.push_back(*pixit); }
-
-	// Store the pixel with original efficiency
-	oldvalue.insert(std::make_pair(*pixit,pixit->value()));
-
-	// Push pixel to result vector with current DAC as value field:
-	pixit->setValue(it->first);
-	result.push_back(*pixit);
-      }
+  std::vector<thresholdScan> scan(1);
+  if((flags&FLAG_RISING_EDGE) != 0) {
+    for(std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it = packed_dac.begin(); it != packed_dac.end(); ++it) {
+      scan.front().push_back(std::make_pair(it->first, &it->second));
+    }
+  }
+  else {
+    for(std::vector<std::pair<uint8_t,std::vector<pixel> > >::reverse_iterator it = packed_dac.rbegin(); it != packed_dac.rend(); ++it) {
+      scan.front().push_back(std::make_pair(it->first, &it->second));
     }
   }
 
-  // Check for pixels that have not reached the threshold at all:
-  for(std::vector<pixel>::iterator px = result.begin(); px != result.end(); ++px) {
-    std::vector<pixel>::iterator px_found = std::find_if(found.begin(),
-							 found.end(),
-							 findPixelXY(px->column(), px->row(), px->roc()));
-    // The pixel is in the "found" vector, which means it crossed threshold at some point:
-    if(px_found != found.end()) continue;
-
-    // The pixel is not in and never reached the threshold. We set the return value to
-    // "dacMax" (rising edge) or "dacMin" (falling edge):
-    if((flags&FLAG_RISING_EDGE) != 0) { px->setValue(dacMax); }
-    else { px->setValue(dacMin); }
+  // The pixels of different ROCs are independent, extract the thresholds ROC-parallel.
+  // Pixels that have not reached the threshold at all get "dacMax" (rising edge) or "dacMin" (falling edge):
+  std::vector<std::vector<pixel> > results, missing;
+  thresholdFinder::Find(scan, threshold, ((flags&FLAG_RISING_EDGE) != 0 ? dacMax : dacMin), nthreads, results, missing);
+  result.swap(results.front());
+  for(std::vector<pixel>::iterator px = missing.front().begin(); px != missing.front().end(); ++px) {
     LOG(logWARNING) << "No threshold found for " << (*px);
   }
 
@@ -2033,11 +1845,9 @@ std::vector<pixel> pxarCore::repackThresholdMapData (std::vector<Event> &data, u
   return result;
 }
 
-std::vector<std::pair<uint8_t,std::vector<pixel> > > pxarCore::repackThresholdDacScanData (std::vector<Event> &data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags) {
+std::vector<std::pair<uint8_t,std::vector<pixel> > > pxarCore::repackThresholdDacScanData (std::vector<Event> &data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags, size_t nthreads) {
 
   std::vector<std::pair<uint8_t,std::vector<pixel> > > result;
-  // Map of pixels with already assigned threshold (key is the dac2 value):
-  std::map<uint8_t,std::vector<pixel> > found;
 
   // Threshold is the the given efficiency level "thresholdlevel":
   // Using ceiling function to take higher threshold when in doubt.
@@ -2050,98 +1860,46 @@ std::vector<std::pair<uint8_t,std::vector<pixel> > > pxarCore::repackThresholdDa
 
   // First, pack the data as it would be a regular DacDac Scan:
   std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > > packed_dacdac = repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags);
-
-  // Efficiency map:
-  std::map<uint8_t,std::map<pixel,uint8_t> > oldvalue;
-
-  // Then loop over all pixels and DAC settings, start from the back if we are looking for falling edge.
-  // This ensures that we end up having the correct edge, even if the efficiency suddenly changes from 0 to max.
-  std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > >::iterator it_start;
-  std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > >::iterator it_end;
-  int increase_op;
-  if((flags&FLAG_RISING_EDGE) != 0) { it_start = packed_dacdac.begin(); it_end = packed_dacdac.end(); increase_op = 1; }
-  else { it_start = packed_dacdac.end()-1; it_end = packed_dacdac.begin()-1; increase_op = -1;  }
-
-  for(std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > >::iterator it = it_start; it != it_end; it += increase_op) {
-
-    // For every DAC/DAC entry, loop over all pixels:
-    for(std::vector<pixel>::iterator pixit = it->second.second.begin(); pixit != it->second.second.end(); ++pixit) {
-
-      // Find the current DAC2 value in the result vector (simple replace for find_if):
-      std::vector<std::pair<uint8_t, std::vector<pixel> > >::iterator dac;
-      for(dac = result.begin(); dac != result.end(); ++dac) { if(it->second.first == dac->first) break; }
-
-      // Didn't find the DAC2 value:
-      if(dac == result.end()) {
-	result.push_back(std::make_pair(it->second.first,std::vector<pixel>()));
-	dac = result.end() - 1;
-	// Also add an entry for bookkeeping:
-	found.insert(std::make_pair(it->second.first,std::vector<pixel>()));
-	oldvalue.insert(std::make_pair(it->second.first,std::map<pixel,uint8_t>()));
-      }
-
-      // Check if for this pixel a threshold has been found already and we can skip the rest:
-      std::vector<pixel>::iterator px_found = std::find_if(found[dac->first].begin(),
-							   found[dac->first].end(),
-							   findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
-      if(px_found != found[dac->first].end()) continue;
-
-      // Check if we have that particular pixel already in:
-      std::vector<pixel>::iterator px = std::find_if(dac->second.begin(),
-						     dac->second.end(),
-						     findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
-
-      // Pixel is known:
-      if(px != dac->second.end()) {
-	// Calculate efficiency deltas and slope:
-	uint8_t delta_old = abs(oldvalue[dac->first][*px] - threshold);
-	uint8_t delta_new = abs(static_cast<uint8_t>(pixit->value()) - threshold);
-	bool positive_slope = (static_cast<uint8_t>(pixit->value()) - oldvalue[dac->first][*px] > 0 ? true : false);
-
-        // Check which value is closer to the threshold. Only if the slope is positive AND
-	// the new delta between value and threshold is *larger* then the old delta, we
-	// found the threshold. If slope is negative, we just have a ripple in the DAC's
-	// distribution:
-	if(positive_slope && !(delta_new < delta_old)) {
-	  found[dac->first].push_back(*pixit);
-	  continue;
-	}
-
-        // No threshold found yet, update the DAC threshold value for the pixel:
-	px->setValue(it->first);
-	// Update the oldvalue map:
-	oldvalue[dac->first][*px] = static_cast<uint8_t>(pixit->value());
-      }
-      // Pixel is new, just adding it:
-      else {
-        // If the pixel is above threshold at first appearance, the respective
-	// DAC value is set as its threshold:
-	if(pixit->value() >= threshold) { found[dac->first].push_back(*pixit); }
-
-	// Store the pixel with original efficiency
-	oldvalue[dac->first].insert(std::make_pair(*pixit,pixit->value()));
-	// Push pixel to result vector with current DAC as value field:
-	pixit->setValue(it->first);
-	dac->second.push_back(*pixit);
+  if(packed_dacdac.empty()) { return result; }
+
+  // The packed data runs over DAC1 in the outer and DAC2 in the inner loop. Thresholds
+  // are independent for every DAC2 value, so scan along DAC1 for one DAC2 value after
+  // the other, from the back if we are looking for falling edge. This ensures that we
+  // end up having the correct edge, even if the efficiency suddenly changes from 0 to max.
+  bool rising = ((flags&FLAG_RISING_EDGE) != 0);
+  size_t ndac1 = static_cast<size_t>((dac1max-dac1min)/dac1step+1);
+  size_t ndac2 = static_cast<size_t>((dac2max-dac2min)/dac2step+1);
+
+  // Remember where each DAC2 value was seen first in scan direction, to keep the order of the result:
+  std::vector<std::pair<size_t, size_t> > order;
+  std::vector<thresholdScan> scans(ndac2);
+
+  for(size_t dac2 = 0; dac2 < ndac2; dac2++) {
+    size_t first = packed_dacdac.size();
+    for(size_t step = 0; step < ndac1; step++) {
+      size_t entry = (rising ? step : ndac1 - 1 - step)*ndac2 + dac2;
+      if(first == packed_dacdac.size() && !packed_dacdac.at(entry).second.second.empty()) {
+	first = rising ? entry : packed_dacdac.size() - 1 - entry;
       }
+      scans.at(dac2).push_back(std::make_pair(packed_dacdac.at(entry).first, &packed_dacdac.at(entry).second.second));
     }
-  }
-
-  // Check for pixels that have not reached the threshold at all:
-  for(std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator dac = result.begin(); dac != result.end(); ++dac) {
-
-    for(std::vector<pixel>::iterator px = dac->second.begin(); px != dac->second.end(); px++) {
-      std::vector<pixel>::iterator px_found = std::find_if(found[dac->first].begin(),
-							   found[dac->first].end(),
-							   findPixelXY(px->column(), px->row(), px->roc()));
-      // The pixel is in the "found" vector, which means it crossed threshold at some point:
-      if(px_found != found[dac->first].end()) continue;
-
-      // The pixel is not in and never reached the threshold. We set the return value to
-      // "dacMax" (rising edge) or "dacMin" (falling edge):
-      if((flags&FLAG_RISING_EDGE) != 0) { px->setValue(dac2max); }
-      else { px->setValue(dac2min); }
-      LOG(logWARNING) << "No threshold found for " << (*px) << " at DAC value " << static_cast<int>(dac->first);
+    // Only DAC2 values with pixels seen are returned:
+    if(first != packed_dacdac.size()) { order.push_back(std::make_pair(first, dac2)); }
+  }
+
+  // The pixels of different ROCs are independent, extract the thresholds ROC-parallel.
+  // Pixels that have not reached the threshold at all get "dac2max" (rising edge) or "dac2min" (falling edge):
+  std::vector<std::vector<pixel> > results, missing;
+  thresholdFinder::Find(scans, threshold, (rising ? dac2max : dac2min), nthreads, results, missing);
+
+  std::sort(order.begin(), order.end());
+  result.reserve(order.size());
+  for(std::vector<std::pair<size_t, size_t> >::iterator it = order.begin(); it != order.end(); ++it) {
+    result.push_back(std::pair<uint8_t,std::vector<pixel> >());
+    result.back().first = static_cast<uint8_t>(dac2min + it->second*dac2step);
+    result.back().second.swap(results.at(it->second));
+    for(std::vector<pixel>::iterator px = missing.at(it->second).begin(); px != missing.at(it->second).end(); ++px) {
+      LOG(logWARNING) << "No threshold found for " << (*px) << " at DAC value " << static_cast<int>(result.back().first);
     }
   }
 
@@ -2206,15 +1964,364 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > pxar
   return result;
 }
 
+bool pxarCore::setupMapScan(uint16_t flags, uint16_t nTriggers, bool efficiency, scanSetup & setup) {
+
+  if(!status()) {return false;}
+
+  // Setup the correct _hal calls for this test
+  setup.pixelfn      = &hal::SingleRocOnePixelCalibrate;
+  setup.multipixelfn = &hal::MultiRocOnePixelCalibrate;
+  setup.rocfn        = &hal::SingleRocAllPixelsCalibrate;
+  setup.multirocfn   = &hal::MultiRocAllPixelsCalibrate;
+
+  // Load the test parameters into vector
+  setup.param.push_back(static_cast<int32_t>(flags));
+  setup.param.push_back(static_cast<int32_t>(nTriggers));
+
+  setup.efficiency = efficiency;
+  setup.flags = flags;
+  return true;
+}
+
+bool pxarCore::setupDacScan(std::string dacName, uint8_t dacStep, uint8_t & dacMin, uint8_t & dacMax, uint16_t flags, uint16_t nTriggers, bool efficiency, scanSetup & setup) {
+
+  if(!status()) {return false;}
+
+  // Check DAC range
+  if(dacMin > dacMax) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dacMin;
+    dacMin = dacMax;
+    dacMax = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dacRegister;
+  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+    return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  setup.pixelfn      = &hal::SingleRocOnePixelDacScan;
+  setup.multipixelfn = &hal::MultiRocOnePixelDacScan;
+  setup.rocfn        = &hal::SingleRocAllPixelsDacScan;
+  setup.multirocfn   = &hal::MultiRocAllPixelsDacScan;
+
+  // Load the test parameters into vector
+  setup.param.push_back(static_cast<int32_t>(dacRegister));
+  setup.param.push_back(static_cast<int32_t>(dacMin));
+  setup.param.push_back(static_cast<int32_t>(dacMax));
+  setup.param.push_back(static_cast<int32_t>(flags));
+  setup.param.push_back(static_cast<int32_t>(nTriggers));
+  setup.param.push_back(static_cast<int32_t>(dacStep));
+
+  setup.efficiency = efficiency;
+  setup.flags = flags;
+
+  // Reset the original value for the scanned DAC afterwards:
+  setup.resetDacs.push_back(std::make_pair(dacName, dacRegister));
+  return true;
+}
+
+bool pxarCore::setupDacDacScan(std::string dac1name, uint8_t dac1step, uint8_t & dac1min, uint8_t & dac1max, std::string dac2name, uint8_t dac2step, uint8_t & dac2min, uint8_t & dac2max, uint16_t flags, uint16_t nTriggers, bool efficiency, scanSetup & setup) {
+
+  if(!status()) {return false;}
+
+  // Check DAC ranges
+  if(dac1min > dac1max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac1min;
+    dac1min = dac1max;
+    dac1max = temp;
+  }
+  if(dac2min > dac2max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac2min;
+    dac2min = dac2max;
+    dac2max = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dac1register, dac2register;
+  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
+    return false;
+  }
+  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+    return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  setup.pixelfn      = &hal::SingleRocOnePixelDacDacScan;
+  setup.multipixelfn = &hal::MultiRocOnePixelDacDacScan;
+  setup.rocfn        = &hal::SingleRocAllPixelsDacDacScan;
+  setup.multirocfn   = &hal::MultiRocAllPixelsDacDacScan;
+
+  // Load the test parameters into vector
+  setup.param.push_back(static_cast<int32_t>(dac1register));
+  setup.param.push_back(static_cast<int32_t>(dac1min));
+  setup.param.push_back(static_cast<int32_t>(dac1max));
+  setup.param.push_back(static_cast<int32_t>(dac2register));
+  setup.param.push_back(static_cast<int32_t>(dac2min));
+  setup.param.push_back(static_cast<int32_t>(dac2max));
+  setup.param.push_back(static_cast<int32_t>(flags));
+  setup.param.push_back(static_cast<int32_t>(nTriggers));
+  setup.param.push_back(static_cast<int32_t>(dac1step));
+  setup.param.push_back(static_cast<int32_t>(dac2step));
+
+  setup.efficiency = efficiency;
+  setup.flags = flags;
+
+  // Reset the original values for the scanned DACs afterwards:
+  setup.resetDacs.push_back(std::make_pair(dac1name, dac1register));
+  setup.resetDacs.push_back(std::make_pair(dac2name, dac2register));
+  return true;
+}
+
+bool pxarCore::setupThresholdMap(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers, scanSetup & setup) {
+
+  if(!status()) {return false;}
+
+  // Scan the maximum DAC range for threshold:
+  uint8_t dacRegister;
+  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+    return false;
+  }
+
+  // Check the threshold percentage level provided:
+  if(threshold == 0 || threshold > 100) {
+    LOG(logCRITICAL) << "Threshold level of " << static_cast<int>(threshold) << "% is not possible!";
+    return false;
+  }
+
+  // Setup the correct _hal calls for this test, a threshold map is a 1D dac scan:
+  setup.pixelfn      = &hal::SingleRocOnePixelDacScan;
+  setup.multipixelfn = &hal::MultiRocOnePixelDacScan;
+  setup.rocfn        = &hal::SingleRocAllPixelsDacScan;
+  setup.multirocfn   = &hal::MultiRocAllPixelsDacScan;
+
+  // Load the test parameters into vector
+  setup.param.push_back(static_cast<int32_t>(dacRegister));
+  setup.param.push_back(static_cast<int32_t>(dacMin));
+  setup.param.push_back(static_cast<int32_t>(dacMax));
+  setup.param.push_back(static_cast<int32_t>(flags));
+  setup.param.push_back(static_cast<int32_t>(nTriggers));
+  setup.param.push_back(static_cast<int32_t>(dacStep));
+
+  setup.efficiency = true;
+  setup.flags = flags;
+  return true;
+}
+
+bool pxarCore::setupThresholdVsDAC(std::string dac1name, uint8_t dac1step, uint8_t & dac1min, uint8_t & dac1max, std::string dac2name, uint8_t dac2step, uint8_t & dac2min, uint8_t & dac2max, uint8_t threshold, uint16_t flags, uint16_t nTriggers, scanSetup & setup) {
+
+  if(!status()) {return false;}
+
+  // Check DAC ranges
+  if(dac1min > dac1max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac1min;
+    dac1min = dac1max;
+    dac1max = temp;
+  }
+  if(dac2min > dac2max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac2min;
+    dac2min = dac2max;
+    dac2max = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dac1register, dac2register;
+  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
+    return false;
+  }
+  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+    return false;
+  }
+
+  // Check the threshold percentage level provided:
+  if(threshold == 0 || threshold > 100) {
+    LOG(logCRITICAL) << "Threshold level of " << static_cast<int>(threshold) << "% is not possible!";
+    return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  setup.pixelfn      = &hal::SingleRocOnePixelDacDacScan;
+  setup.multipixelfn = &hal::MultiRocOnePixelDacDacScan;
+  // In Principle these functions exist, but they would take years to run and fill up the buffer
+  setup.rocfn        = NULL; // &hal::SingleRocAllPixelsDacDacScan;
+  setup.multirocfn   = NULL; // &hal::MultiRocAllPixelsDacDacScan;
+
+  // Load the test parameters into vector
+  setup.param.push_back(static_cast<int32_t>(dac1register));
+  setup.param.push_back(static_cast<int32_t>(dac1min));
+  setup.param.push_back(static_cast<int32_t>(dac1max));
+  setup.param.push_back(static_cast<int32_t>(dac2register));
+  setup.param.push_back(static_cast<int32_t>(dac2min));
+  setup.param.push_back(static_cast<int32_t>(dac2max));
+  setup.param.push_back(static_cast<int32_t>(flags));
+  setup.param.push_back(static_cast<int32_t>(nTriggers));
+  setup.param.push_back(static_cast<int32_t>(dac1step));
+  setup.param.push_back(static_cast<int32_t>(dac2step));
+
+  setup.efficiency = true;
+  setup.flags = flags;
+
+  // Reset the original values for the scanned DACs afterwards:
+  setup.resetDacs.push_back(std::make_pair(dac1name, dac1register));
+  setup.resetDacs.push_back(std::make_pair(dac2name, dac2register));
+  return true;
+}
+
+std::vector<Event> pxarCore::runScan(scanSetup & setup) {
+
+  checkIdle();
+  std::vector<Event> data;
+
+  // Follow the readout of the HAL calls if someone is interested in the progress:
+  _loopCall = _loopCalls = _loopEvents = _callEvents = _callExpected = 0;
+  if(_monitor != NULL || _asyncScan != NULL) {
+    _hal->setProgressHandler([this](size_t events, size_t expected) { scanProgress(events, expected); });
+  }
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  try { data = expandLoop(setup.pixelfn, setup.multipixelfn, setup.rocfn, setup.multirocfn, setup.param, setup.efficiency, setup.flags); }
+  catch(ScanCancelled &) {
+    _hal->setProgressHandler(nullptr);
+    // Leave the DUT as a finished test would:
+    MaskAndTrim(false);
+    SetCalibrateBits(false);
+    resetScanDacs(setup);
+    throw;
+  }
+  catch(...) {
+    _hal->setProgressHandler(nullptr);
+    throw;
+  }
+  _hal->setProgressHandler(nullptr);
+
+  resetScanDacs(setup);
+  return data;
+}
+
+void pxarCore::resetScanDacs(scanSetup & setup) {
+
+  // Reset the original value for the scanned DACs:
+  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
+  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+    for(std::vector<std::pair<std::string, uint8_t> >::iterator dac = setup.resetDacs.begin(); dac != setup.resetDacs.end(); ++dac) {
+      uint8_t oldDacValue = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac->first);
+      LOG(logDEBUGAPI) << "Reset DAC \"" << dac->first << "\" to original value " << static_cast<int>(oldDacValue);
+      _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac->second,oldDacValue,false);
+    }
+  }
+  _hal->flushRegisters();
+}
+
+void pxarCore::streamDacDacScan(scanSetup & setup, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, dacDacVisitor & visitor) {
+
+  // Stream the condensed Events to the visitor as they are read out. The DAC values
+  // cycle in the same order as in repackDacDacScanData, potentially several rounds:
+  size_t current1dac = dac1min;
+  size_t current2dac = dac2min;
+  size_t nslices = 0;
+  _hal->setEventHandler([&](std::vector<Event> & events) {
+      for(std::vector<Event>::iterator Eventit = events.begin(); Eventit != events.end(); ++Eventit) {
+	if(current2dac > dac2max) {
+	  current2dac = dac2min;
+	  current1dac += dac1step;
+	}
+	if(current1dac > dac1max) { current1dac = dac1min; }
+	visitor.processSlice(static_cast<uint8_t>(current1dac), static_cast<uint8_t>(current2dac), Eventit->pixels);
+	current2dac += dac2step;
+	nslices++;
+      }
+    });
+
+  try { runScan(setup); }
+  catch(...) {
+    _hal->setEventHandler(nullptr);
+    throw;
+  }
+  _hal->setEventHandler(nullptr);
+
+  if(nslices % static_cast<size_t>(((dac1max-dac1min)/dac1step+1)*((dac2max-dac2min)/dac2step+1)) != 0) {
+    LOG(logCRITICAL) << "Data size not as expected! " << nslices << " slices do not fit to " << static_cast<int>(((dac1max-dac1min)/dac1step+1)*((dac2max-dac2min)/dac2step+1)) << " DAC values!";
+  }
+  LOG(logDEBUGAPI) << "Streamed " << nslices << " DacDacScan slices.";
+}
+
+void pxarCore::loopProgress(size_t done, size_t total) {
+
+  // Only monitored or asynchronous scans report progress and can be cancelled:
+  if(_monitor == NULL && _asyncScan == NULL) { return; }
+
+  // The events of the HAL calls done so far are complete:
+  _loopEvents += _callEvents;
+  _callEvents = 0;
+  _loopCall = done;
+  _loopCalls = total;
+  reportProgress();
+}
+
+void pxarCore::scanProgress(size_t events, size_t expected) {
+
+  _callEvents = events;
+  _callExpected = expected;
+  reportProgress();
+}
+
+void pxarCore::reportProgress() {
+
+  // Extrapolate the events expected in the current HAL call to the ones not done yet:
+  size_t read = _loopEvents + _callEvents;
+  size_t expected = _loopEvents + _callExpected*(_loopCalls > _loopCall ? _loopCalls - _loopCall : 0);
+  if(expected < read) { expected = read; }
+
+  if(_monitor != NULL) { _monitor->progress(read, expected); }
+  if(_asyncScan != NULL) { _asyncScan->progress = (expected > 0 ? static_cast<double>(read)/expected : 0.0); }
+
+  if((_monitor != NULL && _monitor->cancelled()) || (_asyncScan != NULL && _asyncScan->cancelled)) {
+    throw ScanCancelled("Scan cancelled by user.");
+  }
+}
+
+void pxarCore::submitScan(asyncScan * scan) {
+
+  // Start the worker threads with the first asynchronous scan:
+  if(_async == NULL) { _async = new asyncWorker(this); }
+  _async->Submit(scan);
+}
+
+void pxarCore::checkIdle() {
+  if(_async != NULL && _async->Busy()) {
+    LOG(logERROR) << "Testboard in use by asynchronous scans!";
+    throw TestboardBusy("Testboard in use by asynchronous scans, wait for them to be measured first.");
+  }
+}
+
 // Update mask and trim bits for the full DUT in NIOS structs:
 void pxarCore::MaskAndTrimNIOS() {
 
-  // First transmit all configured I2C addresses:
-  _hal->SetupI2CValues(_dut->getRocI2Caddr());
+  // First transmit all configured I2C addresses, if the NIOS had to learn them the
+  // trim values are sent again as well:
+  if(_hal->SetupI2CValues(_dut->getRocI2Caddr())) { _dut->trim_changed.clear(); }
 
-  // Now run over all existing ROCs and transmit the pixel trim/mask data:
+  // Now run over all existing ROCs and transmit the pixel trim/mask data of the ones
+  // changed since the last upload:
   for (std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); rocit != _dut->roc.end(); ++rocit) {
+    size_t rocid = static_cast<size_t>(rocit - _dut->roc.begin());
+    if(!_dut->getTrimChanged(rocid)) {
+      LOG(logDEBUGAPI) << "NIOS trim values of ROC@I2C " << static_cast<int>(rocit->i2c_address) << " are up to date.";
+      continue;
+    }
     _hal->SetupTrimValues(rocit->i2c_address,rocit->pixels);
+    _dut->setTrimChanged(rocid,false);
   }
 }
 
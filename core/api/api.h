@@ -26,6 +26,9 @@ typedef unsigned char uint8_t;
 #include <string>
 #include <vector>
 #include <map>
+#ifndef __CINT__
+#include <atomic>
+#endif
 #include "datatypes.h"
 #include "exceptions.h"
 #include "dut.h"
@@ -101,6 +104,17 @@ typedef unsigned char uint8_t;
  */
 #define FLAG_ENABLE_XORSUM_LOGGING 0x1000
 
+/** Flag to decode the data of the individual DAQ channels in parallel, one thread per
+ *  channel. The decoded events are merged by trigger afterwards. Only effective for
+ *  setups with more than one DAQ channel (i.e. modules).
+ */
+#define FLAG_PARALLEL_DECODING 0x2000
+
+/** Flag to read the DTB data ahead in a separate thread per DAQ channel while the previous
+ *  blocks are being decoded, overlapping the USB transfers with the decoding.
+ */
+#define FLAG_PREFETCH_DATA 0x4000
+
 
 /** Define a macro for calls to member functions through pointers
  *  to member functions (used in the loop expansion routines).
@@ -129,6 +143,127 @@ namespace pxar {
   typedef  std::vector<Event> (hal::*HalMemFnPixelSerial)(uint8_t rocid, uint8_t column, uint8_t row, bool efficiency, std::vector<int32_t> parameter);
 
 
+  /** Receiver for the streaming DAC-DAC scan functions of pxar::pxarCore
+   *
+   *  Instead of returning the full result of a DAC-DAC scan at the end, the
+   *  streaming variants of getPulseheightVsDACDAC and getEfficiencyVsDACDAC
+   *  hand every (DAC1, DAC2) slice to the visitor as soon as it has been read
+   *  back from the testboard, so only one readout chunk is held in memory.
+   *
+   *  The testboard loops over the pixels outermost, so a slice holds the
+   *  pixels of one pixel round (or ROC, in serial mode) and the same DAC pair
+   *  is visited once per round. Implementations have to accumulate over rounds
+   *  themselves if needed. The pixel vector may be modified or swapped out.
+   */
+  class DLLEXPORT dacDacVisitor {
+  public:
+    virtual ~dacDacVisitor() {}
+    virtual void processSlice(uint8_t dac1, uint8_t dac2, std::vector<pixel> & pixels) = 0;
+  };
+
+
+  /** Progress receiver and cancellation token for the test functions of pxar::pxarCore
+   *
+   *  Attached with pxarCore::setScanMonitor(), progress() is called after every
+   *  readout of the testboard during a test, from the thread running the test. The
+   *  number of expected events is estimated from the first trigger loop of the test.
+   *
+   *  cancel() may be called from any thread, also from within progress(). The running
+   *  test is then stopped at the next readout and throws pxar::ScanCancelled, leaving
+   *  the DUT masked and its DACs at their configured values. The token stays set
+   *  until reset() is called.
+   */
+  class DLLEXPORT scanMonitor {
+  public:
+    scanMonitor() : _cancelled(false) {}
+    virtual ~scanMonitor() {}
+
+    /** Called with the number of events read and expected for the running test
+     */
+    virtual void progress(size_t /*eventsRead*/, size_t /*eventsExpected*/) {}
+
+    /** Request cancellation of the running and all following tests
+     */
+    void cancel() { _cancelled = true; }
+    bool cancelled() const { return _cancelled; }
+    void reset() { _cancelled = false; }
+
+  private:
+#ifndef __CINT__
+    std::atomic<bool> _cancelled;
+#else
+    bool _cancelled;
+#endif
+  };
+
+
+  /** Forward declarations of the bookkeeping for asynchronous scans, implementation
+   *  in asyncscan.cc
+   */
+  class asyncScan;
+  class asyncWorker;
+  struct scanSetup;
+
+
+  /** Handle to a scan running in the background, returned by the asynchronous
+   *  test functions of pxar::pxarCore (e.g. pxarCore::getEfficiencyMapAsync)
+   *
+   *  The trigger loops and readout of all asynchronous scans are executed one after
+   *  the other on a measurement thread, the repacking of the data into the result
+   *  format on a separate thread. Thus the next scan can already run on the testboard
+   *  while the previous one is being repacked.
+   *
+   *  Handles can be copied freely, all copies refer to the same scan. Exceptions
+   *  thrown during the scan (e.g. pxar::DataMissingEvent) are rethrown by get().
+   */
+  template<typename T> class DLLEXPORT scanFuture {
+  public:
+    /** Default constructor, the handle does not refer to any scan
+     */
+    scanFuture();
+    scanFuture(const scanFuture & other);
+    scanFuture & operator=(const scanFuture & other);
+    ~scanFuture();
+
+    /** True if the handle refers to a scan
+     */
+    bool valid() const;
+
+    /** True if the scan has finished and its result is available
+     */
+    bool ready() const;
+
+    /** Wait for the scan to finish
+     */
+    void wait() const;
+
+    /** Wait for the trigger loops and readout of the scan to finish. The testboard
+     *  may be used again afterwards, while the result is still being repacked.
+     */
+    void waitMeasured() const;
+
+    /** Wait for the scan to finish and return its result. Exceptions thrown during
+     *  the scan are rethrown here, a cancelled scan throws pxar::ScanCancelled.
+     */
+    T get() const;
+
+    /** Progress of the scan between 0 and 1, as fraction of the events expected
+     */
+    double progress() const;
+
+    /** Request cancellation of the scan. A scan which has not been started is dropped,
+     *  a running scan is stopped at the next readout of the testboard and the
+     *  device is masked and its DACs reset.
+     */
+    void cancel();
+
+  private:
+    friend class pxarCore;
+    scanFuture(asyncScan * scan);
+    asyncScan * _scan;
+  };
+
+
 
   /** pxar API class definition
    *
@@ -368,6 +503,13 @@ namespace pxar {
      */
     void Poff();
 
+    /** Forget which DAC and TBM register values and which mask and trim bits
+     *  have been uploaded to the DTB and the DUT. Unchanged values are not sent
+     *  again, call this after the DTB or the DUT have been reset or power cycled
+     *  from outside pxar.
+     */
+    void invalidateCache();
+
      /** Selects "signal" as output for the DTB probe channel "probe"
       *  (digital or analog). Valid probe values are the names written
       *  on the case of the DTB, next to the respective outputs.
@@ -584,6 +726,21 @@ namespace pxar {
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
 
 
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the
+     *  pulse height, streaming the results
+     *
+     *  Same as above, but instead of returning all data at the end, every
+     *  (DAC1, DAC2) slice of pxar::pixel is passed to the pxar::dacDacVisitor
+     *  as soon as it has been read out, keeping the memory use bounded by one
+     *  readout chunk. Returns false if the scan could not be set up.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown
+     *  after the slices read until then have been delivered.
+     *
+     */
+    bool getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers, dacDacVisitor & visitor);
+
+
     /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the efficiency
      *
      *  Returns a vector containing pairs of DAC1 values and pais of DAC2
@@ -611,6 +768,20 @@ namespace pxar {
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
 
 
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the efficiency,
+     *  streaming the results
+     *
+     *  Same as above, but every (DAC1, DAC2) slice of pxar::pixel is passed to
+     *  the pxar::dacDacVisitor as soon as it has been read out. Returns false if
+     *  the scan could not be set up.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown
+     *  after the slices read until then have been delivered.
+     *
+     */
+    bool getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers, dacDacVisitor & visitor);
+
+
     /** Method to get a map of the pulse height
      *
      *  Returns a vector of pixels, with the value of the pxar::pixel struct being
@@ -682,6 +853,43 @@ namespace pxar {
      */
     std::vector<pixel> getThresholdMap(std::string dacName, uint16_t flags, uint16_t nTriggers);
 
+
+    // Asynchronous test functions
+
+    /** The following methods run the same tests as their synchronous counterparts
+     *  but return immediately with a pxar::scanFuture handle to the result. The
+     *  parameters are checked right away, if they are invalid an already finished
+     *  handle with an empty result is returned.
+     *
+     *  Scans are executed in the order they have been requested. While scans are
+     *  queued or running on the measurement thread, no other functions accessing the
+     *  testboard or changing the DUT configuration must be called: the synchronous
+     *  tests, the DAQ functions, setDAC(), setTbmReg() and setScanMonitor() throw
+     *  pxar::TestboardBusy meanwhile. Use scanFuture::waitMeasured() to wait for
+     *  the testboard to become available again.
+     */
+    scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > > getPulseheightVsDACAsync(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > > getEfficiencyVsDACAsync(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > > getThresholdVsDACAsync(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t threshold, uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > > getPulseheightVsDACDACAsync(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > > getEfficiencyVsDACDACAsync(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector<pixel> > getPulseheightMapAsync(uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector<pixel> > getEfficiencyMapAsync(uint16_t flags, uint16_t nTriggers);
+
+    scanFuture<std::vector<pixel> > getThresholdMapAsync(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers);
+
+    /** Attach a pxar::scanMonitor to report the progress of all following tests and
+     *  to allow cancelling them. The monitor is not owned by the API, NULL detaches it.
+     *  Throws pxar::TestboardBusy while asynchronous scans are queued or running.
+     */
+    void setScanMonitor(scanMonitor * monitor);
+
     /** Enable or disable the external clock source of the DTB.
      *  This function will return "false" if no external clock is present,
      *  clock is then left on internal.
@@ -844,6 +1052,21 @@ namespace pxar {
      */
     std::vector<Event> daqGetEventBuffer();
 
+    /** Function to read the full currently available pxar::Event buffer from the
+     *  testboard RAM into a flat pxar::eventBatch. The data is decoded exactly as
+     *  for pxarCore::daqGetEventBuffer() but all pixel hits, TBM headers and
+     *  trailers are stored in contiguous column arrays with per-event offsets.
+     *  The batch is cleared before filling, its memory is kept and reused, so
+     *  polling with the same batch object does not cause per-event allocations.
+     *
+     *  This function can throw a pxar::DataDecodingError exception in case severe
+     *  problems were encountered during the readout.
+     *
+     *  If no events are available the function will throw a pxar::DataNoEvent
+     *  exception. Catching this allows constant polling for new events.
+     */
+    void daqGetEventBatch(eventBatch & batch);
+
     /** Function to return the full currently available ROC slow readback value
      *  buffer. The data is stored until a new DAQ session or test is called and
      *  can be fetched once (deleted at read time). The return vector contains
@@ -885,6 +1108,21 @@ namespace pxar {
      */
     statistics getStatistics();
 
+    /** Function that returns a class object of the type pxar::registerStatistics
+     *  with the number of DAC, TBM register and mask/trim writes requested since
+     *  the last call, and how many of them have been dropped because the
+     *  devices already held the values. Like getStatistics() the counters are
+     *  reset when they are fetched.
+     */
+    registerStatistics getRegisterStatistics();
+
+    /** Function that returns a class object of the type pxar::rpcStatistics
+     *  with the number of calls, bytes sent and received and the latencies
+     *  of every RPC call made to the DTB since the last call. Like
+     *  getStatistics() the counters are reset when they are fetched.
+     */
+    rpcStatistics getRpcStatistics();
+
     /** DUT object for book keeping of settings
      */
     dut * _dut;
@@ -919,6 +1157,12 @@ namespace pxar {
      */
     std::vector<Event> expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, bool efficiency, uint16_t flags = 0);
 
+    /** Helper function moving the Events returned by one HAL call of the loop
+     *  expansion to the end of "data", leaving "buffer" empty. Space for all
+     *  "calls" of the loop is reserved with the first data.
+     */
+    void appendEvents(std::vector<Event> & data, std::vector<Event> & buffer, size_t calls);
+
 
     /** Repacks map data from (possibly) several ROCs into one long vector
      *  of pixels.
@@ -926,10 +1170,16 @@ namespace pxar {
     std::vector<pixel> repackMapData (std::vector<Event> &data, uint16_t flags);
 
     /** Repacks map data from (possibly) several ROCs into one long vector
-     *  of pixels and returns the threshold value.
+     *  of pixels and returns the threshold value, extracted in "nthreads" threads.
      */
-    std::vector<pixel> repackThresholdMapData (std::vector<Event> &data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags);
+    std::vector<pixel> repackThresholdMapData (std::vector<Event> &data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags, size_t nthreads);
+
 
+    /** Number of threads to use for the threshold extraction in the repack functions.
+     *  Reads the DUT, so it has to be called when the scan is set up and not by the
+     *  repacking of asynchronous scans.
+     */
+    size_t repackThreads();
 
     /** Repacks DAC scan data into pairs of DAC values with fired pxar::pixel vectors.
      */
@@ -938,7 +1188,7 @@ namespace pxar {
 
     /** Repacks DAC scan data into pairs of DAC values with fired pxar::pixel vectors and return the threshold value.
      */
-    std::vector<std::pair<uint8_t,std::vector<pixel> > > repackThresholdDacScanData (std::vector<Event> &data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags);
+    std::vector<std::pair<uint8_t,std::vector<pixel> > > repackThresholdDacScanData (std::vector<Event> &data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags, size_t nthreads);
 
 
     /** repacks (2D) DAC-DAC scan data into pairs of DAC values with
@@ -947,6 +1197,78 @@ namespace pxar {
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > repackDacDacScanData (std::vector<Event> &data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags);
 
 
+    /** Helper functions checking the parameters of a test and preparing the HAL
+     *  calls for its execution. The DAC ranges are sorted in place. They return
+     *  false if the test cannot be run with the parameters given.
+     */
+    bool setupMapScan(uint16_t flags, uint16_t nTriggers, bool efficiency, scanSetup & setup);
+    bool setupDacScan(std::string dacName, uint8_t dacStep, uint8_t & dacMin, uint8_t & dacMax, uint16_t flags, uint16_t nTriggers, bool efficiency, scanSetup & setup);
+    bool setupDacDacScan(std::string dac1name, uint8_t dac1step, uint8_t & dac1min, uint8_t & dac1max, std::string dac2name, uint8_t dac2step, uint8_t & dac2min, uint8_t & dac2max, uint16_t flags, uint16_t nTriggers, bool efficiency, scanSetup & setup);
+    bool setupThresholdMap(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers, scanSetup & setup);
+    bool setupThresholdVsDAC(std::string dac1name, uint8_t dac1step, uint8_t & dac1min, uint8_t & dac1max, std::string dac2name, uint8_t dac2step, uint8_t & dac2min, uint8_t & dac2max, uint8_t threshold, uint16_t flags, uint16_t nTriggers, scanSetup & setup);
+
+    /** Execute a prepared test through expandLoop and reset the scanned DACs
+     *  to their configured values afterwards.
+     */
+    std::vector<Event> runScan(scanSetup & setup);
+
+    /** Reset the DACs scanned by a test to their configured values
+     */
+    void resetScanDacs(scanSetup & setup);
+
+    /** Execute a prepared DAC-DAC scan and hand the condensed data to the
+     *  visitor slice by slice instead of collecting it.
+     */
+    void streamDacDacScan(scanSetup & setup, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, dacDacVisitor & visitor);
+
+    /** Report the progress of the loop expansion, "done" out of "total" HAL calls.
+     *  Throws pxar::ScanCancelled if the running scan has been cancelled.
+     */
+    void loopProgress(size_t done, size_t total);
+
+    /** Report the progress within a HAL call, "events" read out of "expected".
+     *  Throws pxar::ScanCancelled if the running scan has been cancelled.
+     */
+    void scanProgress(size_t events, size_t expected);
+
+    /** Queue an asynchronous scan for execution
+     */
+    void submitScan(asyncScan * scan);
+
+    /** Throw pxar::TestboardBusy if asynchronous scans are queued or being measured,
+     *  unless called from the measurement thread
+     */
+    void checkIdle();
+
+    /** Measurement and repack threads for asynchronous scans, started on first use
+     */
+    asyncWorker * _async;
+
+    /** Asynchronous scan currently executed on the measurement thread
+     */
+    asyncScan * _asyncScan;
+
+    /** Progress receiver and cancellation token attached by the user
+     */
+    scanMonitor * _monitor;
+
+    /** Progress bookkeeping of the running scan: HAL calls done out of the total,
+     *  events read in the calls done, events read and expected in the current call
+     */
+    size_t _loopCall;
+    size_t _loopCalls;
+    size_t _loopEvents;
+    size_t _callEvents;
+    size_t _callExpected;
+
+    /** Pass the progress bookkeeping to the monitor and the asynchronous scan and
+     *  throw pxar::ScanCancelled if cancellation has been requested
+     */
+    void reportProgress();
+
+    friend class asyncWorker;
+
+
     /** Helper function for conversion from string to register value
      *
      *  Type tells it whether it is a DTB, TBM or ROC register to look for.
@@ -0,0 +1,222 @@
+/**
+ * pxar asynchronous scan implementation
+ */
+
+#include "asyncscan.h"
+#include "exceptions.h"
+#include "log.h"
+
+using namespace pxar;
+
+asyncScan::asyncScan() :
+  setup(),
+  data(),
+  refs(1),
+  measured(false),
+  done(false),
+  error(),
+  cancelled(false),
+  progress(0) {}
+
+void asyncScan::Acquire() {
+  std::lock_guard<std::mutex> lock(mutex);
+  refs++;
+}
+
+void asyncScan::Release(asyncScan * scan) {
+  if(scan == NULL) return;
+  bool last;
+  {
+    std::lock_guard<std::mutex> lock(scan->mutex);
+    last = (--scan->refs == 0);
+  }
+  if(last) delete scan;
+}
+
+void asyncScan::Measured() {
+  std::lock_guard<std::mutex> lock(mutex);
+  measured = true;
+  cv.notify_all();
+}
+
+void asyncScan::Finish() {
+  std::lock_guard<std::mutex> lock(mutex);
+  measured = true;
+  done = true;
+  if(!error) { progress = 1; }
+  cv.notify_all();
+}
+
+
+asyncWorker::asyncWorker(pxarCore * core) :
+  _core(core),
+  _mutex(),
+  _cv(),
+  _measuring(),
+  _repacking(),
+  _stop(false),
+  _measureDone(false),
+  _measureThread(),
+  _repackThread()
+{
+  _measureThread = std::thread(&asyncWorker::Measure, this);
+  _repackThread = std::thread(&asyncWorker::Repack, this);
+}
+
+asyncWorker::~asyncWorker() {
+
+  // Cancel everything not finished yet:
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+    for(std::deque<asyncScan*>::iterator it = _measuring.begin(); it != _measuring.end(); ++it) { (*it)->cancelled = true; }
+    if(_core->_asyncScan != NULL) { _core->_asyncScan->cancelled = true; }
+  }
+  _cv.notify_all();
+  _measureThread.join();
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _measureDone = true;
+  }
+  _cv.notify_all();
+  _repackThread.join();
+}
+
+void asyncWorker::Submit(asyncScan * scan) {
+  // The worker holds its own reference until the scan is finished:
+  scan->Acquire();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _measuring.push_back(scan);
+  }
+  _cv.notify_all();
+}
+
+bool asyncWorker::Busy() {
+  if(std::this_thread::get_id() == _measureThread.get_id()) return false;
+  std::lock_guard<std::mutex> lock(_mutex);
+  return (!_measuring.empty() || _core->_asyncScan != NULL);
+}
+
+void asyncWorker::Measure() {
+
+  while(1) {
+    asyncScan * scan;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]{ return _stop || !_measuring.empty(); });
+      if(_measuring.empty()) break;
+      scan = _measuring.front();
+      _measuring.pop_front();
+      _core->_asyncScan = scan;
+    }
+
+    try {
+      if(scan->cancelled) { throw ScanCancelled("Scan cancelled before start"); }
+      scan->data = _core->runScan(scan->setup);
+    }
+    catch(...) {
+      // Hand the exception over to the waiting handles:
+      scan->error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _core->_asyncScan = NULL;
+      _repacking.push_back(scan);
+    }
+    scan->Measured();
+    _cv.notify_all();
+  }
+}
+
+void asyncWorker::Repack() {
+
+  while(1) {
+    asyncScan * scan;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]{ return _measureDone || !_repacking.empty(); });
+      if(_repacking.empty()) break;
+      scan = _repacking.front();
+      _repacking.pop_front();
+    }
+
+    if(!scan->error) {
+      try { scan->Repack(); }
+      catch(...) { scan->error = std::current_exception(); }
+    }
+    std::vector<Event>().swap(scan->data);
+
+    scan->Finish();
+    asyncScan::Release(scan);
+  }
+}
+
+
+template<typename T> scanFuture<T>::scanFuture() : _scan(NULL) {}
+
+template<typename T> scanFuture<T>::scanFuture(asyncScan * scan) : _scan(scan) {}
+
+template<typename T> scanFuture<T>::scanFuture(const scanFuture & other) : _scan(other._scan) {
+  if(_scan != NULL) { _scan->Acquire(); }
+}
+
+template<typename T> scanFuture<T> & scanFuture<T>::operator=(const scanFuture & other) {
+  if(other._scan != NULL) { other._scan->Acquire(); }
+  asyncScan::Release(_scan);
+  _scan = other._scan;
+  return *this;
+}
+
+template<typename T> scanFuture<T>::~scanFuture() {
+  asyncScan::Release(_scan);
+}
+
+template<typename T> bool scanFuture<T>::valid() const {
+  return (_scan != NULL);
+}
+
+template<typename T> bool scanFuture<T>::ready() const {
+  if(_scan == NULL) return false;
+  std::lock_guard<std::mutex> lock(_scan->mutex);
+  return _scan->done;
+}
+
+template<typename T> void scanFuture<T>::wait() const {
+  if(_scan == NULL) return;
+  std::unique_lock<std::mutex> lock(_scan->mutex);
+  _scan->cv.wait(lock, [this]{ return _scan->done; });
+}
+
+template<typename T> void scanFuture<T>::waitMeasured() const {
+  if(_scan == NULL) return;
+  std::unique_lock<std::mutex> lock(_scan->mutex);
+  _scan->cv.wait(lock, [this]{ return _scan->measured; });
+}
+
+template<typename T> T scanFuture<T>::get() const {
+  if(_scan == NULL) return T();
+  wait();
+  if(_scan->error) { std::rethrow_exception(_scan->error); }
+  return static_cast<asyncResult<T>*>(_scan)->value;
+}
+
+template<typename T> double scanFuture<T>::progress() const {
+  if(_scan == NULL) return 0;
+  return _scan->progress;
+}
+
+template<typename T> void scanFuture<T>::cancel() {
+  if(_scan == NULL) return;
+  LOG(logDEBUGAPI) << "Cancellation of asynchronous scan requested.";
+  _scan->cancelled = true;
+}
+
+// Result types of the asynchronous test functions:
+namespace pxar {
+  template class scanFuture<std::vector<pixel> >;
+  template class scanFuture<std::vector< std::pair<uint8_t, std::vector<pixel> > > >;
+  template class scanFuture<std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >;
+}
@@ -0,0 +1,118 @@
+/**
+ * pxar asynchronous scan bookkeeping, internal to the API
+ */
+
+#ifndef PXAR_ASYNCSCAN_H
+#define PXAR_ASYNCSCAN_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "api.h"
+
+namespace pxar {
+
+  /** Prepared test: the HAL functions and parameters for the loop expansion,
+   *  and the DACs (name and register) to be reset after the scan.
+   */
+  struct scanSetup {
+    scanSetup() : pixelfn(NULL), multipixelfn(NULL), rocfn(NULL), multirocfn(NULL), param(), efficiency(false), flags(0), resetDacs() {}
+    HalMemFnPixelSerial   pixelfn;
+    HalMemFnPixelParallel multipixelfn;
+    HalMemFnRocSerial     rocfn;
+    HalMemFnRocParallel   multirocfn;
+    std::vector<int32_t> param;
+    bool efficiency;
+    uint16_t flags;
+    std::vector<std::pair<std::string, uint8_t> > resetDacs;
+  };
+
+  /** Shared state of one asynchronous scan, referenced by its pxar::scanFuture
+   *  handles and by the asyncWorker while queued. Deleted with the last reference.
+   */
+  class asyncScan {
+  public:
+    asyncScan();
+    virtual ~asyncScan() {}
+
+    /** Repack the measured data into the result, run on the repack thread
+     */
+    virtual void Repack() = 0;
+
+    /** Reference counting
+     */
+    void Acquire();
+    static void Release(asyncScan * scan);
+
+    /** Mark the measurement or the whole scan as done and wake up waiting handles
+     */
+    void Measured();
+    void Finish();
+
+    scanSetup setup;
+    std::vector<Event> data;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t refs;
+    bool measured;
+    bool done;
+    std::exception_ptr error;
+    std::atomic<bool> cancelled;
+    std::atomic<double> progress;
+  };
+
+  /** Asynchronous scan with a result of type T
+   */
+  template<typename T> class asyncResult : public asyncScan {
+  public:
+    asyncResult() : asyncScan(), value(), repack() {}
+    void Repack() { if(repack) { value = repack(data); } }
+
+    T value;
+    std::function<T(std::vector<Event>&)> repack;
+  };
+
+  /** Measurement and repack threads of a pxar::pxarCore. Scans are measured one
+   *  after the other in the order submitted, and handed to the repack thread
+   *  afterwards.
+   */
+  class asyncWorker {
+  public:
+    asyncWorker(pxarCore * core);
+
+    /** Cancels all pending scans and waits for the threads to finish
+     */
+    ~asyncWorker();
+
+    void Submit(asyncScan * scan);
+
+    /** True if scans are queued or being measured. Always false when called from
+     *  the measurement thread itself.
+     */
+    bool Busy();
+
+  private:
+    void Measure();
+    void Repack();
+
+    pxarCore * _core;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<asyncScan*> _measuring;
+    std::deque<asyncScan*> _repacking;
+    bool _stop;
+    bool _measureDone;
+    std::thread _measureThread;
+    std::thread _repackThread;
+  };
+
+}
+
+#endif /* PXAR_ASYNCSCAN_H */
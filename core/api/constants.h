@@ -14,6 +14,9 @@ namespace pxar {
 // #define DTB_SOURCE_BLOCK_SIZE  8192
 #define DTB_SOURCE_BLOCK_SIZE 65536
 #define DTB_SOURCE_BUFFER_SIZE 50000000
+#define DTB_SOURCE_PREFETCH_BLOCKS 3 // Number of blocks read ahead by the prefetching source
+#define DTB_SPLITTER_MAX_EVENT 40000 // Maximum raw event size in words, longer events are truncated
+#define HAL_PARALLEL_QUEUE_EVENTS 4096 // Decoded events per channel waiting to be merged in the parallel readout
 #define DTB_DAQ_FIFO_OVFL 4 // bit 2 = DAQ fast HW FIFO overflow
 #define DTB_DAQ_MEM_OVFL  2 // bit 1 = DAQ RAM FIFO overflow
 #define DTB_DAQ_STOPPED   1 // bit 0 = DAQ stopped (because of overflow)
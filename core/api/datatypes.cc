@@ -3,16 +3,18 @@
 #include "log.h"
 #include "exceptions.h"
 #include "constants.h"
+#include <algorithm>
+#include <iomanip>
 
 namespace pxar {
 
 
-  void pixel::decodeRaw(uint32_t raw, bool invert) {
+  pixelStatus pixel::tryDecodeRaw(uint32_t raw, bool invert) {
     // Get the pulse height:
     setValue(static_cast<double>((raw & 0x0f) + ((raw >> 1) & 0xf0)));
     if((raw & 0x10) > 0) {
       LOG(logDEBUGAPI) << "invalid pulse-height fill bit from raw value of "<< std::hex << raw << std::dec << ": " << *this;
-      throw DataInvalidPulseheightError("Error decoding pixel raw value");
+      return PIXEL_INVALID_PULSEHEIGHT;
     }
 
     // Decode the pixel address
@@ -29,23 +31,24 @@ namespace pxar {
     // Perform range checks:
     if(_row >= ROC_NUMROWS || _column >= ROC_NUMCOLS) {
       LOG(logDEBUGAPI) << "Invalid pixel from raw value of "<< std::hex << raw << std::dec << ": " << *this;
-      if(_row == ROC_NUMROWS) throw DataCorruptBufferError("Error decoding pixel raw value");
-      else throw DataInvalidAddressError("Error decoding pixel raw value");
+      if(_row == ROC_NUMROWS) return PIXEL_CORRUPT_BUFFER;
+      else return PIXEL_INVALID_ADDRESS;
     }
+    return PIXEL_VALID;
   }
 
-  void pixel::decodeLinear(uint32_t raw) {
+  pixelStatus pixel::tryDecodeLinear(uint32_t raw) {
     // Get the pulse height:
     setValue(static_cast<double>((raw & 0x0f) + ((raw >> 1) & 0xf0)));
     if((raw & 0x10) > 0) {
       LOG(logDEBUGAPI) << "invalid pulse-height fill bit from raw value of "<< std::hex << raw << std::dec << ": " << *this;
-      throw DataInvalidPulseheightError("Error decoding pixel raw value");
+      return PIXEL_INVALID_PULSEHEIGHT;
     }
 
     // Perform checks on the fill bits:
     if((raw & 0x1000) > 0 || (raw & 0x100000) > 0) {
       LOG(logDEBUGAPI) << "invalid address fill bit from raw value of "<< std::hex << raw << std::dec << ": " << *this;
-      throw DataInvalidAddressError("Error decoding pixel raw value");
+      return PIXEL_INVALID_ADDRESS;
     }
 
     // Decode the pixel address
@@ -55,9 +58,10 @@ namespace pxar {
     // Perform range checks:
     if(_row >= ROC_NUMROWS || _column >= ROC_NUMCOLS) {
       LOG(logDEBUGAPI) << "Invalid pixel from raw value of "<< std::hex << raw << std::dec << ": " << *this;
-      if(_row == ROC_NUMROWS) throw DataCorruptBufferError("Error decoding pixel raw value");
-      else throw DataInvalidAddressError("Error decoding pixel raw value");
+      if(_row == ROC_NUMROWS) return PIXEL_CORRUPT_BUFFER;
+      else return PIXEL_INVALID_ADDRESS;
     }
+    return PIXEL_VALID;
   }
 
   uint8_t pixel::translateLevel(uint16_t x, int16_t level0, int16_t level1, int16_t levelS) {
@@ -66,11 +70,11 @@ namespace pxar {
     return level1 ? y/level1 + 1: 0;
   }
 
-  void pixel::decodeAnalog(std::vector<uint16_t> analog, int16_t ultrablack, int16_t black) {
+  pixelStatus pixel::tryDecodeAnalog(const std::vector<uint16_t> & analog, int16_t ultrablack, int16_t black) {
     // Check pixel data length:
     if(analog.size() != 6) {
       LOG(logDEBUGAPI) << "Received wrong number of data words for a pixel: " << analog.size();
-      throw DataInvalidAddressError("Received wrong number of data words for a pixel");
+      return PIXEL_INVALID_ADDRESS;
     }
 
     // Calculate the levels:
@@ -97,8 +101,31 @@ namespace pxar {
     // Perform range checks:
     if(_row >= ROC_NUMROWS || _column >= ROC_NUMCOLS) {
       LOG(logDEBUGAPI) << "Invalid pixel from levels "<< listVector(analog) << ": " << *this;
-      throw DataInvalidAddressError("Error decoding pixel address");
+      return PIXEL_INVALID_ADDRESS;
     }
+    return PIXEL_VALID;
+  }
+
+  // Translate the decoding status into the corresponding exception:
+  static void throwDecodingError(pixelStatus status, const std::string & message) {
+    switch(status) {
+    case PIXEL_INVALID_ADDRESS: throw DataInvalidAddressError(message);
+    case PIXEL_INVALID_PULSEHEIGHT: throw DataInvalidPulseheightError(message);
+    case PIXEL_CORRUPT_BUFFER: throw DataCorruptBufferError(message);
+    default: break;
+    }
+  }
+
+  void pixel::decodeRaw(uint32_t raw, bool invert) {
+    throwDecodingError(tryDecodeRaw(raw,invert),"Error decoding pixel raw value");
+  }
+
+  void pixel::decodeLinear(uint32_t raw) {
+    throwDecodingError(tryDecodeLinear(raw),"Error decoding pixel raw value");
+  }
+
+  void pixel::decodeAnalog(std::vector<uint16_t> analog, int16_t ultrablack, int16_t black) {
+    throwDecodingError(tryDecodeAnalog(analog,ultrablack,black),"Error decoding pixel address");
   }
 
   uint32_t pixel::encode() {
@@ -297,6 +324,69 @@ namespace pxar {
     LOG(logINFO) << "\t Stack Count \t" << listVector(this->stackCounts(),false,false,true);
   }
 
+  void eventBatch::Clear() {
+    // Clearing keeps the capacity of all columns:
+    roc.clear(); column.clear(); row.clear(); value.clear();
+    header.clear(); trailer.clear();
+    pixel_offset.resize(1); header_offset.resize(1); trailer_offset.resize(1);
+  }
+
+  void eventBatch::reserve(size_t events, size_t hits) {
+    roc.reserve(hits); column.reserve(hits); row.reserve(hits); value.reserve(hits);
+    pixel_offset.reserve(events+1);
+    header_offset.reserve(events+1);
+    trailer_offset.reserve(events+1);
+  }
+
+  void eventBatch::addEvent(Event &evt) {
+    for(std::vector<pixel>::iterator px = evt.pixels.begin(); px != evt.pixels.end(); ++px) {
+      roc.push_back(px->roc());
+      column.push_back(px->column());
+      row.push_back(px->row());
+      value.push_back(static_cast<int16_t>(px->value()));
+    }
+    header.insert(header.end(), evt.header.begin(), evt.header.end());
+    trailer.insert(trailer.end(), evt.trailer.begin(), evt.trailer.end());
+  }
+
+  void eventBatch::closeEvent() {
+    pixel_offset.push_back(roc.size());
+    header_offset.push_back(header.size());
+    trailer_offset.push_back(trailer.size());
+  }
+
+  void eventBatch::dropEvent() {
+    roc.resize(pixel_offset.back());
+    column.resize(pixel_offset.back());
+    row.resize(pixel_offset.back());
+    value.resize(pixel_offset.back());
+    header.resize(header_offset.back());
+    trailer.resize(trailer_offset.back());
+  }
+
+  bool eventBatch::openTriggerCountsEqual() const {
+    for(size_t i = header_offset.back(); i < header.size(); i++) {
+      if(((header[i] >> 8) & 0xff) != ((header[header_offset.back()] >> 8) & 0xff)) return false;
+    }
+    return true;
+  }
+
+  std::vector<uint8_t> eventBatch::openTriggerCounts() const {
+    std::vector<uint8_t> counts;
+    for(size_t i = header_offset.back(); i < header.size(); i++) {
+      counts.push_back((header[i] >> 8) & 0xff);
+    }
+    return counts;
+  }
+
+  Event eventBatch::getEvent(size_t evt) const {
+    Event tmp;
+    for(size_t i = pixelBegin(evt); i < pixelEnd(evt); i++) { tmp.pixels.push_back(getPixel(i)); }
+    for(size_t i = headerBegin(evt); i < headerEnd(evt); i++) { tmp.addHeader(header[i]); }
+    for(size_t i = trailerBegin(evt); i < trailerEnd(evt); i++) { tmp.addTrailer(trailer[i]); }
+    return tmp;
+  }
+
   void statistics::dump() {
     // Print out the full statistics:
     LOG(logINFO) << "Decoding statistics:";
@@ -357,6 +447,78 @@ namespace pxar {
     m_errors_pixel_buffer_corrupt = 0;
   }
 
+  void registerStatistics::dump() {
+    // Print out the full statistics:
+    LOG(logINFO) << "Register cache statistics:";
+    LOG(logINFO) << "\t DAC writes:               " << this->dac_writes();
+    LOG(logINFO) << "\t DAC writes skipped:       " << this->dac_writes_skipped();
+    LOG(logINFO) << "\t TBM register writes:      " << this->tbm_writes();
+    LOG(logINFO) << "\t TBM writes skipped:       " << this->tbm_writes_skipped();
+    LOG(logINFO) << "\t ROC mask/trim writes:     " << this->mask_writes();
+    LOG(logINFO) << "\t mask/trim writes skipped: " << this->mask_writes_skipped();
+    LOG(logINFO) << "\t RPC calls saved:          " << this->rpcs_saved();
+    LOG(logINFO) << "\t USB transfers saved:      " << this->flushes_saved();
+  }
+
+  void registerStatistics::clear() {
+    m_dac_writes = 0;
+    m_dac_writes_skipped = 0;
+    m_tbm_writes = 0;
+    m_tbm_writes_skipped = 0;
+    m_mask_writes = 0;
+    m_mask_writes_skipped = 0;
+    m_rpcs_saved = 0;
+    m_flushes_saved = 0;
+  }
+
+  void rpcStatistics::dump(size_t ncalls) {
+    // Sort the calls used by the time spent in them:
+    std::vector<std::pair<uint64_t, std::string> > order;
+    for(std::map<std::string, rpcCallStatistics>::iterator it = m_calls.begin(); it != m_calls.end(); ++it) {
+      if(it->second.calls > 0) order.push_back(std::make_pair(it->second.time_total, it->first));
+    }
+    std::sort(order.rbegin(), order.rend());
+    if(ncalls > 0 && ncalls < order.size()) { order.resize(ncalls); }
+
+    LOG(logINFO) << "RPC call statistics: " << total_calls() << " calls, "
+		 << total_bytes_sent() << " bytes sent, " << total_bytes_received() << " bytes received, "
+		 << total_time()/1000 << " ms";
+    for(size_t i = 0; i < order.size(); i++) {
+      rpcCallStatistics & call = m_calls[order.at(i).second];
+      LOG(logINFO) << "\t " << std::setw(28) << std::left << order.at(i).second << std::right
+		   << std::setw(8) << call.calls << " calls"
+		   << std::setw(12) << call.bytes_sent << "b sent"
+		   << std::setw(12) << call.bytes_received << "b received"
+		   << std::setw(10) << call.time_total/1000 << "ms"
+		   << std::setw(10) << call.time_total/call.calls << "us mean"
+		   << std::setw(10) << call.time_max << "us max";
+    }
+  }
+
+  uint32_t rpcStatistics::total_calls() {
+    uint32_t total = 0;
+    for(std::map<std::string, rpcCallStatistics>::iterator it = m_calls.begin(); it != m_calls.end(); ++it) { total += it->second.calls; }
+    return total;
+  }
+
+  uint64_t rpcStatistics::total_bytes_sent() {
+    uint64_t total = 0;
+    for(std::map<std::string, rpcCallStatistics>::iterator it = m_calls.begin(); it != m_calls.end(); ++it) { total += it->second.bytes_sent; }
+    return total;
+  }
+
+  uint64_t rpcStatistics::total_bytes_received() {
+    uint64_t total = 0;
+    for(std::map<std::string, rpcCallStatistics>::iterator it = m_calls.begin(); it != m_calls.end(); ++it) { total += it->second.bytes_received; }
+    return total;
+  }
+
+  uint64_t rpcStatistics::total_time() {
+    uint64_t total = 0;
+    for(std::map<std::string, rpcCallStatistics>::iterator it = m_calls.begin(); it != m_calls.end(); ++it) { total += it->second.time_total; }
+    return total;
+  }
+
   tbmConfig::tbmConfig(uint8_t tbmtype) : dacs(), type(tbmtype), hubid(31), core(0xE0), tokenchains(), enable(true) {
 
     if(tbmtype == 0x0) {
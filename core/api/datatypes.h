@@ -13,12 +13,14 @@ typedef short int int16_t;
 typedef unsigned int uint32_t;
 typedef unsigned short int uint16_t;
 typedef unsigned char uint8_t;
+typedef unsigned long long uint64_t;
 #else
 #include <stdint.h>
 #endif
 
 #include <iostream>
 #include <vector>
+#include <utility>
 #include <map>
 #include <limits>
 #include <cmath>
@@ -27,6 +29,17 @@ typedef unsigned char uint8_t;
 
 namespace pxar {
 
+  /** Status codes returned by the non-throwing pixel decoding functions
+   *  pxar::pixel::decode(). They correspond to the exceptions thrown by
+   *  the decoding constructors of pxar::pixel.
+   */
+  enum pixelStatus {
+    PIXEL_VALID = 0,            // successfully decoded
+    PIXEL_INVALID_ADDRESS,      // see pxar::DataInvalidAddressError
+    PIXEL_INVALID_PULSEHEIGHT,  // see pxar::DataInvalidPulseheightError
+    PIXEL_CORRUPT_BUFFER        // see pxar::DataCorruptBufferError
+  };
+
   /** Class for storing decoded pixel readout data
    */
   class DLLEXPORT pixel {
@@ -51,6 +64,26 @@ namespace pxar {
      */
   pixel(std::vector<uint16_t> analogdata, uint8_t rocid, int16_t ultrablack, int16_t black) : _roc_id(rocid) { decodeAnalog(analogdata,ultrablack,black); }
 
+    /** Decode rawdata pixel address & value and set the ROC id without throwing
+     *  exceptions. Returns pxar::PIXEL_VALID on success or the pxar::pixelStatus
+     *  code of the decoding problem encountered. This is to be used in the
+     *  decoder loops where invalid hits are frequent and only counted.
+     */
+    pixelStatus decode(uint32_t rawdata, uint8_t rocid, bool invertAddress = false, bool linearAddress = false) {
+      _roc_id = rocid;
+      if(linearAddress) { return tryDecodeLinear(rawdata); }
+      else { return tryDecodeRaw(rawdata,invertAddress); }
+    }
+
+    /** Decode analog levels data using the given ultrablack & black levels and
+     *  set the ROC id without throwing exceptions. Returns pxar::PIXEL_VALID on
+     *  success or the pxar::pixelStatus code of the decoding problem encountered.
+     */
+    pixelStatus decode(const std::vector<uint16_t> & analogdata, uint8_t rocid, int16_t ultrablack, int16_t black) {
+      _roc_id = rocid;
+      return tryDecodeAnalog(analogdata,ultrablack,black);
+    }
+
     /** Getter function to return ROC ID
      */
     uint8_t roc() const { return _roc_id; };
@@ -77,7 +110,7 @@ namespace pxar {
 
     /** Member function to get the signal variance for this pixel hit
      */
-    double variance() { return expandFloat(_variance); };
+    double variance() const { return expandFloat(_variance); };
 
     /** Member function to set the signal variance for this pixel hit
      */
@@ -85,7 +118,7 @@ namespace pxar {
 
     /** Member function to get the value stored for this pixel hit
      */
-    double value() { 
+    double value() const { 
       return static_cast<double>(_mean);
     };
 
@@ -170,6 +203,13 @@ namespace pxar {
      */
     void decodeAnalog(std::vector<uint16_t> analog, int16_t ultrablack, int16_t black);
 
+    /** Non-throwing implementations of the decoding functions above, returning
+     *  a pxar::pixelStatus code instead.
+     */
+    pixelStatus tryDecodeRaw(uint32_t raw, bool invert);
+    pixelStatus tryDecodeLinear(uint32_t raw);
+    pixelStatus tryDecodeAnalog(const std::vector<uint16_t> & analog, int16_t ultrablack, int16_t black);
+
     /** Helper function to translate ADC values into address levels
      */
     uint8_t translateLevel(uint16_t x, int16_t level0, int16_t level1, int16_t levelS);
@@ -184,7 +224,7 @@ namespace pxar {
     /** Helper function to expand 16bit fixed-width integer value to
      *  floating point value with precision roughly ~10^-4
      */
-    double expandFloat(uint16_t input) {
+    double expandFloat(uint16_t input) const {
       return static_cast<double>(input)/std::numeric_limits<uint16_t>::max();
     }
 
@@ -203,11 +243,25 @@ namespace pxar {
   class DLLEXPORT Event {
   public:
   Event() : pixels(), header(), trailer() {}
-  Event(const Event &evt) {
+  Event(const Event &evt) : pixels(evt.pixels), header(evt.header), trailer(evt.trailer) {}
+  Event & operator=(const Event &evt) {
     pixels = evt.pixels;
     header = evt.header;
     trailer = evt.trailer;
+    return *this;
+  }
+#if ((!defined __CINT__) && ((__cplusplus >= 201103L) || (defined _MSC_VER && _MSC_VER >= 1900)))
+    /** Move construction and assignment take over the pixel and TBM data, so
+     *  std::vector<Event> can be grown and merged without copying the hits
+     */
+  Event(Event &&evt) noexcept : pixels(std::move(evt.pixels)), header(std::move(evt.header)), trailer(std::move(evt.trailer)) {}
+  Event & operator=(Event &&evt) noexcept {
+    pixels = std::move(evt.pixels);
+    header = std::move(evt.header);
+    trailer = std::move(evt.trailer);
+    return *this;
   }
+#endif
 
     /** Helper function to clear the event content
      */
@@ -355,6 +409,119 @@ namespace pxar {
     /** Overloaded ostream operator for simple printing of Event data
      */
     friend std::ostream & operator<<(std::ostream &out, Event& evt);
+
+    /** Allow the eventBatch to directly copy the TBM header and trailer words
+     */
+    friend class eventBatch;
+  };
+
+
+  /** Class to store a batch of decoded Events in flat column arrays (structure
+   *  of arrays) instead of one pxar::Event object per trigger. The pixel hits of
+   *  all Events are stored consecutively, the hits of Event i are found in the
+   *  index range [pixelBegin(i), pixelEnd(i)) of the roc, column, row and value
+   *  columns. TBM headers and trailers are stored the same way.
+   *
+   *  Clearing the batch keeps the allocated memory, so one batch object can be
+   *  reused for subsequent readouts without any further heap allocations.
+   */
+  class DLLEXPORT eventBatch {
+  public:
+  eventBatch() : roc(), column(), row(), value(), pixel_offset(1,0), header(), header_offset(1,0), trailer(), trailer_offset(1,0) {}
+
+    /** Helper function to clear the batch content, the allocated capacity is kept
+     */
+    void Clear();
+
+    /** Reserve memory for the given number of Events and pixel hits
+     */
+    void reserve(size_t events, size_t hits);
+
+    /** Returns the number of Events stored in this batch
+     */
+    size_t size() const { return pixel_offset.size() - 1; }
+
+    /** Returns the total number of pixel hits stored in this batch
+     */
+    size_t hits() const { return roc.size(); }
+
+    /** Index range of the pixel hits belonging to Event "evt"
+     */
+    uint32_t pixelBegin(size_t evt) const { return pixel_offset[evt]; }
+    uint32_t pixelEnd(size_t evt) const { return pixel_offset[evt+1]; }
+
+    /** Index range of the TBM headers belonging to Event "evt"
+     */
+    uint32_t headerBegin(size_t evt) const { return header_offset[evt]; }
+    uint32_t headerEnd(size_t evt) const { return header_offset[evt+1]; }
+
+    /** Index range of the TBM trailers belonging to Event "evt"
+     */
+    uint32_t trailerBegin(size_t evt) const { return trailer_offset[evt]; }
+    uint32_t trailerEnd(size_t evt) const { return trailer_offset[evt+1]; }
+
+    /** Append the content of a decoded pxar::Event to the currently open Event
+     *  of the batch. Several Events (e.g. from different DAQ channels) can be
+     *  added before the Event is closed.
+     */
+    void addEvent(Event &evt);
+
+    /** Close the currently open Event, subsequent data is added to a new one
+     */
+    void closeEvent();
+
+    /** Discard all data added to the currently open Event
+     */
+    void dropEvent();
+
+    /** Returns the number of TBM headers in the currently open Event
+     */
+    size_t openHeaders() const { return header.size() - header_offset.back(); }
+
+    /** Returns true if all TBM headers of the currently open Event report
+     *  the same 8 bit event counter
+     */
+    bool openTriggerCountsEqual() const;
+
+    /** Returns the 8 bit event counters of all TBM headers in the currently
+     *  open Event
+     */
+    std::vector<uint8_t> openTriggerCounts() const;
+
+    /** Access to TBM header and trailer words number "idx" of the batch
+     */
+    uint16_t getHeader(size_t idx) const { return header[idx]; }
+    uint16_t getTrailer(size_t idx) const { return trailer[idx]; }
+
+    /** Return a pixel object for hit number "hit" of the batch
+     */
+    pixel getPixel(size_t hit) const { return pixel(roc[hit],column[hit],row[hit],value[hit]); }
+
+    /** Convert Event "evt" of the batch back into a pxar::Event object
+     */
+    Event getEvent(size_t evt) const;
+
+    /** Pixel hit columns: ROC ID, column, row and value (pulse height)
+     */
+    std::vector<uint8_t> roc;
+    std::vector<uint8_t> column;
+    std::vector<uint8_t> row;
+    std::vector<int16_t> value;
+
+  private:
+    /** Offsets of the first pixel hit of every Event, plus the end of the last one
+     */
+    std::vector<uint32_t> pixel_offset;
+
+    /** TBM Headers and the offsets of the first header of every Event
+     */
+    std::vector<uint16_t> header;
+    std::vector<uint32_t> header_offset;
+
+    /** TBM Trailers and the offsets of the first trailer of every Event
+     */
+    std::vector<uint16_t> trailer;
+    std::vector<uint32_t> trailer_offset;
   };
 
 
@@ -365,6 +532,23 @@ namespace pxar {
   class DLLEXPORT rawEvent {
   public:
   rawEvent() : data(), flags(0) {}
+  rawEvent(const rawEvent &evt) : data(evt.data), flags(evt.flags) {}
+  rawEvent & operator=(const rawEvent &evt) {
+    data = evt.data;
+    flags = evt.flags;
+    return *this;
+  }
+#if ((!defined __CINT__) && ((__cplusplus >= 201103L) || (defined _MSC_VER && _MSC_VER >= 1900)))
+    /** Move construction and assignment take over the raw data words
+     */
+  rawEvent(rawEvent &&evt) noexcept : data(std::move(evt.data)), flags(evt.flags) { evt.flags = 0; }
+  rawEvent & operator=(rawEvent &&evt) noexcept {
+    data = std::move(evt.data);
+    flags = evt.flags;
+    evt.flags = 0;
+    return *this;
+  }
+#endif
     void SetStartError() { flags |= 1; }
     void SetEndError()   { flags |= 2; }
     void SetOverflow()   { flags |= 4; }
@@ -378,6 +562,7 @@ namespace pxar {
 	
     size_t GetSize() { return data.size(); }
     void Add(uint16_t value) { data.push_back(value); }
+    void Add(const uint16_t * begin, const uint16_t * end) { data.insert(data.end(), begin, end); }
     uint16_t operator[](size_t index) { return data.at(index); }
 
     std::vector<uint16_t> data;
@@ -659,5 +844,111 @@ namespace pxar {
     // Total number of pixels with row 80:
     uint32_t m_errors_pixel_buffer_corrupt;
   };
+
+  /** Class to store the statistics of the device register caches in the HAL:
+   *  how many DAC, TBM register and pixel mask/trim writes have been requested,
+   *  how many of them have been dropped because the device already holds the
+   *  value, and how many RPC calls and USB transfers have been saved in total
+   *  by dropping and batching writes.
+   */
+  class DLLEXPORT registerStatistics {
+    /** Allow the HAL to directly alter private members of the statistics
+     */
+    friend class hal;
+
+  public:
+  registerStatistics() :
+    m_dac_writes(0),
+      m_dac_writes_skipped(0),
+      m_tbm_writes(0),
+      m_tbm_writes_skipped(0),
+      m_mask_writes(0),
+      m_mask_writes_skipped(0),
+      m_rpcs_saved(0),
+      m_flushes_saved(0)
+	{};
+    // Print all statistics to stdout:
+    void dump();
+
+    uint32_t dac_writes() { return m_dac_writes; }
+    uint32_t dac_writes_skipped() { return m_dac_writes_skipped; }
+    uint32_t tbm_writes() { return m_tbm_writes; }
+    uint32_t tbm_writes_skipped() { return m_tbm_writes_skipped; }
+    uint32_t mask_writes() { return m_mask_writes; }
+    uint32_t mask_writes_skipped() { return m_mask_writes_skipped; }
+    uint32_t rpcs_saved() { return m_rpcs_saved; }
+    uint32_t flushes_saved() { return m_flushes_saved; }
+
+  private:
+    // Clear all statistics:
+    void clear();
+
+    // ROC DAC writes requested, and dropped as the DAC already had the value:
+    uint32_t m_dac_writes;
+    uint32_t m_dac_writes_skipped;
+    // TBM register writes requested, and dropped as the register already had the value:
+    uint32_t m_tbm_writes;
+    uint32_t m_tbm_writes_skipped;
+    // ROC mask and trim requests, and dropped as the PUCs were in that state already:
+    uint32_t m_mask_writes;
+    uint32_t m_mask_writes_skipped;
+    // RPC calls not sent, from dropped writes and shared address selections:
+    uint32_t m_rpcs_saved;
+    // USB transfers saved by flushing batches of writes at once:
+    uint32_t m_flushes_saved;
+  };
+
+  /** Class for the statistics of one RPC call to the DTB: how often it was
+   *  called, the bytes sent and received and the time spent in it. The
+   *  latencies are histogrammed in powers of two: bin 0 counts calls taking
+   *  less than 1us, bin i calls from 2^(i-1)us to 2^i us, and the last bin
+   *  all calls taking longer.
+   */
+  class DLLEXPORT rpcCallStatistics {
+  public:
+  rpcCallStatistics() :
+    calls(0),
+      bytes_sent(0),
+      bytes_received(0),
+      time_total(0),
+      time_max(0),
+      latency()
+	{};
+
+    uint32_t calls;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    // Time spent in the calls, in us:
+    uint64_t time_total;
+    uint64_t time_max;
+    std::vector<uint32_t> latency;
+  };
+
+  /** Class for the statistics of all RPC calls to the DTB, keyed by their
+   *  RPC names as in the DTB function list (e.g. "Daq_Read$C5SI0IC"). Calls
+   *  deferred in a batch send their request during the call but receive
+   *  their reply at the end of the batch, these replies are counted under
+   *  "BatchEnd".
+   */
+  class DLLEXPORT rpcStatistics {
+    /** Allow the HAL to directly alter private members of the statistics
+     */
+    friend class hal;
+
+  public:
+  rpcStatistics() : m_calls() {};
+    // Print the calls used, sorted by the time spent in them. Only the
+    // first "ncalls" are listed if given, all of them for 0:
+    void dump(size_t ncalls = 0);
+
+    std::map<std::string, rpcCallStatistics> calls() { return m_calls; }
+    uint32_t total_calls();
+    uint64_t total_bytes_sent();
+    uint64_t total_bytes_received();
+    uint64_t total_time();
+
+  private:
+    std::map<std::string, rpcCallStatistics> m_calls;
+  };
 }
 #endif
@@ -221,6 +221,21 @@ std::vector< bool > dut::getEnabledColumns(size_t roci2c) {
   return result;
 }
 
+bool dut::getTrimChanged(size_t rocid) {
+  // ROCs never uploaded count as changed:
+  if(rocid >= trim_changed.size()) return true;
+  return trim_changed.at(rocid);
+}
+
+void dut::setTrimChanged(size_t rocid, bool changed) {
+  // Unknown ROCs are changed by default:
+  if(rocid >= trim_changed.size()) {
+    if(changed) return;
+    trim_changed.resize(rocid+1,true);
+  }
+  trim_changed.at(rocid) = changed;
+}
+
 std::vector< rocConfig > dut::getEnabledRocs() {
   std::vector< rocConfig > result;
   if (!_initialized) return result;
@@ -430,6 +445,7 @@ void dut:: maskPixel(uint8_t column, uint8_t row, bool mask) {
       // Set enable bit
       if(it != rocit->pixels.end()) {
 	it->setMask(mask);
+	setTrimChanged(static_cast<size_t>(rocit - roc.begin()),true);
       } else {
 	LOG(logWARNING) << "Pixel at column " << static_cast<int>(column) << " and row " << static_cast<int>(row) << " not found for ROC " << static_cast<int>(rocit - roc.begin()) << "!" ;
       }
@@ -447,6 +463,7 @@ void dut:: maskPixel(uint8_t column, uint8_t row, bool mask, uint8_t rocid) {
     // Set mask:
     if(it != roc.at(rocid).pixels.end()){
       it->setMask(mask);
+      setTrimChanged(rocid,true);
     } else {
       LOG(logWARNING) << "Pixel at column " << static_cast<int>(column) << " and row " << static_cast<int>(row) << " not found for ROC " << static_cast<int>(rocid)<< "!" ;
     }
@@ -498,6 +515,7 @@ void dut::maskAllPixels(bool mask) {
       for (std::vector<pixelConfig>::iterator pixelit = rocit->pixels.begin() ; pixelit != rocit->pixels.end(); ++pixelit){
 	pixelit->setMask(mask);
       }
+      setTrimChanged(static_cast<size_t>(rocit - roc.begin()),true);
     }
   }
 }
@@ -510,6 +528,7 @@ void dut::maskAllPixels(bool mask, uint8_t rocid) {
     for (std::vector<pixelConfig>::iterator pixelit = roc.at(rocid).pixels.begin() ; pixelit != roc.at(rocid).pixels.end(); ++pixelit){
       pixelit->setMask(mask);
     }
+    setTrimChanged(rocid,true);
   }
 }
 
@@ -550,6 +569,7 @@ bool dut::updateTrimBits(pixelConfig trimming, uint8_t rocid) {
     if(px == roc.at(0).pixels.end()) return false;
     // Pixel was found, set the new trimming values:
     px->setTrim(trimming.trim());
+    setTrimChanged(rocid,true);
     return true;
   }
   else { return false; }
@@ -567,6 +587,7 @@ bool dut::updateTrimBits(uint8_t column, uint8_t row, uint8_t trim, uint8_t roci
     if(px == roc.at(0).pixels.end()) return false;
     // Pixel was found, set the new trimming values:
     px->setTrim(trim);
+    setTrimChanged(rocid,true);
     return true;
   }
   else { return false; }
@@ -586,6 +607,7 @@ bool dut::updateTrimBits(std::vector<pixelConfig> trimming, uint8_t rocid) {
       if(px == roc.at(0).pixels.end()) return false;
       // Pixel was found, set the new trimming values:
       px->setTrim(it->trim());
+      setTrimChanged(rocid,true);
     }
     return true;
   }
@@ -42,7 +42,7 @@ namespace pxar {
 
     /** Default DUT constructor
      */
-  dut() : _initialized(false), _programmed(false), roc(), tbm(), sig_delays(),
+  dut() : _initialized(false), _programmed(false), roc(), trim_changed(), tbm(), sig_delays(),
       va(0), vd(0), ia(0), id(0), pg_setup(), pg_sum(0), trigger_source(TRG_SEL_PG_DIR) {}
 
     // GET functions to read information
@@ -243,10 +243,26 @@ namespace pxar {
      */
     std::vector< bool > getEnabledColumns(size_t roci2c);
 
+    /** Function returning if the mask or trim bits of ROC "rocid" have changed
+     *  since they have last been uploaded to the testboard:
+     */
+    bool getTrimChanged(size_t rocid);
+
+    /** Function to flag the mask and trim bits of ROC "rocid" as changed or as
+     *  uploaded to the testboard:
+     */
+    void setTrimChanged(size_t rocid, bool changed);
+
     /** DUT member to hold all ROC configurations
      */
     std::vector< rocConfig > roc;
 
+    /** DUT member to flag ROCs with mask or trim bits changed since the last
+     *  upload to the testboard. ROCs beyond its size count as changed, clearing
+     *  it forces a new upload of all ROCs.
+     */
+    std::vector< bool > trim_changed;
+
     /** DUT member to hold all TBM configurations
      */
     std::vector< tbmConfig > tbm;
@@ -41,6 +41,22 @@ namespace pxar {
     FirmwareVersionMismatch(const std::string& what_arg) : pxarException(what_arg) {}
   };
 
+  /**  This exception class is used when a scan has been cancelled by the user
+   *   before it completed.
+   */
+  class ScanCancelled : public pxarException {
+  public:
+    ScanCancelled(const std::string& what_arg) : pxarException(what_arg) {}
+  };
+
+  /**  This exception class is used when the testboard is accessed while
+   *   asynchronous scans are still queued or being measured.
+   */
+  class TestboardBusy : public pxarException {
+  public:
+    TestboardBusy(const std::string& what_arg) : pxarException(what_arg) {}
+  };
+
   /**  This exception class covers read/write issues during the USB communication 
    *   or problems opening the connection to the specified testboard.
    */
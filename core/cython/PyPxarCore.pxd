@@ -225,6 +225,7 @@ cdef extern from "api.h" namespace "pxar":
         void HVon()
         void Poff()
         void Pon()
+        void invalidateCache()
         bool SignalProbe(string probe, string name, uint8_t channel) except +
         bool setDAC(string dacName, uint8_t dacValue, uint8_t rocid) except +
         bool setDAC(string dacName, uint8_t dacValue) except +
@@ -485,6 +485,8 @@ cdef class PyPxarCore:
         self.thisptr.Poff()
     def Pon(self):
         self.thisptr.Pon()
+    def invalidateCache(self):
+        self.thisptr.invalidateCache()
     def SignalProbe(self, string probe, string name, int channel = 0):
         return self.thisptr.SignalProbe(probe, name, channel)
     def setDAC(self, string dacName, uint8_t dacValue, rocid = None):
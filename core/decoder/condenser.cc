@@ -0,0 +1,63 @@
+#include "condenser.h"
+#include "constants.h"
+
+namespace pxar {
+
+  eventCondenser::eventCondenser() : table(MOD_NUMROCS*ROC_NUMCOLS*ROC_NUMROWS), first(), index() {
+    for(std::vector<accumulator>::iterator it = table.begin(); it != table.end(); ++it) {
+      it->count = 0; it->mean = 0; it->m2 = 0;
+    }
+  }
+
+  void eventCondenser::Add(const Event & evt) {
+    for(std::vector<pixel>::const_iterator px = evt.pixels.begin(); px != evt.pixels.end(); ++px) {
+      size_t i = (static_cast<size_t>(px->roc())*ROC_NUMCOLS + px->column())*ROC_NUMROWS + px->row();
+
+      // Make room for ROC ids beyond a full module:
+      if(i >= table.size()) {
+	accumulator empty = {0, 0, 0};
+	table.resize((static_cast<size_t>(px->roc()) + 1)*ROC_NUMCOLS*ROC_NUMROWS, empty);
+      }
+
+      accumulator & acc = table[i];
+      double value = px->value();
+
+      // Pixel is new in this group:
+      if(acc.count == 0) {
+	first.push_back(*px);
+	index.push_back(i);
+	acc.mean = value;
+	acc.m2 = 0;
+	acc.count = 1;
+      }
+      // Pixel is known, update mean and variance incrementally:
+      else {
+	acc.count++;
+	double delta = value - acc.mean;
+	acc.mean += delta/acc.count;
+	acc.m2 += delta*(value - acc.mean);
+      }
+    }
+  }
+
+  void eventCondenser::Fill(Event & evt, bool efficiency) {
+    evt.pixels.reserve(evt.pixels.size() + first.size());
+    for(size_t p = 0; p < first.size(); p++) {
+      accumulator & acc = table[index[p]];
+      evt.pixels.push_back(first[p]);
+      if(efficiency) { evt.pixels.back().setValue(acc.count); }
+      else {
+	evt.pixels.back().setValue(acc.mean);
+	evt.pixels.back().setVariance(acc.m2/(acc.count - 1));
+      }
+    }
+    Reset();
+  }
+
+  void eventCondenser::Reset() {
+    for(std::vector<size_t>::const_iterator i = index.begin(); i != index.end(); ++i) { table[*i].count = 0; }
+    first.clear();
+    index.clear();
+  }
+
+}
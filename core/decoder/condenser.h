@@ -0,0 +1,44 @@
+#ifndef PXAR_CONDENSER_H
+#define PXAR_CONDENSER_H
+
+#include <vector>
+#include "datatypes.h"
+
+namespace pxar {
+
+  // Condensing of the events of one trigger group into a single event. Hits are
+  // accumulated in a dense per-pixel table (count, running mean and M2 after Welford) indexed by
+  // ROC, column and row, so condensing is linear in the number of hits.
+  // Only the entries touched by the current group are reset afterwards.
+  class eventCondenser {
+  public:
+    eventCondenser();
+
+    // Add all pixel hits of one event to the current group:
+    void Add(const Event & evt);
+
+    // Write the condensed pixels of the current group to "evt" in the order of their
+    // first appearance and start a new group. With "efficiency" set, the pixel value is
+    // the number of hits, otherwise the mean pulse height with its variance:
+    void Fill(Event & evt, bool efficiency);
+
+    // Drop the current group:
+    void Reset();
+
+  private:
+    struct accumulator {
+      uint16_t count;
+      double mean;
+      double m2;
+    };
+
+    // Dense table, MOD_NUMROCS ROCs initially, grown for higher ROC ids:
+    std::vector<accumulator> table;
+
+    // Pixels of the current group in order of appearance, and their table index:
+    std::vector<pixel> first;
+    std::vector<size_t> index;
+  };
+
+}
+#endif
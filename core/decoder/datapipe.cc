@@ -1,8 +1,15 @@
 #include "datapipe.h"
+#include "hitdecoder.h"
 #include "helper.h"
 #include "log.h"
 #include "constants.h"
 #include "exceptions.h"
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__)
+#define PXAR_SPLITTER_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace pxar {
 
@@ -24,6 +31,70 @@ namespace pxar {
     return &record;
   }
 
+  namespace {
+
+    // Index of the first sample with (sample & mask1) == marker1 or (sample & mask2) == marker2,
+    // n if there is none. Scans eight samples at a time where SSE2 is available:
+    size_t findMarker(const uint16_t * data, size_t n, uint16_t mask1, uint16_t marker1, uint16_t mask2, uint16_t marker2) {
+      size_t i = 0;
+#ifdef PXAR_SPLITTER_SSE2
+      const __m128i m1 = _mm_set1_epi16(static_cast<short>(mask1)), v1 = _mm_set1_epi16(static_cast<short>(marker1));
+      const __m128i m2 = _mm_set1_epi16(static_cast<short>(mask2)), v2 = _mm_set1_epi16(static_cast<short>(marker2));
+      for(; i + 8 <= n; i += 8) {
+	__m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+	__m128i hit = _mm_or_si128(_mm_cmpeq_epi16(_mm_and_si128(w, m1), v1), _mm_cmpeq_epi16(_mm_and_si128(w, m2), v2));
+	int bits = _mm_movemask_epi8(hit);
+	if(bits) { return i + __builtin_ctz(bits)/2; }
+      }
+#endif
+      for(; i < n; i++) {
+	if((data[i] & mask1) == marker1 || (data[i] & mask2) == marker2) { return i; }
+      }
+      return n;
+    }
+
+  } // namespace
+
+  bool dtbEventSplitter::CollectUntil(uint16_t mask1, uint16_t marker1, uint16_t mask2, uint16_t marker2, bool stopAtOverflow) {
+    while(true) {
+      const uint16_t * data;
+      size_t n = GetBuffered(data);
+
+      // Source buffer exhausted, have it refilled by reading the next sample:
+      if(n == 0) {
+	uint16_t sample = Get();
+	if((sample & mask1) == marker1 || (sample & mask2) == marker2) { return true; }
+	if(record.GetSize() < DTB_SPLITTER_MAX_EVENT) { record.Add(sample); }
+	else {
+	  record.SetOverflow();
+	  if(stopAtOverflow) { return false; }
+	}
+	continue;
+      }
+
+      size_t marker = findMarker(data, n, mask1, marker1, mask2, marker2);
+      size_t room = DTB_SPLITTER_MAX_EVENT - std::min(record.GetSize(), static_cast<size_t>(DTB_SPLITTER_MAX_EVENT));
+
+      // If total Event size is too big, truncate:
+      if(marker > room) {
+	record.Add(data, data + room);
+	record.SetOverflow();
+	if(stopAtOverflow) {
+	  Skip(room + 1);
+	  return false;
+	}
+      }
+      else { record.Add(data, data + marker); }
+
+      // Consume everything up to and including the marker:
+      if(marker < n) {
+	Skip(marker + 1);
+	return true;
+      }
+      Skip(n);
+    }
+  }
+
   void dtbEventSplitter::SplitDeser400() {
     // If last one had Event end marker, get a new sample:
     if (!nextStartDetected) { Get(); }
@@ -37,16 +108,13 @@ namespace pxar {
     record.Add(GetLast() | ((GetChannel() & 0x7) << 8));
 
     // Else keep reading and adding samples until we find any marker.
-    while ((Get() & 0xe000) != 0xc000) {
-      // Check if the last read sample has Event end marker:
-      if ((GetLast() & 0xe000) == 0xa000) {
-	record.SetEndError();
-	nextStartDetected = true;
-	return;
-      }
-      // If total Event size is too big, break:
-      if (record.GetSize() < 40000) record.Add(GetLast());
-      else record.SetOverflow();
+    CollectUntil(0xe000, 0xc000, 0xe000, 0xa000, false);
+
+    // Check if the last read sample has Event end marker:
+    if ((GetLast() & 0xe000) == 0xa000) {
+      record.SetEndError();
+      nextStartDetected = true;
+      return;
     }
     record.Add(GetLast());
     nextStartDetected = false;
@@ -65,16 +133,13 @@ namespace pxar {
 
     // Else keep reading and adding samples until we find the last trailer marker.
     // Make sure to look for "c0" and not "c" - the latter one is also the DESER160 end marker!
-    while ((Get() & 0xef00) != 0xc000) {
-      // Check if the last read sample has Event end marker:
-      if ((GetLast() & 0xe000) == 0xa000) {
-	record.SetEndError();
-	nextStartDetected = true;
-	return;
-      }
-      // If total Event size is too big, break:
-      if (record.GetSize() < 40000) record.Add(GetLast());
-      else record.SetOverflow();
+    CollectUntil(0xef00, 0xc000, 0xe000, 0xa000, false);
+
+    // Check if the last read sample has Event end marker:
+    if ((GetLast() & 0xe000) == 0xa000) {
+      record.SetEndError();
+      nextStartDetected = true;
+      return;
     }
     record.Add(GetLast());
     nextStartDetected = false;
@@ -90,20 +155,13 @@ namespace pxar {
       while (!(GetLast() & 0x8000)) Get();
     }
 
-    // Else keep reading and adding samples until we find any marker.
-    do {
-      // If total Event size is too big, break:
-      if (record.GetSize() >= 40000) {
-	record.SetOverflow();
-	break;
-      }
-
-      // FIXME Very first Event starts with 0xC - which srews up empty Event detection here!
-      // If the Event start sample is also Event end sample, write and quit:
-      if((GetLast() & 0xc000) == 0xc000) { break; }
-
+    // FIXME Very first Event starts with 0xC - which srews up empty Event detection here!
+    // If the Event start sample is also Event end sample, write and quit:
+    if((GetLast() & 0xc000) != 0xc000) {
       record.Add(GetLast());
-    } while ((Get() & 0xc000) == 0);
+      // Else keep reading and adding samples until we find any marker, stop if total Event size is too big:
+      CollectUntil(0x8000, 0x8000, 0x4000, 0x4000, true);
+    }
 
     // Check if the last read sample has Event end marker:
     if (GetLast() & 0x4000) record.Add(GetLast());
@@ -115,7 +173,14 @@ namespace pxar {
     record.Clear();
     try {
       do {
-	record.Add(Get());
+	// Take over all buffered samples at once where the source allows:
+	const uint16_t * data;
+	size_t n = GetBuffered(data);
+	if(n > 0) {
+	  record.Add(data, data + n);
+	  Skip(n);
+	}
+	else { record.Add(Get()); }
       } while(1);
     }
     catch(dsBufferEmpty) {}
@@ -297,34 +362,17 @@ namespace pxar {
 	// (*word) >> 13 == 0
 	// (*(word+1) >> 13 == 1
 
-	uint32_t raw = (((*word) & 0x0fff) << 12) + ((*(++word)) & 0x0fff);
-	try {
-	  // Check if this is just fill bits of the TBM09 data stream
-	  // accounting for the other channel:
-	  if(GetEnvelopeType() >= TBM_09 && (raw&0xffffff) == 0xffffff) {
-	    LOG(logDEBUGPIPES) << "Empty hit detected (TBM09 data streams). Skipping.";
-	    continue;
-	  }
-
-	  // Get the correct ROC id: Channel number x ROC offset (= token chain length)
-	  // TBM08x: channel 0: 0-7, channel 1: 8-15
-	  // TBM09x: channel 0: 0-3, channel 1: 4-7, channel 2: 8-11, channel 3: 12-15
-	  pixel pix(raw,static_cast<uint8_t>(roc_n + GetTokenChainOffset()),invertedAddress,linearAddress);
-	  roc_Event.pixels.push_back(pix);
-	  decodingStats.m_info_pixels_valid++;
-	}
-	catch(DataInvalidAddressError /*&e*/){
-	  // decoding of raw address lead to invalid address
-	  decodingStats.m_errors_pixel_address++;
-	}
-	catch(DataInvalidPulseheightError /*&e*/){
-	  // decoding of pulse height featured non-zero fill bit
-	  decodingStats.m_errors_pixel_pulseheight++;
-	}
-	catch(DataCorruptBufferError /*&e*/){
-	  // decoding returned row 80 - corrupt data buffer
-	  decodingStats.m_errors_pixel_buffer_corrupt++;
-	}
+	// Collect the run of consecutive hit word pairs following this ROC header:
+	std::vector<uint16_t>::iterator last = word;
+	while(sample->data.end() - last >= 2 && ((*last) & 0xe000) <= 0x2000) { last += 2; }
+
+	// Get the correct ROC id: Channel number x ROC offset (= token chain length)
+	// TBM08x: channel 0: 0-7, channel 1: 8-15
+	// TBM09x: channel 0: 0-3, channel 1: 4-7, channel 2: 8-11, channel 3: 12-15
+	// Fill bits of the TBM09 data stream accounting for the other channel are skipped.
+	DecodeHits(&(*word), (last - word)/2, static_cast<uint8_t>(roc_n + GetTokenChainOffset()),
+		   invertedAddress, linearAddress, GetEnvelopeType() >= TBM_09);
+	word = last - 1;
       }
     }
 
@@ -345,6 +393,10 @@ namespace pxar {
       roc_Event.pixels.reserve((sample->GetSize() - 3*GetTokenChainLength())/6);
     }
 
+    // Storage for the six analog levels of one pixel hit:
+    std::vector<uint16_t> data;
+    data.reserve(6);
+
     // Loop over the full data:
     for(std::vector<uint16_t>::iterator word = sample->data.begin(); word != sample->data.end(); word++) {
 
@@ -386,20 +438,13 @@ namespace pxar {
 	  break;
 	}
 
-	std::vector<uint16_t> data;
+	data.clear();
 	data.push_back((*word) & 0x0fff);
 	for(size_t i = 0; i < 5; i++) { data.push_back((*(++word)) & 0x0fff); }
 
-	try{
-	  LOG(logDEBUGPIPES) << "Trying to decode pixel: " << listVector(data,false,true);
-	  pixel pix(data,roc_n,ultrablack,black);
-	  roc_Event.pixels.push_back(pix);
-	  decodingStats.m_info_pixels_valid++;
-	}
-	catch(DataDecodingError /*&e*/){
-	  // decoding of raw address lead to invalid address
-	  decodingStats.m_errors_pixel_address++;
-	}
+	LOG(logDEBUGPIPES) << "Trying to decode pixel: " << listVector(data,false,true);
+	pixel pix;
+	countPixel(pix.decode(data,roc_n,ultrablack,black),pix);
       }
     }
 
@@ -443,24 +488,12 @@ namespace pxar {
 	  continue;
 	}
 
-	uint32_t raw = (((*word) & 0x0fff) << 12) + ((*(++word)) & 0x0fff);
-	try {
-	  pixel pix(raw,roc_n,invertedAddress,linearAddress);
-	  roc_Event.pixels.push_back(pix);
-	  decodingStats.m_info_pixels_valid++;
-	}
-	catch(DataInvalidAddressError /*&e*/) {
-	  // decoding of raw address lead to invalid address
-	  decodingStats.m_errors_pixel_address++;
-	}
-	catch(DataInvalidPulseheightError /*&e*/) {
-	  // decoding of pulse height featured non-zero fill bit
-	  decodingStats.m_errors_pixel_pulseheight++;
-	}
-	catch(DataCorruptBufferError /*&e*/) {
-	  // decoding returned row 80 - corrupt data buffer
-	  decodingStats.m_errors_pixel_buffer_corrupt++;
-	}
+	// Collect the run of hit word pairs up to the next ROC header:
+	std::vector<uint16_t>::iterator last = word;
+	while(sample->data.end() - last >= 2 && ((*last) & 0x0ffc) != 0x07f8) { last += 2; }
+
+	DecodeHits(&(*word), (last - word)/2, static_cast<uint8_t>(roc_n), invertedAddress, linearAddress, false);
+	word = last - 1;
       }
     }
 
@@ -468,6 +501,54 @@ namespace pxar {
     CheckEventValidity(roc_n);
   }
 
+  void dtbEventDecoder::DecodeHits(const uint16_t * words, size_t npairs, uint8_t roc, bool invertedAddress, bool linearAddress, bool skipEmpty) {
+
+    // Decode the full run at once into the scratch buffers:
+    if(hit_status.size() < npairs) {
+      hit_column.resize(npairs);
+      hit_row.resize(npairs);
+      hit_value.resize(npairs);
+      hit_status.resize(npairs);
+    }
+    hitDecoder::decodePairs(words, npairs, invertedAddress, linearAddress, &hit_column[0], &hit_row[0], &hit_value[0], &hit_status[0]);
+
+    for(size_t i = 0; i < npairs; i++) {
+      if(skipEmpty && (words[2*i] & 0x0fff) == 0x0fff && (words[2*i+1] & 0x0fff) == 0x0fff) {
+	LOG(logDEBUGPIPES) << "Empty hit detected (TBM09 data streams). Skipping.";
+	continue;
+      }
+
+      pixelStatus status = static_cast<pixelStatus>(hit_status[i]);
+      if(status != PIXEL_VALID) {
+	LOG(logDEBUGPIPES) << "Invalid pixel from raw value of " << std::hex
+			   << (((words[2*i] & 0x0fff) << 12) | (words[2*i+1] & 0x0fff)) << std::dec;
+      }
+      pixel pix(roc, hit_column[i], hit_row[i], hit_value[i]);
+      countPixel(status, pix);
+    }
+  }
+
+  void dtbEventDecoder::countPixel(pixelStatus status, pixel & pix) {
+    switch(status) {
+    case PIXEL_VALID:
+      roc_Event.pixels.push_back(pix);
+      decodingStats.m_info_pixels_valid++;
+      break;
+    case PIXEL_INVALID_ADDRESS:
+      // decoding of raw address lead to invalid address
+      decodingStats.m_errors_pixel_address++;
+      break;
+    case PIXEL_INVALID_PULSEHEIGHT:
+      // decoding of pulse height featured non-zero fill bit
+      decodingStats.m_errors_pixel_pulseheight++;
+      break;
+    case PIXEL_CORRUPT_BUFFER:
+      // decoding returned row 80 - corrupt data buffer
+      decodingStats.m_errors_pixel_buffer_corrupt++;
+      break;
+    }
+  }
+
   void dtbEventDecoder::CheckEventID() {
     // After startup, register the first event ID:
     if(eventID == -1) { eventID = roc_Event.triggerCount(); }
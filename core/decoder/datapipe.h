@@ -30,6 +30,11 @@ namespace pxar {
     virtual uint8_t ReadTokenChainOffset() = 0;
     virtual uint8_t ReadEnvelopeType() = 0;
     virtual uint8_t ReadDeviceType() = 0;
+    // Optional direct access to the samples buffered after the last one read.
+    // Returns their number, zero if the buffer is exhausted or not accessible:
+    virtual size_t ReadBuffered(const T *& /*data*/) { return 0; }
+    // Consume samples obtained from ReadBuffered(), the last one becomes ReadLast():
+    virtual void SkipBuffered(size_t /*n*/) {}
   public:
     virtual ~dataSource() {}
     template <class S> friend class dataSink;
@@ -56,22 +61,54 @@ namespace pxar {
   // Formward declaration of dataPipe class:
   template <class TI, class TO> class dataPipe;
 
+  // Properties of a data stream, constant for a DAQ session:
+  struct streamProperties {
+    uint8_t channel;
+    uint16_t flags;
+    uint8_t chainlength;
+    uint8_t chainoffset;
+    uint8_t envelopetype;
+    uint8_t devicetype;
+  streamProperties() : channel(0), flags(0), chainlength(0), chainoffset(0), envelopetype(0), devicetype(0) {}
+  };
+
   template <class T> 
     class dataSink {
   protected: 
     dataSource<T> *src;
     static nullSource<T> null;
+    // Stream properties cached by CacheProperties(), dropped when connecting to another source:
+    bool cached;
+    streamProperties properties;
   public: 
-  dataSink() : src(&null) {}
+  dataSink() : src(&null), cached(false), properties() {}
     T GetLast() { return src->ReadLast(); }
     T Get() { return src->Read(); }
-    uint8_t GetChannel() { return src->ReadChannel(); }
-    uint16_t GetFlags() { return src->ReadFlags(); }
-    uint8_t GetTokenChainLength() { return src->ReadTokenChainLength(); }
-    uint8_t GetTokenChainOffset() { return src->ReadTokenChainOffset(); }
-    uint8_t GetEnvelopeType() { return src->ReadEnvelopeType(); }
-    uint8_t GetDeviceType() { return src->ReadDeviceType(); }
+    uint8_t GetChannel() { return cached ? properties.channel : src->ReadChannel(); }
+    uint16_t GetFlags() { return cached ? properties.flags : src->ReadFlags(); }
+    uint8_t GetTokenChainLength() { return cached ? properties.chainlength : src->ReadTokenChainLength(); }
+    uint8_t GetTokenChainOffset() { return cached ? properties.chainoffset : src->ReadTokenChainOffset(); }
+    uint8_t GetEnvelopeType() { return cached ? properties.envelopetype : src->ReadEnvelopeType(); }
+    uint8_t GetDeviceType() { return cached ? properties.devicetype : src->ReadDeviceType(); }
+    size_t GetBuffered(const T *& data) { return src->ReadBuffered(data); }
+    void Skip(size_t n) { src->SkipBuffered(n); }
     void GetAll() { while (true) Get(); }
+
+    // Fetch the stream properties once from the connected source instead of
+    // querying them through the whole pipe on every access. To be called after
+    // connecting, e.g. at the start of a DAQ session:
+    void CacheProperties() {
+      cached = false;
+      properties.channel = GetChannel();
+      properties.flags = GetFlags();
+      properties.chainlength = GetTokenChainLength();
+      properties.chainoffset = GetTokenChainOffset();
+      properties.envelopetype = GetEnvelopeType();
+      properties.devicetype = GetDeviceType();
+      cached = true;
+    }
+    // Drop the cached properties, e.g. when the source has been replaced in place:
+    void ClearProperties() { cached = false; }
     template <class TI, class TO> friend void operator >> (dataSource<TI> &, dataSink<TO> &); 
     template  <class TI, class TO> friend dataSource<TO>& operator >> (dataSource<TI> &in, dataPipe<TI,TO> &out);
   };
@@ -86,12 +123,14 @@ namespace pxar {
   // Operator to connect source -> sink; source -> datapipe
   template <class TI, class TO>
     void operator >> (dataSource<TI> &in, dataSink<TO> &out) {
+    if(out.src != &in) { out.cached = false; }
     out.src = &in;
   }
     
   // Operator to connect source -> datapipe -> datapipe -> sink
   template <class TI, class TO>
     dataSource<TO>& operator >> (dataSource<TI> &in, dataPipe<TI,TO> &out) {
+    if(out.src != &in) { out.cached = false; }
     out.src = &in;
     return out;
   }
@@ -125,6 +164,11 @@ namespace pxar {
     void SplitDeser400();
     void SplitSoftTBM();
 
+    // Add samples to the record until one matching either marker pattern is read,
+    // scanning the source buffer in blocks. Returns false if stopped at the event
+    // size limit instead of a marker, the last sample read is available from GetLast():
+    bool CollectUntil(uint16_t mask1, uint16_t marker1, uint16_t mask2, uint16_t marker2, bool stopAtOverflow);
+
     bool nextStartDetected;
   public:
   dtbEventSplitter() :
@@ -167,6 +211,14 @@ namespace pxar {
     void ProcessTBMTrailer(uint16_t t1, uint16_t t2);
     statistics decodingStats;
 
+    // Decode a run of digital hit word pairs and store the valid pixels:
+    void DecodeHits(const uint16_t * words, size_t npairs, uint8_t roc, bool invertedAddress, bool linearAddress, bool skipEmpty);
+    std::vector<uint8_t> hit_column, hit_row, hit_status;
+    std::vector<int16_t> hit_value;
+
+    // Store a successfully decoded pixel or count the decoding error:
+    void countPixel(pixelStatus status, pixel & pix);
+
     // Readback decoding:
     void evalReadback(uint8_t roc, uint16_t val);
     std::vector<bool> readback_dirty;
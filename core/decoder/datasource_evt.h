@@ -30,6 +30,17 @@ namespace pxar {
       if(!connected) throw dpNotConnected();
       return lastSample;
     }
+    size_t ReadBuffered(const uint16_t *& data) {
+      if(!connected) throw dpNotConnected();
+      if(pos >= buffer.size()) return 0;
+      data = &buffer[pos];
+      return buffer.size() - pos;
+    }
+    void SkipBuffered(size_t n) {
+      if(n == 0) return;
+      pos += n;
+      lastSample = buffer[pos-1];
+    }
     uint8_t ReadChannel() {
       if(!connected) throw dpNotConnected();
       return channel;
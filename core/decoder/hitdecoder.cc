@@ -0,0 +1,248 @@
+#include "hitdecoder.h"
+#include "constants.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define PXAR_HITDECODER_X86
+#include <immintrin.h>
+#endif
+
+namespace pxar {
+
+  namespace {
+
+    // Address lookup tables, filled once on first use:
+    struct hitTables {
+      // Raw address mode: row and column parity indexed by the row bits 9-17 of the raw hit:
+      uint8_t row[512];
+      uint8_t parity[512];
+      // Raw address mode: double column base address indexed by the column bits 18-23:
+      uint8_t column[64];
+      // Linear address mode, indexed by bits 9-16 and bits 17-23 respectively:
+      uint8_t linrow[256];
+      uint8_t lincolumn[128];
+
+      hitTables() {
+	for(int i = 0; i < 512; i++) {
+	  int r = ((i >> 6) & 7)*36 + ((i >> 3) & 7)*6 + (i & 7);
+	  row[i] = static_cast<uint8_t>(80 - r/2);
+	  parity[i] = static_cast<uint8_t>(r&1);
+	}
+	for(int i = 0; i < 64; i++) { column[i] = static_cast<uint8_t>(2*(((i >> 3) & 7)*6 + (i & 7))); }
+	for(int i = 0; i < 256; i++) { linrow[i] = static_cast<uint8_t>((i & 0x07) + ((i >> 1) & 0x78)); }
+	for(int i = 0; i < 128; i++) { lincolumn[i] = static_cast<uint8_t>((i & 0x07) + ((i >> 1) & 0x38)); }
+      }
+    };
+
+    const hitTables & tables() {
+      static const hitTables t;
+      return t;
+    }
+
+    inline uint32_t joinPair(const uint16_t * words) {
+      return (static_cast<uint32_t>(words[0] & 0x0fff) << 12) | (words[1] & 0x0fff);
+    }
+
+#ifdef PXAR_HITDECODER_X86
+    // Vectorized decoding of four hit word pairs per iteration. A 32 bit lane loaded
+    // from the 16 bit word stream holds one pair, first word in the lower half.
+    void decodePairsSSE2(const uint16_t * words, size_t npairs, bool invert, bool linear,
+			 uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status) {
+
+      const __m128i m12 = _mm_set1_epi32(0xfff);
+      const __m128i m3 = _mm_set1_epi32(0x7);
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i flip = _mm_set1_epi32(invert ? 0x3fe00 : 0);
+
+      int32_t c[4], r[4], v[4], s[4];
+      size_t i = 0;
+      for(; i + 4 <= npairs; i += 4) {
+	__m128i lane = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + 2*i));
+	__m128i raw = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(lane, m12), 12),
+				   _mm_and_si128(_mm_srli_epi32(lane, 16), m12));
+
+	// Pulse height and its fill bit:
+	__m128i ph = _mm_add_epi32(_mm_and_si128(raw, _mm_set1_epi32(0x0f)),
+				   _mm_and_si128(_mm_srli_epi32(raw, 1), _mm_set1_epi32(0xf0)));
+	__m128i badph = _mm_cmpeq_epi32(_mm_and_si128(raw, _mm_set1_epi32(0x10)), _mm_set1_epi32(0x10));
+
+	__m128i vr, vc, fill;
+	if(linear) {
+	  vc = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(raw, 17), m3),
+			     _mm_and_si128(_mm_srli_epi32(raw, 18), _mm_set1_epi32(0x38)));
+	  vr = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(raw, 9), m3),
+			     _mm_and_si128(_mm_srli_epi32(raw, 10), _mm_set1_epi32(0x78)));
+	  fill = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(raw, _mm_set1_epi32(0x101000)), zero),
+				  _mm_set1_epi32(-1));
+	}
+	else {
+	  __m128i a = _mm_xor_si128(raw, flip);
+	  // r = (r2*6 + r1)*6 + r0, multiplying by six as (x<<2) + (x<<1):
+	  __m128i t = _mm_and_si128(_mm_srli_epi32(a, 15), m3);
+	  t = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(t, 2), _mm_slli_epi32(t, 1)), _mm_and_si128(_mm_srli_epi32(a, 12), m3));
+	  t = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(t, 2), _mm_slli_epi32(t, 1)), _mm_and_si128(_mm_srli_epi32(a, 9), m3));
+	  vr = _mm_sub_epi32(_mm_set1_epi32(80), _mm_srli_epi32(t, 1));
+
+	  __m128i u = _mm_and_si128(_mm_srli_epi32(raw, 21), m3);
+	  u = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(u, 2), _mm_slli_epi32(u, 1)), _mm_and_si128(_mm_srli_epi32(raw, 18), m3));
+	  vc = _mm_add_epi32(_mm_slli_epi32(u, 1), _mm_and_si128(t, _mm_set1_epi32(1)));
+	  fill = zero;
+	}
+
+	// Range checks, applied in the order of pxar::pixel::decode():
+	__m128i corrupt = _mm_cmpeq_epi32(vr, _mm_set1_epi32(ROC_NUMROWS));
+	__m128i outside = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi32(vr, zero),
+						    _mm_cmpgt_epi32(vr, _mm_set1_epi32(ROC_NUMROWS-1))),
+				       _mm_cmpgt_epi32(vc, _mm_set1_epi32(ROC_NUMCOLS-1)));
+	__m128i st = _mm_and_si128(outside, _mm_set1_epi32(PIXEL_INVALID_ADDRESS));
+	st = _mm_or_si128(_mm_and_si128(corrupt, _mm_set1_epi32(PIXEL_CORRUPT_BUFFER)), _mm_andnot_si128(corrupt, st));
+	st = _mm_or_si128(_mm_and_si128(fill, _mm_set1_epi32(PIXEL_INVALID_ADDRESS)), _mm_andnot_si128(fill, st));
+	st = _mm_or_si128(_mm_and_si128(badph, _mm_set1_epi32(PIXEL_INVALID_PULSEHEIGHT)), _mm_andnot_si128(badph, st));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(c), vc);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(r), vr);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(v), ph);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(s), st);
+	for(size_t k = 0; k < 4; k++) {
+	  column[i+k] = static_cast<uint8_t>(c[k]);
+	  row[i+k] = static_cast<uint8_t>(r[k]);
+	  value[i+k] = static_cast<int16_t>(v[k]);
+	  status[i+k] = static_cast<uint8_t>(s[k]);
+	}
+      }
+
+      if(i < npairs) {
+	hitDecoder::decodePairsScalar(words + 2*i, npairs - i, invert, linear, column + i, row + i, value + i, status + i);
+      }
+    }
+
+    // Same as decodePairsSSE2() with eight hit word pairs per iteration:
+    __attribute__((target("avx2")))
+    void decodePairsAVX2(const uint16_t * words, size_t npairs, bool invert, bool linear,
+			 uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status) {
+
+      const __m256i m12 = _mm256_set1_epi32(0xfff);
+      const __m256i m3 = _mm256_set1_epi32(0x7);
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i flip = _mm256_set1_epi32(invert ? 0x3fe00 : 0);
+
+      int32_t c[8], r[8], v[8], s[8];
+      size_t i = 0;
+      for(; i + 8 <= npairs; i += 8) {
+	__m256i lane = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + 2*i));
+	__m256i raw = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(lane, m12), 12),
+				      _mm256_and_si256(_mm256_srli_epi32(lane, 16), m12));
+
+	__m256i ph = _mm256_add_epi32(_mm256_and_si256(raw, _mm256_set1_epi32(0x0f)),
+				      _mm256_and_si256(_mm256_srli_epi32(raw, 1), _mm256_set1_epi32(0xf0)));
+	__m256i badph = _mm256_cmpeq_epi32(_mm256_and_si256(raw, _mm256_set1_epi32(0x10)), _mm256_set1_epi32(0x10));
+
+	__m256i vr, vc, fill;
+	if(linear) {
+	  vc = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(raw, 17), m3),
+				_mm256_and_si256(_mm256_srli_epi32(raw, 18), _mm256_set1_epi32(0x38)));
+	  vr = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(raw, 9), m3),
+				_mm256_and_si256(_mm256_srli_epi32(raw, 10), _mm256_set1_epi32(0x78)));
+	  fill = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(raw, _mm256_set1_epi32(0x101000)), zero),
+				     _mm256_set1_epi32(-1));
+	}
+	else {
+	  __m256i a = _mm256_xor_si256(raw, flip);
+	  __m256i t = _mm256_and_si256(_mm256_srli_epi32(a, 15), m3);
+	  t = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(t, 2), _mm256_slli_epi32(t, 1)), _mm256_and_si256(_mm256_srli_epi32(a, 12), m3));
+	  t = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(t, 2), _mm256_slli_epi32(t, 1)), _mm256_and_si256(_mm256_srli_epi32(a, 9), m3));
+	  vr = _mm256_sub_epi32(_mm256_set1_epi32(80), _mm256_srli_epi32(t, 1));
+
+	  __m256i u = _mm256_and_si256(_mm256_srli_epi32(raw, 21), m3);
+	  u = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(u, 2), _mm256_slli_epi32(u, 1)), _mm256_and_si256(_mm256_srli_epi32(raw, 18), m3));
+	  vc = _mm256_add_epi32(_mm256_slli_epi32(u, 1), _mm256_and_si256(t, _mm256_set1_epi32(1)));
+	  fill = zero;
+	}
+
+	__m256i corrupt = _mm256_cmpeq_epi32(vr, _mm256_set1_epi32(ROC_NUMROWS));
+	__m256i outside = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(zero, vr),
+							  _mm256_cmpgt_epi32(vr, _mm256_set1_epi32(ROC_NUMROWS-1))),
+					  _mm256_cmpgt_epi32(vc, _mm256_set1_epi32(ROC_NUMCOLS-1)));
+	__m256i st = _mm256_and_si256(outside, _mm256_set1_epi32(PIXEL_INVALID_ADDRESS));
+	st = _mm256_blendv_epi8(st, _mm256_set1_epi32(PIXEL_CORRUPT_BUFFER), corrupt);
+	st = _mm256_blendv_epi8(st, _mm256_set1_epi32(PIXEL_INVALID_ADDRESS), fill);
+	st = _mm256_blendv_epi8(st, _mm256_set1_epi32(PIXEL_INVALID_PULSEHEIGHT), badph);
+
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(c), vc);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(r), vr);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(v), ph);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(s), st);
+	for(size_t k = 0; k < 8; k++) {
+	  column[i+k] = static_cast<uint8_t>(c[k]);
+	  row[i+k] = static_cast<uint8_t>(r[k]);
+	  value[i+k] = static_cast<int16_t>(v[k]);
+	  status[i+k] = static_cast<uint8_t>(s[k]);
+	}
+      }
+
+      if(i < npairs) {
+	hitDecoder::decodePairsScalar(words + 2*i, npairs - i, invert, linear, column + i, row + i, value + i, status + i);
+      }
+    }
+
+    bool hasAVX2() {
+      static const bool avx2 = __builtin_cpu_supports("avx2");
+      return avx2;
+    }
+#endif
+
+  } // namespace
+
+  pixelStatus hitDecoder::decode(uint32_t raw, bool invert, bool linear, uint8_t & column, uint8_t & row, int16_t & value) {
+    const hitTables & t = tables();
+
+    value = static_cast<int16_t>((raw & 0x0f) + ((raw >> 1) & 0xf0));
+    if(raw & 0x10) { return PIXEL_INVALID_PULSEHEIGHT; }
+
+    if(linear) {
+      if(raw & 0x101000) { return PIXEL_INVALID_ADDRESS; }
+      row = t.linrow[(raw >> 9) & 0xff];
+      column = t.lincolumn[(raw >> 17) & 0x7f];
+    }
+    else {
+      uint32_t r = (raw >> 9) & 0x1ff;
+      if(invert) { r ^= 0x1ff; }
+      row = t.row[r];
+      column = t.column[(raw >> 18) & 0x3f] + t.parity[r];
+    }
+
+    if(row >= ROC_NUMROWS || column >= ROC_NUMCOLS) {
+      if(row == ROC_NUMROWS) return PIXEL_CORRUPT_BUFFER;
+      else return PIXEL_INVALID_ADDRESS;
+    }
+    return PIXEL_VALID;
+  }
+
+  void hitDecoder::decodePairsScalar(const uint16_t * words, size_t npairs, bool invert, bool linear,
+				     uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status) {
+    for(size_t i = 0; i < npairs; i++) {
+      status[i] = static_cast<uint8_t>(decode(joinPair(words + 2*i), invert, linear, column[i], row[i], value[i]));
+    }
+  }
+
+  void hitDecoder::decodePairs(const uint16_t * words, size_t npairs, bool invert, bool linear,
+			       uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status) {
+#ifdef PXAR_HITDECODER_X86
+    // Short runs, e.g. a single hit per ROC, are not worth the vector setup:
+    if(npairs < 4) { decodePairsScalar(words, npairs, invert, linear, column, row, value, status); }
+    else if(hasAVX2()) { decodePairsAVX2(words, npairs, invert, linear, column, row, value, status); }
+    else { decodePairsSSE2(words, npairs, invert, linear, column, row, value, status); }
+#else
+    decodePairsScalar(words, npairs, invert, linear, column, row, value, status);
+#endif
+  }
+
+  std::string hitDecoder::vectorExtension() {
+#ifdef PXAR_HITDECODER_X86
+    if(hasAVX2()) return "AVX2";
+    return "SSE2";
+#else
+    return "none";
+#endif
+  }
+
+}
@@ -0,0 +1,34 @@
+#ifndef PXAR_HITDECODER_H
+#define PXAR_HITDECODER_H
+
+#include <string>
+#include "datatypes.h"
+
+namespace pxar {
+
+  // Fast decoding of digital pixel hits. The pixel address is taken from
+  // precomputed lookup tables instead of the multiplications and divisions
+  // done in pxar::pixel::decode(). Runs of consecutive hit word pairs can be
+  // decoded in bulk, using SSE2 or AVX2 where available with a scalar fallback.
+  // The returned status codes and addresses are bit-exact with pxar::pixel::decode().
+  class hitDecoder {
+  public:
+    // Decode one raw 24 bit hit word:
+    static pixelStatus decode(uint32_t raw, bool invert, bool linear, uint8_t & column, uint8_t & row, int16_t & value);
+
+    // Decode "npairs" consecutive hit word pairs. The first word of each pair carries
+    // the upper, the second word the lower 12 bits of the raw hit. Results are written
+    // to the column, row, value and status arrays which have to hold npairs entries.
+    static void decodePairs(const uint16_t * words, size_t npairs, bool invert, bool linear,
+			    uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status);
+
+    // Same as decodePairs() but always using the scalar table lookup:
+    static void decodePairsScalar(const uint16_t * words, size_t npairs, bool invert, bool linear,
+				  uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status);
+
+    // Name of the vector extension used by decodePairs():
+    static std::string vectorExtension();
+  };
+
+}
+#endif
@@ -0,0 +1,177 @@
+#include "thresholdfinder.h"
+#include "constants.h"
+#include <cstdlib>
+#include <exception>
+#include <thread>
+
+namespace pxar {
+
+  thresholdFinder::thresholdFinder(uint16_t thr, uint8_t np, uint8_t p) :
+    threshold(thr), nparts(np > 0 ? np : 1), part(p), table(MOD_NUMROCS*ROC_NUMCOLS*ROC_NUMROWS), pixels(), index(), first(), hits(0) {
+    for(std::vector<state>::iterator it = table.begin(); it != table.end(); ++it) {
+      it->index = -1; it->last = 0; it->found = false;
+    }
+  }
+
+  void thresholdFinder::Add(uint8_t dac, const std::vector<pixel> & hitlist) {
+    for(std::vector<pixel>::const_iterator px = hitlist.begin(); px != hitlist.end(); ++px, ++hits) {
+      // Leave the ROCs of other parts to their finders:
+      if(nparts > 1 && px->roc()%nparts != part) continue;
+
+      size_t i = (static_cast<size_t>(px->roc())*ROC_NUMCOLS + px->column())*ROC_NUMROWS + px->row();
+
+      // Make room for ROC ids beyond a full module:
+      if(i >= table.size()) {
+	state empty = {-1, 0, false};
+	table.resize((static_cast<size_t>(px->roc()) + 1)*ROC_NUMCOLS*ROC_NUMROWS, empty);
+      }
+
+      state & s = table[i];
+
+      // Threshold has been found already for this pixel, skip the rest:
+      if(s.found) continue;
+
+      uint8_t value = static_cast<uint8_t>(px->value());
+
+      // Pixel is known:
+      if(s.index >= 0) {
+	// Calculate efficiency deltas and slope:
+	uint8_t delta_old = abs(s.last - threshold);
+	uint8_t delta_new = abs(value - threshold);
+	bool positive_slope = (value - s.last > 0 ? true : false);
+
+	// Check which value is closer to the threshold. Only if the slope is positive AND
+	// the new delta between value and threshold is *larger* then the old delta, we
+	// found the threshold. If slope is negative, we just have a ripple in the DAC's
+	// distribution:
+	if(positive_slope && !(delta_new < delta_old)) {
+	  s.found = true;
+	  continue;
+	}
+
+	// No threshold found yet, update the DAC threshold value for the pixel:
+	pixels[s.index].setValue(dac);
+	s.last = value;
+      }
+      // Pixel is new, just adding it:
+      else {
+	// If the pixel is above threshold at first appearance, the respective
+	// DAC value is set as its threshold:
+	if(px->value() >= threshold) { s.found = true; }
+
+	// Store the pixel with current DAC as value field and its original efficiency:
+	s.last = value;
+	s.index = static_cast<int32_t>(pixels.size());
+	pixels.push_back(*px);
+	pixels.back().setValue(dac);
+	index.push_back(i);
+	first.push_back(hits);
+      }
+    }
+  }
+
+  void thresholdFinder::Fill(std::vector<pixel> & result, uint8_t fallback, std::vector<pixel> & missing) {
+    result.reserve(result.size() + pixels.size());
+    for(size_t p = 0; p < pixels.size(); p++) {
+      result.push_back(pixels[p]);
+      // The pixel never reached the threshold:
+      if(!table[index[p]].found) {
+	result.back().setValue(fallback);
+	missing.push_back(result.back());
+      }
+    }
+    Reset();
+  }
+
+  void thresholdFinder::Collect(partial & out) {
+    out.found.resize(pixels.size());
+    for(size_t p = 0; p < pixels.size(); p++) { out.found[p] = table[index[p]].found; }
+    out.pixels.swap(pixels);
+    out.first.swap(first);
+    Reset();
+  }
+
+  void thresholdFinder::Reset() {
+    for(std::vector<size_t>::const_iterator i = index.begin(); i != index.end(); ++i) {
+      table[*i].index = -1;
+      table[*i].found = false;
+    }
+    pixels.clear();
+    index.clear();
+    first.clear();
+    hits = 0;
+  }
+
+  void thresholdFinder::Process(const std::vector<thresholdScan> * scans, std::vector<partial> * out, std::exception_ptr * error) {
+    try {
+      out->resize(scans->size());
+      for(size_t s = 0; s < scans->size(); s++) {
+	for(thresholdScan::const_iterator it = scans->at(s).begin(); it != scans->at(s).end(); ++it) { Add(it->first, *it->second); }
+	Collect(out->at(s));
+      }
+    }
+    catch(...) {
+      // Hand the exception over to the merging thread:
+      *error = std::current_exception();
+    }
+  }
+
+  void thresholdFinder::Find(const std::vector<thresholdScan> & scans, uint16_t threshold, uint8_t fallback, size_t nthreads,
+			     std::vector<std::vector<pixel> > & results, std::vector<std::vector<pixel> > & missing) {
+
+    // Small scans are not worth starting threads:
+    size_t nhits = 0;
+    for(std::vector<thresholdScan>::const_iterator sc = scans.begin(); sc != scans.end(); ++sc) {
+      for(thresholdScan::const_iterator it = sc->begin(); it != sc->end(); ++it) { nhits += it->second->size(); }
+    }
+    if(nhits < 16384 || nthreads < 1) { nthreads = 1; }
+    if(nthreads > 255) { nthreads = 255; }
+
+    // One finder per thread, each taking care of every nthreads-th ROC:
+    std::vector<thresholdFinder> finders;
+    for(size_t t = 0; t < nthreads; t++) { finders.push_back(thresholdFinder(threshold, static_cast<uint8_t>(nthreads), static_cast<uint8_t>(t))); }
+    std::vector<std::vector<partial> > parts(nthreads);
+    std::vector<std::exception_ptr> errors(nthreads);
+
+    if(nthreads == 1) { finders.front().Process(&scans, &parts.front(), &errors.front()); }
+    else {
+      std::vector<std::thread> workers;
+      for(size_t t = 0; t < nthreads; t++) {
+	workers.push_back(std::thread(&thresholdFinder::Process, &finders.at(t), &scans, &parts.at(t), &errors.at(t)));
+      }
+      for(size_t t = 0; t < workers.size(); t++) { workers.at(t).join(); }
+    }
+
+    // Forward errors from the worker threads:
+    for(size_t t = 0; t < errors.size(); t++) {
+      if(errors.at(t)) { std::rethrow_exception(errors.at(t)); }
+    }
+
+    // Merge the threads by first appearance of the pixels:
+    results.resize(scans.size());
+    missing.resize(scans.size());
+    std::vector<size_t> next(nthreads);
+    for(size_t s = 0; s < scans.size(); s++) {
+      size_t total = 0;
+      for(size_t t = 0; t < nthreads; t++) { next.at(t) = 0; total += parts.at(t).at(s).pixels.size(); }
+      results.at(s).reserve(results.at(s).size() + total);
+
+      for(size_t n = 0; n < total; n++) {
+	size_t best = nthreads;
+	for(size_t t = 0; t < nthreads; t++) {
+	  partial & p = parts.at(t).at(s);
+	  if(next.at(t) < p.first.size() && (best == nthreads || p.first.at(next.at(t)) < parts.at(best).at(s).first.at(next.at(best)))) { best = t; }
+	}
+	partial & p = parts.at(best).at(s);
+	results.at(s).push_back(p.pixels.at(next.at(best)));
+	// The pixel never reached the threshold:
+	if(!p.found.at(next.at(best))) {
+	  results.at(s).back().setValue(fallback);
+	  missing.at(s).push_back(results.at(s).back());
+	}
+	next.at(best)++;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,82 @@
+#ifndef PXAR_THRESHOLDFINDER_H
+#define PXAR_THRESHOLDFINDER_H
+
+#include <vector>
+#include <exception>
+#include "datatypes.h"
+
+namespace pxar {
+
+  // One efficiency scan: the DAC values in scan direction with the pixel efficiencies
+  // measured there.
+  typedef std::vector<std::pair<uint8_t, const std::vector<pixel>*> > thresholdScan;
+
+  // Extraction of pixel thresholds from efficiency scans. The efficiencies are fed
+  // one DAC value after the other in scan direction, the per-pixel state (position
+  // in the result, last efficiency, threshold found) is kept in a dense table indexed
+  // by ROC, column and row, so the extraction is linear in the number of hits.
+  // Only the entries touched by the current scan are reset afterwards.
+  class thresholdFinder {
+  public:
+    // The threshold is given as number of hits. With "nparts" given, only the ROCs
+    // with roc % nparts == part are taken into account:
+    thresholdFinder(uint16_t threshold, uint8_t nparts = 1, uint8_t part = 0);
+
+    // Add the pixel efficiencies measured at one DAC value:
+    void Add(uint8_t dac, const std::vector<pixel> & pixels);
+
+    // Append all pixels in the order of their first appearance to "result", with the
+    // threshold DAC value as pixel value, and start a new scan. Pixels which never
+    // crossed threshold get "fallback" as value and are appended to "missing" as well:
+    void Fill(std::vector<pixel> & result, uint8_t fallback, std::vector<pixel> & missing);
+
+    // Number of pixels seen in the current scan:
+    size_t size() const { return pixels.size(); }
+
+    // Drop the current scan:
+    void Reset();
+
+    // Extract the thresholds for all "scans", distributing the ROCs over up to
+    // "nthreads" threads. Per scan, the pixels are returned in the order of their first
+    // appearance as with Fill(), merged from all threads:
+    static void Find(const std::vector<thresholdScan> & scans, uint16_t threshold, uint8_t fallback, size_t nthreads,
+		     std::vector<std::vector<pixel> > & results, std::vector<std::vector<pixel> > & missing);
+
+  private:
+    struct state {
+      int32_t index;
+      uint8_t last;
+      bool found;
+    };
+
+    // Pixels of one scan extracted by one thread, with the position of their first
+    // appearance among all hits of the scan:
+    struct partial {
+      std::vector<pixel> pixels;
+      std::vector<size_t> first;
+      std::vector<bool> found;
+    };
+
+    // Move the current scan to "out" and start a new scan:
+    void Collect(partial & out);
+
+    // Run all "scans" through this finder, as worker thread of Find():
+    void Process(const std::vector<thresholdScan> * scans, std::vector<partial> * out, std::exception_ptr * error);
+
+    uint16_t threshold;
+    uint8_t nparts;
+    uint8_t part;
+
+    // Dense table, MOD_NUMROCS ROCs initially, grown for higher ROC ids:
+    std::vector<state> table;
+
+    // Pixels of the current scan in order of appearance, their table index and the
+    // position of their first appearance among all hits added:
+    std::vector<pixel> pixels;
+    std::vector<size_t> index;
+    std::vector<size_t> first;
+    size_t hits;
+  };
+
+}
+#endif
@@ -393,8 +393,15 @@ uint8_t CTestboard::Daq_Read(std::vector<uint16_t> &data, uint32_t blocksize, ui
 }
 
 uint8_t CTestboard::Daq_Read(std::vector<uint16_t> &data, uint32_t blocksize, uint32_t &available, uint8_t channel) {
+  uint32_t size = 0;
+  uint8_t state = Daq_ReadInto(data, size, blocksize, available, channel);
+  data.resize(size);
+  return state;
+}
+
+uint8_t CTestboard::Daq_ReadInto(std::vector<uint16_t> &buffer, uint32_t &size, uint32_t blocksize, uint32_t &available, uint8_t channel) {
   LOG(pxar::logDEBUGRPC) << "called.";
-  data.clear();
+  size = 0;
 
   // Fake buffer empty after 1k events:
   if(eventcounter >= 1000) {
@@ -417,7 +424,9 @@ uint8_t CTestboard::Daq_Read(std::vector<uint16_t> &data, uint32_t blocksize, ui
   std::vector<uint16_t>::iterator copy_end =
     (blocksize/2 < daq_buffer.at(channel).size() ? (daq_buffer.at(channel).begin() + blocksize/2) : daq_buffer.at(channel).end());
 
-  data.insert(data.end(),daq_buffer.at(channel).begin(),copy_end);
+  size = copy_end - daq_buffer.at(channel).begin();
+  if(buffer.size() < size) { buffer.resize(size); }
+  std::copy(daq_buffer.at(channel).begin(),copy_end,buffer.begin());
   daq_buffer.at(channel).erase(daq_buffer.at(channel).begin(),copy_end);
   
   return 0;
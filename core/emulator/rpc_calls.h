@@ -18,6 +18,17 @@ class CRpcError {
   void What() {};
 };
 
+#define RPC_LATENCY_BINS 24
+
+struct CRpcCallTotals {
+  uint64_t calls;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t time_total;
+  uint64_t time_max;
+  uint32_t latency[RPC_LATENCY_BINS];
+};
+
 class CTestboard {
 
   uint16_t vd, va, id, ia;
@@ -60,6 +71,12 @@ class CTestboard {
   };
   uint32_t GetRpcCallHash() { return 0x0; };
   bool RpcLink() { return true; }
+  std::vector<int32_t> GetRpcCallIds() { return std::vector<int32_t>(); }
+  void SetRpcCallIds(const std::vector<int32_t> &) {}
+  std::string GetHostRpcTimestamp() { return ""; }
+  // No RPC calls to collect statistics for:
+  void GetRpcStatistics(std::map<std::string, CRpcCallTotals> &) {}
+  void ClearRpcStatistics() {}
 
 
   // === DTB connection ====================================================
@@ -78,6 +95,13 @@ class CTestboard {
 
   void ClearInterface() {}
 
+  // There are no transfers to record or replay:
+  bool StartRecording(const std::string &) { return false; }
+  void StopRecording() {}
+  bool Recording() { return false; }
+  bool SelectReplay(bool) { return false; }
+  bool Replaying() { return false; }
+
 
   uint32_t GetInterfaceListSize() { return 1; }
 
@@ -94,6 +118,13 @@ class CTestboard {
   void Flush() { }
   void Clear() { }
 
+  // === command batching ==================================================
+  // Calls are executed immediately, there is nothing to collect:
+  void BatchBegin() { }
+  void BatchEnd() { }
+  void BatchAbort() { }
+  bool InBatch() { return false; }
+
 
   // === DTB identification ================================================
 
@@ -217,6 +248,7 @@ class CTestboard {
   uint8_t Daq_FillLevel();
   uint8_t Daq_Read(std::vector<uint16_t> &data, uint32_t blocksize = 65536, uint8_t channel = 0);
   uint8_t Daq_Read(std::vector<uint16_t> &data, uint32_t blocksize, uint32_t &availsize, uint8_t channel = 0);
+  uint8_t Daq_ReadInto(std::vector<uint16_t> &buffer, uint32_t &size, uint32_t blocksize, uint32_t &availsize, uint8_t channel = 0);
 	
 
   void Daq_Select_ADC(uint16_t blocksize, uint8_t source, uint8_t start, uint8_t stop = 0);
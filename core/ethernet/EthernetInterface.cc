@@ -1,3 +1,4 @@
+#include <cstring>
 #include "EthernetInterface.h"
 #include "rpc_error.h"
 #include "config.h"
@@ -168,12 +169,18 @@ CEthernet::~CEthernet(){
 }
 
 void CEthernet::Write(const void *buffer, unsigned int size){
-    for(unsigned int i = 0 ; i < size; i++){
+    // copy in blocks of what fits into the frame, sending it when full:
+    const unsigned char* data = static_cast<const unsigned char*>(buffer);
+    while(size > 0){
         if(tx_payload_size == MAX_TX_DATA){
             Flush();
         }
-        tx_frame[ETH_HEADER_SIZE + tx_payload_size] = ((char*)buffer)[i];
-        tx_payload_size++;
+        unsigned int n = MAX_TX_DATA - tx_payload_size;
+        if(n > size) n = size;
+        memcpy(tx_frame + ETH_HEADER_SIZE + tx_payload_size, data, n);
+        tx_payload_size += n;
+        data += n;
+        size -= n;
     }
 }
 void CEthernet::Flush(){
@@ -206,60 +213,76 @@ void CEthernet::Flush(){
 void CEthernet::Clear(){
     tx_payload_size = 0;
     rx_buffer.clear();
+    rx_pos = 0;
 }
 void CEthernet::Read(void *buffer, unsigned int size){
+    unsigned char* data = static_cast<unsigned char*>(buffer);
+
+    // data left over from the last frame:
+    unsigned int n = rx_buffer.size() - rx_pos;
+    if(n > size) n = size;
+    if(n > 0){
+        memcpy(data, &rx_buffer[rx_pos], n);
+        rx_pos += n;
+        data += n;
+        size -= n;
+    }
+
+    // copy the payload of new frames straight to the caller, keep what is not requested:
+    while(size > 0){
+        unsigned int rx_payload_size;
+        const unsigned char* payload = ReceiveFrame(rx_payload_size);
+        n = (rx_payload_size > size) ? size : rx_payload_size;
+        memcpy(data, payload, n);
+        data += n;
+        size -= n;
+        rx_buffer.assign(payload + n, payload + rx_payload_size);
+        rx_pos = 0;
+    }
+}
+const unsigned char* CEthernet::ReceiveFrame(unsigned int &payload_size){
     int timeout = 10000;
-    for(unsigned int i = 0; i < size; i++){
-        if(!rx_buffer.empty()){
-            ((unsigned char*)buffer)[i] = rx_buffer.front();
-            rx_buffer.pop_front();
-        } else{
-            const unsigned char* rx_frame = pcap_next(descr, &header);
-            if(rx_frame == NULL){
-                timeout--;
-                i--;
-                if(timeout == 0){
-                    printf("Error reading from ethernet.\n");
-                    throw CRpcError(CRpcError::TIMEOUT);
-                }
+    while(true){
+        const unsigned char* rx_frame = pcap_next(descr, &header);
+        if(rx_frame == NULL){
+            timeout--;
+            if(timeout == 0){
+                printf("Error reading from ethernet.\n");
+                throw CRpcError(CRpcError::TIMEOUT);
             }
+            continue;
+        }
 
-	    IFLOG(logINTERFACE) {
-	      std::stringstream st;
-	      st << std::uppercase << std::hex;
-	      for(size_t i = 0; i < header.len; i++){
-		st << std::setw(2) << std::setfill('0') << rx_frame[i];
-	      }
-	      st << std::nouppercase << std::dec;
-	      LOG(logINTERFACE) << "Received packet: " << st.str();
-	    }
-
-            if(header.len < ETH_HEADER_SIZE){ // malformed message
-                i--;
-                continue;
-            }
+	IFLOG(logINTERFACE) {
+	  std::stringstream st;
+	  st << std::uppercase << std::hex;
+	  for(size_t i = 0; i < header.len; i++){
+	    st << std::setw(2) << std::setfill('0') << rx_frame[i];
+	  }
+	  st << std::nouppercase << std::dec;
+	  LOG(logINTERFACE) << "Received packet: " << st.str();
+	}
+
+        if(header.len < ETH_HEADER_SIZE){ // malformed message
+            continue;
+        }
             
-            if(!packet_equals(rx_frame,host_mac,6) || 
-               !packet_equals(rx_frame+14,host_pid,2) ||
-               rx_frame[16] != 0) {
-				   i--;
-				   continue;
-			   }
-	    LOG(logINTERFACE) << "Passed Filter.";
-			
-            unsigned int rx_payload_size = rx_frame[17];
-            rx_payload_size = (rx_payload_size << 8) | rx_frame[18];
-
-            for(unsigned int j =0; j < rx_payload_size;j++){
-                rx_buffer.push_back(rx_frame[j + ETH_HEADER_SIZE]);
-            }
-            i--;
+        if(!packet_equals(rx_frame,host_mac,6) || 
+           !packet_equals(rx_frame+14,host_pid,2) ||
+           rx_frame[16] != 0) {
+            continue;
         }
+	LOG(logINTERFACE) << "Passed Filter.";
+
+        payload_size = rx_frame[17];
+        payload_size = (payload_size << 8) | rx_frame[18];
+        return rx_frame + ETH_HEADER_SIZE;
     }
 }
 
 void CEthernet::InitInterface(){
-    rx_buffer.resize(0);
+    rx_buffer.clear();
+    rx_pos = 0;
     for(int i =0; i < TX_FRAME_SIZE; i++){
         tx_frame[i] = 0;
     }
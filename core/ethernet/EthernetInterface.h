@@ -1,7 +1,6 @@
 #ifndef PXAR_ETHERNET_H
 #define PXAR_ETHERNET_H
 
-#include <deque>
 #include <string>
 #include <vector>
 #include <ctime>
@@ -23,6 +22,7 @@
 class CEthernet : public CRpcIo
 {
     void InitInterface();
+    const unsigned char* ReceiveFrame(unsigned int &payload_size);
     
     void Hello();
     bool Claim(const unsigned char* MAC, bool force);
@@ -38,7 +38,9 @@ class CEthernet : public CRpcIo
     
     unsigned char host_pid[2];
     
-    std::deque<unsigned char>    rx_buffer;
+    // payload received but not read yet: rx_buffer[rx_pos] to the end
+    std::vector<unsigned char>   rx_buffer;
+    size_t             rx_pos;
     unsigned char      tx_frame[TX_FRAME_SIZE];
     unsigned char      dtb_mac[6];
     unsigned char      host_mac[6];
@@ -7,29 +7,164 @@
 
 namespace pxar {
 
+  uint8_t dtbSource::ReadBlock(std::vector<uint16_t> & block, uint32_t & size) {
+    uint32_t remaining = dtbRemainingSize;
+    uint8_t state;
+    if(rpcLock) {
+      std::lock_guard<std::mutex> lock(*rpcLock);
+      state = tb->Daq_ReadInto(block, size, DTB_SOURCE_BLOCK_SIZE, remaining, channel);
+    }
+    else { state = tb->Daq_ReadInto(block, size, DTB_SOURCE_BLOCK_SIZE, remaining, channel); }
+    dtbRemainingSize = remaining;
+    dtbState = state;
+    return state;
+  }
+
   uint16_t dtbSource::FillBuffer() {
     pos = 0;
     do {
-      dtbState = tb->Daq_Read(buffer, DTB_SOURCE_BLOCK_SIZE, dtbRemainingSize, channel);
+      ReadBlock(buffer, fill);
     
-      if (buffer.size() == 0) {
+      if (fill == 0) {
 	if (stopAtEmptyData) throw dsBufferEmpty();
 	if (dtbState) throw dsBufferOverflow();
       }
-    } while (buffer.size() == 0);
+    } while (fill == 0);
 
     LOG(logDEBUGPIPES) << "-------------------------";
     LOG(logDEBUGPIPES) << "Channel " << static_cast<int>(channel)
 		       << " (" << static_cast<int>(chainlength) << " ROCs, "
 		       << static_cast<int>(chainlengthOffset) << "-" << static_cast<int>(chainlengthOffset+chainlength-1)<< ")"
 		       << (envelopetype == TBM_NONE ? " DESER160 " : (envelopetype == TBM_EMU ? " SOFTTBM " : " DESER400 "));
-    LOG(logDEBUGPIPES) << "Remaining " << static_cast<int>(dtbRemainingSize);
+    LOG(logDEBUGPIPES) << "Remaining " << static_cast<int>(dtbRemainingSize.load());
     LOG(logDEBUGPIPES) << "-------------------------";
     LOG(logDEBUGPIPES) << "FULL RAW DATA BLOB:";
-    LOG(logDEBUGPIPES) << listVector(buffer,true);
+    LOG(logDEBUGPIPES) << listVector(std::vector<uint16_t>(buffer.begin(), buffer.begin() + fill),true);
     LOG(logDEBUGPIPES) << "-------------------------";
 
     return lastSample = buffer[pos++];
   }
 
+  void dtbPrefetchSource::Connect(dtbSource * source, size_t depth) {
+    Halt();
+    src = source;
+    lastSample = src->lastSample;
+    blocks.resize(depth > 0 ? depth : 1);
+    blockFill.assign(blocks.size(), 0);
+    head = tail = filled = 0;
+
+    // Continue with the data the source has buffered but not delivered yet:
+    current.swap(src->buffer);
+    currentFill = src->fill;
+    pos = src->pos;
+    src->pos = src->fill = 0;
+  }
+
+  void dtbPrefetchSource::Halt() {
+    {
+      std::lock_guard<std::mutex> lock(ringLock);
+      halt = true;
+    }
+    spaceReady.notify_all();
+    if(reader.joinable()) reader.join();
+
+    // Hand the data read from the DTB but not consumed yet back to the attached
+    // source, the next read without prefetching continues with it:
+    if(src && (pos < currentFill || filled > 0)) {
+      std::vector<uint16_t> & data = src->buffer;
+      data.assign(current.begin() + pos, current.begin() + currentFill);
+      for(size_t i = 0; i < filled; i++) {
+	size_t block = (tail+i)%blocks.size();
+	data.insert(data.end(), blocks.at(block).begin(), blocks.at(block).begin() + blockFill.at(block));
+      }
+      src->pos = 0;
+      src->fill = data.size();
+      LOG(logDEBUGPIPES) << "Channel " << static_cast<int>(src->channel)
+			 << " handed " << data.size() << " prefetched words back.";
+    }
+    if(src) { src->lastSample = lastSample; }
+
+    head = tail = filled = 0;
+    currentFill = 0;
+    pos = 0;
+    halt = endOfData = false;
+    readerError = std::exception_ptr();
+  }
+
+  void dtbPrefetchSource::ReaderLoop() {
+    try {
+      while(1) {
+	std::unique_lock<std::mutex> lock(ringLock);
+	// Back-pressure: wait for the consumer to release a block:
+	while(filled == blocks.size() && !halt) spaceReady.wait(lock);
+	if(halt) break;
+	std::vector<uint16_t> & block = blocks.at(head);
+	uint32_t & size = blockFill.at(head);
+	lock.unlock();
+
+	// The block at "head" is not accessed by the consumer until it is marked filled:
+	uint8_t state = src->ReadBlock(block, size);
+	if(size == 0) {
+	  if(src->stopAtEmptyData) break;
+	  if(state) throw dsBufferOverflow();
+	  continue;
+	}
+
+	LOG(logDEBUGPIPES) << "Channel " << static_cast<int>(src->channel)
+			   << " prefetched " << size << " words, remaining "
+			   << static_cast<int>(src->dtbRemainingSize.load());
+
+	lock.lock();
+	head = (head+1)%blocks.size();
+	filled++;
+	lock.unlock();
+	dataReady.notify_one();
+      }
+    }
+    catch(...) {
+      // Hand the exception over to the consumer:
+      std::lock_guard<std::mutex> lock(ringLock);
+      readerError = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(ringLock);
+    endOfData = true;
+    dataReady.notify_one();
+  }
+
+  uint16_t dtbPrefetchSource::NextBlock() {
+    if(!src) throw dpNotConnected();
+
+    // (Re-)start the reader thread:
+    if(!reader.joinable()) { reader = std::thread(&dtbPrefetchSource::ReaderLoop, this); }
+
+    std::unique_lock<std::mutex> lock(ringLock);
+    while(filled == 0 && !endOfData) dataReady.wait(lock);
+
+    // The reader has finished and everything has been consumed:
+    if(filled == 0) {
+      lock.unlock();
+      reader.join();
+      endOfData = false;
+      head = tail = 0;
+      if(readerError) {
+	std::exception_ptr error = readerError;
+	readerError = std::exception_ptr();
+	std::rethrow_exception(error);
+      }
+      throw dsBufferEmpty();
+    }
+
+    // Swap the filled block in, the consumed one goes back to the ring:
+    current.swap(blocks.at(tail));
+    currentFill = blockFill.at(tail);
+    tail = (tail+1)%blocks.size();
+    filled--;
+    lock.unlock();
+    spaceReady.notify_one();
+
+    pos = 0;
+    return lastSample = current[pos++];
+  }
+
 }
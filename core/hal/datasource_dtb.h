@@ -2,14 +2,29 @@
 #define PXAR_DATASOURCE_DTB_H
 
 #include <stdexcept>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
 #include "datapipe.h"
 #include "rpc_calls.h"
 
 namespace pxar {
 
+  // Atomic member which is copied along with the source holding it:
+  template <class T> class copyableAtomic : public std::atomic<T> {
+  public:
+    copyableAtomic(T value = T()) : std::atomic<T>(value) {}
+    copyableAtomic(const copyableAtomic & other) : std::atomic<T>(other.load()) {}
+    copyableAtomic & operator=(const copyableAtomic & other) { this->store(other.load()); return *this; }
+    copyableAtomic & operator=(T value) { this->store(value); return *this; }
+  };
+
   // DTB data source class
   class dtbSource : public dataSource<uint16_t> {
-    volatile bool stopAtEmptyData;
+    // Set by Stop() while a prefetch reader may be reading the channel:
+    copyableAtomic<bool> stopAtEmptyData;
 
     // --- DTB control/state
     CTestboard * tb;
@@ -17,27 +32,42 @@ namespace pxar {
     uint16_t flags;
     uint8_t chainlength;
     uint8_t chainlengthOffset;
-    uint32_t dtbRemainingSize;
-    uint8_t  dtbState;
+    // Written by the reading thread, polled by the HAL through GetState()/GetRemainingSize():
+    copyableAtomic<uint32_t> dtbRemainingSize;
+    copyableAtomic<uint8_t>  dtbState;
     bool connected;
+    std::mutex * rpcLock;
     uint8_t envelopetype;
     uint8_t devicetype;
 
-    // --- data buffer
+    // --- data buffer: the first "fill" words of the reused block storage are valid
     uint16_t lastSample;
     unsigned int pos;
+    uint32_t fill;
     std::vector<uint16_t> buffer;
     uint16_t FillBuffer();
+    uint8_t ReadBlock(std::vector<uint16_t> & block, uint32_t & size);
 
     // --- virtual data access methods
     uint16_t Read() { 
       if(!connected) throw dpNotConnected();
-      return (pos < buffer.size()) ? lastSample = buffer[pos++] : FillBuffer();
+      return (pos < fill) ? lastSample = buffer[pos++] : FillBuffer();
     }
     uint16_t ReadLast() {
       if(!connected) throw dpNotConnected();
       return lastSample;
     }
+    size_t ReadBuffered(const uint16_t *& data) {
+      if(!connected) throw dpNotConnected();
+      if(pos >= fill) return 0;
+      data = &buffer[pos];
+      return fill - pos;
+    }
+    void SkipBuffered(size_t n) {
+      if(n == 0) return;
+      pos += n;
+      lastSample = buffer[pos-1];
+    }
     uint8_t ReadChannel() {
       if(!connected) throw dpNotConnected();
       return channel;
@@ -64,14 +94,106 @@ namespace pxar {
     }
   public:
   dtbSource(CTestboard * src, uint8_t daqchannel, uint8_t tokenChainLength, uint8_t offset, uint8_t tbmtype, uint8_t roctype, bool endlessStream, uint16_t daqflags = 0)
-    : stopAtEmptyData(endlessStream), tb(src), channel(daqchannel), flags(daqflags), chainlength(tokenChainLength), chainlengthOffset(offset), connected(true), envelopetype(tbmtype), devicetype(roctype), lastSample(0x4000), pos(0) {}
-  dtbSource() : connected(false) {}
+    : stopAtEmptyData(endlessStream), tb(src), channel(daqchannel), flags(daqflags), chainlength(tokenChainLength), chainlengthOffset(offset), dtbRemainingSize(0), dtbState(0), connected(true), rpcLock(NULL), envelopetype(tbmtype), devicetype(roctype), lastSample(0x4000), pos(0), fill(0) {}
+  dtbSource() : stopAtEmptyData(false), tb(NULL), channel(0), flags(0), chainlength(0), chainlengthOffset(0), dtbRemainingSize(0), dtbState(0), connected(false), rpcLock(NULL), envelopetype(0), devicetype(0), lastSample(0x4000), pos(0), fill(0) {}
     bool isConnected() { return connected; }
 
+    // Take over the block storage of the source previously used for the channel,
+    // so it is allocated only once:
+    void TakeBuffer(dtbSource & previous) { buffer.swap(previous.buffer); }
+
+    // Serialize the DTB access with other sources, needed when reading from several threads:
+    void SetLock(std::mutex * lock) { rpcLock = lock; }
+
     // --- control and status
     uint8_t  GetState() { return dtbState; }
     uint32_t GetRemainingSize() { return dtbRemainingSize; }
     void Stop() { stopAtEmptyData = true; }
+
+    friend class dtbPrefetchSource;
+  };
+
+  // DTB data source reading ahead: a reader thread keeps requesting the next
+  // DTB_SOURCE_BLOCK_SIZE block from the attached dtbSource channel while the
+  // previous ones are consumed. Blocks are kept in a bounded ring, the reader
+  // waits when all blocks are filled. The reader stops at the first empty block
+  // and is restarted by the next read access.
+  class dtbPrefetchSource : public dataSource<uint16_t> {
+    // --- attached DTB channel
+    dtbSource * src;
+
+    // --- ring of prefetched blocks, reused storage with the number of valid words
+    std::vector<std::vector<uint16_t> > blocks;
+    std::vector<uint32_t> blockFill;
+    size_t head, tail, filled;
+    bool endOfData, halt;
+    std::exception_ptr readerError;
+    std::mutex ringLock;
+    std::condition_variable dataReady, spaceReady;
+    std::thread reader;
+    void ReaderLoop();
+
+    // --- block currently consumed
+    uint16_t lastSample;
+    unsigned int pos;
+    uint32_t currentFill;
+    std::vector<uint16_t> current;
+    uint16_t NextBlock();
+
+    // --- virtual data access methods
+    uint16_t Read() {
+      return (pos < currentFill) ? lastSample = current[pos++] : NextBlock();
+    }
+    uint16_t ReadLast() {
+      if(!src) throw dpNotConnected();
+      return lastSample;
+    }
+    size_t ReadBuffered(const uint16_t *& data) {
+      if(!src) throw dpNotConnected();
+      if(pos >= currentFill) return 0;
+      data = &current[pos];
+      return currentFill - pos;
+    }
+    void SkipBuffered(size_t n) {
+      if(n == 0) return;
+      pos += n;
+      lastSample = current[pos-1];
+    }
+    uint8_t ReadChannel() {
+      if(!src) throw dpNotConnected();
+      return src->ReadChannel();
+    }
+    uint16_t ReadFlags() {
+      if(!src) throw dpNotConnected();
+      return src->ReadFlags();
+    }
+    uint8_t ReadTokenChainLength() {
+      if(!src) throw dpNotConnected();
+      return src->ReadTokenChainLength();
+    }
+    uint8_t ReadTokenChainOffset() {
+      if(!src) throw dpNotConnected();
+      return src->ReadTokenChainOffset();
+    }
+    uint8_t ReadEnvelopeType() {
+      if(!src) throw dpNotConnected();
+      return src->ReadEnvelopeType();
+    }
+    uint8_t ReadDeviceType() {
+      if(!src) throw dpNotConnected();
+      return src->ReadDeviceType();
+    }
+  public:
+  dtbPrefetchSource() : src(NULL), head(0), tail(0), filled(0), endOfData(false), halt(false), lastSample(0x4000), pos(0), currentFill(0) {}
+    ~dtbPrefetchSource() { Halt(); }
+
+    // Attach to a DTB channel source, reading ahead up to "depth" blocks:
+    void Connect(dtbSource * source, size_t depth = DTB_SOURCE_PREFETCH_BLOCKS);
+
+    // Stop the reader thread and hand the stream position back to the attached
+    // source. Data already prefetched but not yet consumed is discarded.
+    void Halt();
+    bool isConnected() { return (src != NULL); }
   };
 
 }
@@ -5,7 +5,11 @@
 #include "config.h"
 #include "constants.h"
 #include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
 #include <algorithm>
+#include <thread>
 
 using namespace pxar;
 
@@ -24,17 +28,53 @@ hal::hal(std::string name, bool doDaq_MemReset) :
   m_roccount(0),
   m_tokenchains(),
   m_daqstatus(),
+  m_daqflags(0),
   _currentTrgSrc(TRG_SEL_PG_DIR),
+  m_queueabort(false),
   m_src(),
   m_splitter(),
-  m_decoder()
+  m_decoder(),
+  m_condenser(),
+  m_condenseTriggers(0),
+  m_condenseEfficiency(false),
+  m_condensedTriggers(0),
+  m_eventHandler(),
+  m_handledEvents(0),
+  m_progressHandler(),
+  m_expectedEvents(0),
+  m_rocTrims(),
+  m_niosI2Cs(),
+  m_niosI2CsValid(false),
+  m_rocDacs(),
+  m_tbmRegs(),
+  m_pendingDacs(),
+  m_pendingTbmRegs(),
+  m_registerStats()
 {
 
   // Get a new CTestboard class instance:
   _testboard = new CTestboard();
 
-  // Check if any boards are connected:
-  FindDTB(name);
+  // Replay a recorded DTB session instead of connecting to a board, the
+  // replies are delayed like in the recording unless PXAR_RPC_REPLAY_TIMING is 0:
+  const char * replay = std::getenv("PXAR_RPC_REPLAY");
+  const char * timing = std::getenv("PXAR_RPC_REPLAY_TIMING");
+  bool timed = (timing == NULL || std::string(timing) != "0");
+  if(replay != NULL && *replay != '\0' && _testboard->SelectReplay(timed)) {
+    name = replay;
+    LOG(logINFO) << "Replaying DTB session " << name;
+  }
+  else {
+    // Check if any boards are connected:
+    FindDTB(name);
+
+    // Record the session with the board if requested:
+    const char * record = std::getenv("PXAR_RPC_RECORD");
+    if(record != NULL && *record != '\0') {
+      if(_testboard->StartRecording(record)) { LOG(logINFO) << "Recording DTB session to " << record; }
+      else { LOG(logERROR) << "Could not record DTB session to " << record; }
+    }
+  }
 
   // Open the testboard connection:
   if(_testboard->Open(name)) {
@@ -48,6 +88,9 @@ hal::hal(std::string name, bool doDaq_MemReset) :
 	// Set compatibility flag
 	_compatible = true;
 
+	// Resolve all RPC calls now instead of at their first use:
+	LinkRpcCalls();
+
 	// ...and do the obligatory welcome LED blink:
 	_testboard->Welcome();
 	_testboard->Flush();
@@ -131,6 +174,9 @@ uint32_t hal::GetHashForStringVector(const std::vector<std::string> & v)
 
 void hal::initTestboard(std::map<uint8_t,uint8_t> sig_delays, std::vector<std::pair<uint16_t,uint8_t> > pg_setup, uint16_t delaysum, double va, double vd, double ia, double id) {
 
+  // Send the whole testboard setup in one transfer:
+  rpcBatch batch(this);
+
   // Set the power limits:
   setTestboardPower(va,vd,ia,id);
 
@@ -139,6 +185,7 @@ void hal::initTestboard(std::map<uint8_t,uint8_t> sig_delays, std::vector<std::p
 
   // Set up Pattern Generator:
   SetupPatternGenerator(pg_setup,delaysum);
+  batch.send();
 
   // We are ready for operations now, mark the HAL as initialized:
   _initialized = true;
@@ -255,8 +302,10 @@ void hal::SetupPatternGenerator(std::vector<std::pair<uint16_t,uint8_t> > pg_set
 		     << " del " << static_cast<int>((*it).second) << ")";
   }
 
+  rpcBatch batch(this);
   _testboard->Pg_SetCmdAll(cmd);
   _testboard->Pg_SetSum(delaysum);
+  batch.send();
 
   // Since the last delay is known to be zero we don't have to overwrite the rest of the address range -
   // the Pattern generator will stop automatically at that point.
@@ -332,6 +381,9 @@ bool hal::flashTestboard(std::ifstream& flashFile) {
 
 void hal::initTBMCore(tbmConfig tbm) {
 
+  // Send the TBM setup in one transfer:
+  rpcBatch batch(this);
+
   // Turn the TBM on:
   _testboard->tbm_Enable(true);
 
@@ -348,6 +400,7 @@ void hal::initTBMCore(tbmConfig tbm) {
   LOG(logDEBUGHAL) << "Setting register vector for TBM Core " << tbm.corename() << ".";
   if(tbm.NoTokenPass()) { LOG(logDEBUGHAL) << "This TBM has the NoTokenPass register set!"; }
   tbmSetRegs(tbm.hubid,tbm.core,tbm.dacs);
+  batch.send();
 }
 
 void hal::setTBMType(uint8_t type) {
@@ -368,7 +421,12 @@ void hal::initROC(uint8_t roci2c, uint8_t type, std::map< uint8_t,uint8_t > dacV
 
   // Programm all DAC registers according to the configuration data:
   LOG(logDEBUGHAL) << "Setting DAC vector for ROC@I2C " << static_cast<int>(roci2c) << ".";
+  rpcBatch batch(this);
   rocSetDACs(roci2c,dacVector);
+  batch.send();
+
+  // The PUC state of the ROC is unknown until it is masked or trimmed:
+  m_rocTrims.erase(roci2c);
 }
 
 void hal::PrintInfo() {
@@ -427,6 +485,90 @@ bool hal::CheckCompatibility() {
   return true;
 }
 
+void hal::LinkRpcCalls() {
+
+  // Nothing to resolve without RPC layer:
+  std::vector<int32_t> ids = _testboard->GetRpcCallIds();
+  if(ids.empty()) return;
+
+  // Recorded sessions always contain the full negotiation, so they replay
+  // independent of the cache on either machine:
+  std::string path;
+  const char * env = std::getenv("PXAR_RPC_CACHE");
+  if(_testboard->Recording() || _testboard->Replaying()) { env = ""; }
+  if(env != NULL) { path = env; }
+  else {
+#ifdef WIN32
+    env = std::getenv("USERPROFILE");
+#else
+    env = std::getenv("HOME");
+#endif
+    if(env != NULL) { path = std::string(env) + "/.pxar_rpccache"; }
+  }
+
+  // The cached ids are valid for the same DTB firmware and host RPC layer:
+  std::ostringstream key;
+  key << "fw " << _testboard->GetFWVersion() << " hash " << _testboard->GetRpcCallHash()
+      << " timestamp " << _testboard->GetHostRpcTimestamp();
+  std::vector<std::string> names = _testboard->GetHostRpcCallNames();
+
+  // Calls cached with id -1 are missing on this DTB and count as resolved,
+  // they have been reported when the cache was written:
+  if(!path.empty()) {
+    std::ifstream cache(path.c_str());
+    std::string line;
+    if(std::getline(cache, line) && line == key.str()) {
+      std::map<std::string,int32_t> table;
+      std::string name;
+      int32_t id;
+      while(cache >> name >> id) { table[name] = id; }
+      size_t unresolved = 0, missing = 0;
+      for(size_t i = 2; i < names.size() && i < ids.size(); i++) {
+	if(ids[i] >= 0) continue;
+	std::map<std::string,int32_t>::iterator it = table.find(names[i]);
+	if(it == table.end()) { unresolved++; continue; }
+	ids[i] = it->second;
+	if(ids[i] < 0) { missing++; }
+      }
+      _testboard->SetRpcCallIds(ids);
+
+      if(unresolved == 0) {
+	LOG(logDEBUGHAL) << "RPC call ids read from cache " << path
+			 << ", " << missing << " functions missing on the DTB.";
+	return;
+      }
+    }
+  }
+
+  // Negotiate all ids still unknown in one round trip. Functions missing on the
+  // DTB are reported here and cached with id -1:
+  if(std::count_if(ids.begin() + 2, ids.end(), [](int32_t id) { return id < 0; }) > 0) { _testboard->RpcLink(); }
+
+  // Write the cache in one go, concurrent sessions never read a partial file:
+  if(path.empty()) return;
+  std::string tmppath = path + ".tmp";
+  {
+    std::ofstream cache(tmppath.c_str());
+    if(!cache) {
+      LOG(logDEBUGHAL) << "Could not write RPC call id cache " << tmppath;
+      return;
+    }
+    cache << key.str() << std::endl;
+    ids = _testboard->GetRpcCallIds();
+    for(size_t i = 2; i < names.size() && i < ids.size(); i++) { cache << names[i] << " " << ids[i] << std::endl; }
+  }
+#ifdef WIN32
+  // Windows does not replace existing files on rename:
+  std::remove(path.c_str());
+#endif
+  if(std::rename(tmppath.c_str(), path.c_str()) != 0) {
+    LOG(logDEBUGHAL) << "Could not write RPC call id cache " << path;
+    std::remove(tmppath.c_str());
+    return;
+  }
+  LOG(logDEBUGHAL) << "RPC call ids written to cache " << path;
+}
+
 bool hal::FindDTB(std::string &rpcId) {
 
   // Try to access interfaces:
@@ -563,6 +705,9 @@ void hal::setHubId(uint8_t hub0, uint8_t hub1) {
 
 bool hal::rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs) {
 
+  // Queued writes go first, they would overwrite these values otherwise:
+  flushRegisters();
+
   // Make sure we are writing to the correct ROC by setting the I2C address:
   _testboard->roc_I2cAddr(roci2c);
 
@@ -578,6 +723,7 @@ bool hal::rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs) {
 
     LOG(logDEBUGHAL) << "Set DAC" << static_cast<int>(it->first) << " to " << static_cast<int>(it->second);
     _testboard->roc_SetDAC(it->first,it->second);
+    m_rocDacs[roci2c][it->first] = it->second;
     if(it->first == ROC_DAC_WBC) { is_wbc = true; }
   }
 
@@ -585,6 +731,7 @@ bool hal::rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs) {
   if(rangetemp != dacPairs.end()) {
     LOG(logDEBUGHAL) << "Set DAC" << static_cast<int>(rangetemp->first) << " to " << static_cast<int>(rangetemp->second);
     _testboard->roc_SetDAC(rangetemp->first,rangetemp->second);
+    m_rocDacs[roci2c][rangetemp->first] = rangetemp->second;
   }
 
   // Make sure to issue a ROC Reset after WBC has been programmed:
@@ -599,30 +746,135 @@ bool hal::rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs) {
   return true;
 }
 
-bool hal::rocSetDAC(uint8_t roci2c, uint8_t dacId, uint8_t dacValue) {
+bool hal::rocSetDAC(uint8_t roci2c, uint8_t dacId, uint8_t dacValue, bool flush) {
 
-  // Make sure we are writing to the correct ROC by setting the I2C address:
-  _testboard->roc_I2cAddr(roci2c);
+  m_registerStats.m_dac_writes++;
+
+  // Drop the write if the ROC has this value already, this saves both the I2C
+  // address selection and the DAC write:
+  std::map<uint8_t,uint8_t> & dacs = m_rocDacs[roci2c];
+  std::map<uint8_t,uint8_t>::iterator dac = dacs.find(dacId);
+  if(dac != dacs.end() && dac->second == dacValue) {
+    LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<size_t>(roci2c)
+		     << ": DAC" << static_cast<int>(dacId) << " is " << static_cast<int>(dacValue) << " already.";
+    m_registerStats.m_dac_writes_skipped++;
+    m_registerStats.m_rpcs_saved += 2;
+    return true;
+  }
 
   LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<size_t>(roci2c)
 		   << ": Set DAC" << static_cast<int>(dacId) << " to " << static_cast<int>(dacValue);
-  _testboard->roc_SetDAC(dacId,dacValue);
+  dacs[dacId] = dacValue;
+  m_pendingDacs[roci2c][dacId] = dacValue;
+
+  // If requested, send it immediately:
+  if(flush) flushRegisters();
+  return true;
+}
+
+void hal::flushRegisters() {
+
+  if(m_pendingDacs.empty() && m_pendingTbmRegs.empty()) return;
+
+  size_t writes = 0;
+  bool is_wbc = false;
+
+  // Select every ROC once and write all of its queued DACs:
+  for(std::map<uint8_t, std::map<uint8_t,uint8_t> >::iterator roc = m_pendingDacs.begin(); roc != m_pendingDacs.end(); ++roc) {
+    _testboard->roc_I2cAddr(roc->first);
+
+    // RangeTemp is written last, this allows to read its value via lastDAC:
+    std::map<uint8_t,uint8_t>::iterator rangetemp = roc->second.end();
+    for(std::map<uint8_t,uint8_t>::iterator it = roc->second.begin(); it != roc->second.end(); ++it) {
+      if(it->first == ROC_DAC_RangeTemp) { rangetemp = it; continue; }
+      _testboard->roc_SetDAC(it->first,it->second);
+      if(it->first == ROC_DAC_WBC) { is_wbc = true; }
+    }
+    if(rangetemp != roc->second.end()) { _testboard->roc_SetDAC(rangetemp->first,rangetemp->second); }
+
+    writes += roc->second.size();
+    m_registerStats.m_rpcs_saved += roc->second.size() - 1;
+  }
+
+  // Select every TBM hub once and write all of its queued registers:
+  for(std::map<uint8_t, std::map<uint8_t,uint8_t> >::iterator tbm = m_pendingTbmRegs.begin(); tbm != m_pendingTbmRegs.end(); ++tbm) {
+    _testboard->mod_Addr(tbm->first);
+    for(std::map<uint8_t,uint8_t>::iterator it = tbm->second.begin(); it != tbm->second.end(); ++it) {
+      _testboard->tbm_Set(it->first,it->second);
+    }
+
+    writes += tbm->second.size();
+    m_registerStats.m_rpcs_saved += tbm->second.size() - 1;
+  }
+
+  LOG(logDEBUGHAL) << "Sending " << writes << " queued register writes to the testboard.";
+  m_pendingDacs.clear();
+  m_pendingTbmRegs.clear();
   _testboard->Flush();
+  m_registerStats.m_flushes_saved += writes - 1;
 
-  // Make sure to issue a ROC Reset after the DAc WBC has been programmed:
-  if(dacId == ROC_DAC_WBC) {
+  // Make sure to issue a ROC Reset after the DAC WBC has been programmed:
+  if(is_wbc) {
     LOG(logDEBUGHAL) << "WBC has been programmed - sending a ROC Reset command.";
     daqTriggerSingleSignal(TRG_SEND_RSR);
   }
-  return true;
+}
+
+void hal::batchBegin() {
+  _testboard->BatchBegin();
+}
+
+void hal::batchEnd(bool abort) {
+  if(abort) { _testboard->BatchAbort(); }
+  else { _testboard->BatchEnd(); }
+}
+
+registerStatistics hal::registerStats() {
+  registerStatistics stats = m_registerStats;
+  m_registerStats.clear();
+  return stats;
+}
+
+rpcStatistics hal::rpcStats() {
+  std::map<std::string, CRpcCallTotals> calls;
+  _testboard->GetRpcStatistics(calls);
+  _testboard->ClearRpcStatistics();
+
+  rpcStatistics stats;
+  for(std::map<std::string, CRpcCallTotals>::iterator it = calls.begin(); it != calls.end(); ++it) {
+    rpcCallStatistics & call = stats.m_calls[it->first];
+    call.calls = static_cast<uint32_t>(it->second.calls);
+    call.bytes_sent = it->second.bytes_sent;
+    call.bytes_received = it->second.bytes_received;
+    call.time_total = it->second.time_total;
+    call.time_max = it->second.time_max;
+    call.latency.assign(it->second.latency, it->second.latency + RPC_LATENCY_BINS);
+  }
+  return stats;
+}
+
+void hal::forgetDac(std::vector<uint8_t> roci2cs, uint8_t dacId) {
+  for(std::vector<uint8_t>::iterator roc = roci2cs.begin(); roc != roci2cs.end(); ++roc) {
+    m_rocDacs[*roc].erase(dacId);
+  }
 }
 
 bool hal::tbmSetRegs(uint8_t hubid, uint8_t core, std::map< uint8_t, uint8_t > regPairs) {
 
+  // Queued writes go first, they would overwrite these values otherwise:
+  flushRegisters();
+
+  // Make sure we are writing to the correct TBM by setting the module's hub id:
+  _testboard->mod_Addr(hubid);
+
   // Iterate over all register id/value pairs and set them
   for(std::map< uint8_t,uint8_t >::iterator it = regPairs.begin(); it != regPairs.end(); ++it) {
-    // One of the register settings had an issue, abort:
-    if(!tbmSetReg(hubid, core | it->first, it->second),false) return false;
+    uint8_t regId = core | it->first;
+    LOG(logDEBUGHAL) << "TBM@HUB " << static_cast<int>(hubid)
+		     << ": set register \"0x" << std::hex << static_cast<int>(regId)
+		     << "\" to 0x" << static_cast<int>(it->second) << std::dec;
+    _testboard->tbm_Set(regId,it->second);
+    m_tbmRegs[hubid][regId] = it->second;
   }
 
   // Send all queued commands to the testboard:
@@ -633,18 +885,28 @@ bool hal::tbmSetRegs(uint8_t hubid, uint8_t core, std::map< uint8_t, uint8_t > r
 
 bool hal::tbmSetReg(uint8_t hubid, uint8_t regId, uint8_t regValue, bool flush) {
 
+  m_registerStats.m_tbm_writes++;
+
+  // Drop the write if the TBM has this value already:
+  std::map<uint8_t,uint8_t> & regs = m_tbmRegs[hubid];
+  std::map<uint8_t,uint8_t>::iterator reg = regs.find(regId);
+  if(reg != regs.end() && reg->second == regValue) {
+    LOG(logDEBUGHAL) << "TBM@HUB " << static_cast<int>(hubid)
+		     << ": register \"0x" << std::hex << static_cast<int>(regId)
+		     << "\" is 0x" << static_cast<int>(regValue) << std::dec << " already.";
+    m_registerStats.m_tbm_writes_skipped++;
+    m_registerStats.m_rpcs_saved += 2;
+    return true;
+  }
+
   LOG(logDEBUGHAL) << "TBM@HUB " << static_cast<int>(hubid)
 		   << ": set register \"0x" << std::hex << static_cast<int>(regId)
 		   << "\" to 0x" << static_cast<int>(regValue) << std::dec;
+  regs[regId] = regValue;
+  m_pendingTbmRegs[hubid][regId] = regValue;
 
-  // Make sure we are writing to the correct TBM by setting the module's hub id:
-  _testboard->mod_Addr(hubid);
-
-  // Set this register:
-  _testboard->tbm_Set(regId,regValue);
-
-  // If requested, flush immediately:
-  if(flush) _testboard->Flush();
+  // If requested, send it immediately:
+  if(flush) flushRegisters();
   return true;
 }
 
@@ -653,14 +915,22 @@ void hal::tbmSelectRDA(uint8_t rda_id) {
   _testboard->Flush();
 }
 
-void hal::SetupI2CValues(std::vector<uint8_t> roci2cs) {
+bool hal::SetupI2CValues(std::vector<uint8_t> roci2cs) {
+
+  // The NIOS already knows these devices:
+  if(m_niosI2CsValid && roci2cs == m_niosI2Cs) {
+    LOG(logDEBUGHAL) << "I2C devices in NIOS storage are up to date.";
+    return false;
+  }
 
   LOG(logDEBUGHAL) << "Writing the following available I2C devices into NIOS storage:";
   LOG(logDEBUGHAL) << listVector(roci2cs);
 
   // Write all ROC I2C addresses to the NIOS storage:
   _testboard->SetI2CAddresses(roci2cs);
-
+  m_niosI2Cs = roci2cs;
+  m_niosI2CsValid = true;
+  return true;
 }
 
 void hal::SetupTrimValues(uint8_t roci2c, std::vector<pixelConfig> pixels) {
@@ -687,15 +957,26 @@ void hal::SetupTrimValues(uint8_t roci2c, std::vector<pixelConfig> pixels) {
 
 void hal::RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels) {
 
-  _testboard->roc_I2cAddr(roci2c);
+  std::map<uint8_t, std::vector<int16_t> >::iterator state = m_rocTrims.find(roci2c);
+  m_registerStats.m_mask_writes++;
 
   // Check if we want to mask or unmask&trim:
   if(mask) {
+    // Nothing to do if the ROC is masked already:
+    if(state != m_rocTrims.end() && state->second.empty()) {
+      LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<int>(roci2c) << " is fully masked already.";
+      m_registerStats.m_mask_writes_skipped++;
+      m_registerStats.m_rpcs_saved += 2;
+      return;
+    }
+
     // This is quite easy:
     LOG(logDEBUGHAL) << "Masking full ROC@I2C " << static_cast<int>(roci2c);
+    _testboard->roc_I2cAddr(roci2c);
 
     // Mask the PUC and detach all DC from their readout (both done on NIOS):
     _testboard->roc_Chip_Mask();
+    m_rocTrims[roci2c].clear();
   }
   else {
     // Prepare configuration of the pixels, linearize vector:
@@ -711,11 +992,21 @@ void hal::RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels)
       else trim[position] = pxIt->trim();
     }
 
+    // Nothing to do if the ROC is trimmed like this already:
+    if(state != m_rocTrims.end() && state->second == trim) {
+      LOG(logDEBUGHAL) << "Mask bits & trim values of ROC@I2C " << static_cast<int>(roci2c) << " are up to date.";
+      m_registerStats.m_mask_writes_skipped++;
+      m_registerStats.m_rpcs_saved += 2;
+      return;
+    }
+
     // We really want to program that full thing with correct mask/trim bits:
     LOG(logDEBUGHAL) << "Updating mask bits & trim values of ROC@I2C " << static_cast<int>(roci2c);
 
     // Trim the whole ROC:
+    _testboard->roc_I2cAddr(roci2c);
     _testboard->TrimChip(trim);
+    m_rocTrims[roci2c].swap(trim);
   }
 }
 
@@ -732,6 +1023,9 @@ void hal::AllColumnsSetEnable(uint8_t roci2c, bool enable) {
 
   _testboard->roc_AllCol_Enable(enable);
   _testboard->Flush();
+
+  // Masking the ROC also detaches its columns, it has to be done again:
+  m_rocTrims.erase(roci2c);
 }
 
 void hal::PixelSetCalibrate(uint8_t roci2c, uint8_t column, uint8_t row, uint16_t flags) {
@@ -776,6 +1070,7 @@ void hal::estimateDataVolume(uint32_t events, uint8_t nROCs) {
   else { nSamples = events*nROCs*(1+2); }
 
   LOG(logINFO) << "Expecting " << events << " events.";
+  m_expectedEvents = events;
   LOG(logDEBUGHAL) << "Estimated data volume: "
 		   << (nSamples/1000) << "k/" << (DTB_SOURCE_BUFFER_SIZE/1000)
 		   << "k (~" << (100*static_cast<double>(nSamples)/DTB_SOURCE_BUFFER_SIZE) << "% allocated DTB RAM)";
@@ -816,7 +1111,7 @@ std::vector<Event> hal::MultiRocAllPixelsCalibrate(std::vector<uint8_t> roci2cs,
   daqClear();
 
   // check for missing events
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -858,7 +1153,7 @@ std::vector<Event> hal::MultiRocOnePixelCalibrate(std::vector<uint8_t> roci2cs,
   daqClear();
 
   // We expect one Event per trigger, all ROCs are triggered in parallel:
-  int missing = 1 - data.size();
+  int missing = 1 - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -899,7 +1194,7 @@ std::vector<Event> hal::SingleRocAllPixelsCalibrate(uint8_t roci2c, bool efficie
   daqClear();
 
   // check for missing events
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -939,7 +1234,7 @@ std::vector<Event> hal::SingleRocOnePixelCalibrate(uint8_t roci2c, uint8_t colum
   daqClear();
 
   // We are expecting one Event per trigger:
-  int missing = 1 - data.size();
+  int missing = 1 - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -974,6 +1269,9 @@ std::vector<Event> hal::MultiRocAllPixelsDacScan(std::vector<uint8_t> roci2cs, b
 
  // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DAC at its last value:
+  forgetDac(roci2cs, dacreg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -991,7 +1289,7 @@ std::vector<Event> hal::MultiRocAllPixelsDacScan(std::vector<uint8_t> roci2cs, b
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1027,6 +1325,9 @@ std::vector<Event> hal::MultiRocOnePixelDacScan(std::vector<uint8_t> roci2cs, ui
 
  // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DAC at its last value:
+  forgetDac(roci2cs, dacreg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1044,7 +1345,7 @@ std::vector<Event> hal::MultiRocOnePixelDacScan(std::vector<uint8_t> roci2cs, ui
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1076,6 +1377,9 @@ std::vector<Event> hal::SingleRocAllPixelsDacScan(uint8_t roci2c, bool efficienc
 
  // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DAC at its last value:
+  forgetDac(std::vector<uint8_t>(1,roci2c), dacreg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1093,7 +1397,7 @@ std::vector<Event> hal::SingleRocAllPixelsDacScan(uint8_t roci2c, bool efficienc
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1125,6 +1429,9 @@ std::vector<Event> hal::SingleRocOnePixelDacScan(uint8_t roci2c, uint8_t column,
 
   // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DAC at its last value:
+  forgetDac(std::vector<uint8_t>(1,roci2c), dacreg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1142,7 +1449,7 @@ std::vector<Event> hal::SingleRocOnePixelDacScan(uint8_t roci2c, uint8_t column,
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1184,6 +1491,10 @@ std::vector<Event> hal::MultiRocAllPixelsDacDacScan(std::vector<uint8_t> roci2cs
 
   // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DACs at their last values:
+  forgetDac(roci2cs, dac1reg);
+  forgetDac(roci2cs, dac2reg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1201,7 +1512,7 @@ std::vector<Event> hal::MultiRocAllPixelsDacDacScan(std::vector<uint8_t> roci2cs
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1246,6 +1557,10 @@ std::vector<Event> hal::MultiRocOnePixelDacDacScan(std::vector<uint8_t> roci2cs,
 
   // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DACs at their last values:
+  forgetDac(roci2cs, dac1reg);
+  forgetDac(roci2cs, dac2reg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1263,7 +1578,7 @@ std::vector<Event> hal::MultiRocOnePixelDacDacScan(std::vector<uint8_t> roci2cs,
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1304,6 +1619,10 @@ std::vector<Event> hal::SingleRocAllPixelsDacDacScan(uint8_t roci2c, bool effici
 
   // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DACs at their last values:
+  forgetDac(std::vector<uint8_t>(1,roci2c), dac1reg);
+  forgetDac(std::vector<uint8_t>(1,roci2c), dac2reg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1321,7 +1640,7 @@ std::vector<Event> hal::SingleRocAllPixelsDacDacScan(uint8_t roci2c, bool effici
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1362,6 +1681,10 @@ std::vector<Event> hal::SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t colu
 
   // Prepare for data acquisition:
   daqStart(flags,deser160phase);
+
+  // The trigger loop leaves the scanned DACs at their last values:
+  forgetDac(std::vector<uint8_t>(1,roci2c), dac1reg);
+  forgetDac(std::vector<uint8_t>(1,roci2c), dac2reg);
   timer t;
 
   // Call the RPC command containing the trigger loop:
@@ -1379,7 +1702,7 @@ std::vector<Event> hal::SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t colu
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected/nTriggers - data.size();
+  int missing = expected/nTriggers - (data.size() + m_handledEvents);
   if(missing != 0) {
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1419,6 +1742,7 @@ void hal::Pon() {
   m_roctype = ROC_NONE;
   m_roccount = 0;
   m_tokenchains.clear();
+  invalidateCache();
 
   // Wait a little and let the power switch do its job:
   mDelay(300);
@@ -1428,6 +1752,7 @@ void hal::Poff() {
   // Turn off DUT power and execute (flush):
   _testboard->Poff();
   _testboard->Flush();
+  invalidateCache();
 }
 
 
@@ -1523,6 +1848,15 @@ void hal::SigSetLVDS(){
 void hal::daqStart(uint16_t flags, uint8_t deser160phase, uint32_t buffersize) {
 
   LOG(logDEBUGHAL) << "Starting new DAQ session.";
+  m_daqflags = flags;
+  m_handledEvents = 0;
+
+  // Queued register writes have to reach the devices before taking data:
+  flushRegisters();
+
+  // The trigger loops of the test functions (un)mask and trim the pixels under
+  // test on the NIOS, the PUC state of all ROCs is unknown from here on:
+  m_rocTrims.clear();
   for(uint8_t channel = 0; channel < DTB_DAQ_CHANNELS; channel++) { m_daqstatus.push_back(false); }
 
   // Clear all decoder instances:
@@ -1548,9 +1882,15 @@ void hal::daqStart(uint16_t flags, uint8_t deser160phase, uint32_t buffersize) {
     LOG(logDEBUGHAL) << "Channel " << i << ": token chain: "
 				<< static_cast<int>(m_tokenchains.at(i))
 				<< " offset " << static_cast<int>(rocid_offset) << " buffer " << allocated_buffer;
-    // Initialize the data source, set tokenchain length to zero if no token pass is expected:
-    m_src.at(i) = dtbSource(_testboard,( (m_tbmtype == TBM_10C || m_tbmtype == TBM_10D) && m_roccount == 16 ) ? ((i + 6) % 8) : i,m_tokenchains.at(i),rocid_offset,m_tbmtype,m_roctype,true,flags);
-    m_src.at(i) >> m_splitter.at(i);
+    // Initialize the data source, set tokenchain length to zero if no token pass is expected.
+    // The block buffer of the channel is kept:
+    dtbSource src(_testboard,( (m_tbmtype == TBM_10C || m_tbmtype == TBM_10D) && m_roccount == 16 ) ? ((i + 6) % 8) : i,m_tokenchains.at(i),rocid_offset,m_tbmtype,m_roctype,true,flags);
+    src.TakeBuffer(m_src.at(i));
+    m_src.at(i) = std::move(src);
+    m_src.at(i) >> m_splitter.at(i) >> m_decoder.at(i);
+    // Cache the channel properties along the pipe, they are needed for every decoded event:
+    m_splitter.at(i).CacheProperties();
+    m_decoder.at(i).CacheProperties();
     _testboard->uDelay(100);
     // Increment the ROC id offset by the amount of ROCs expected:
     rocid_offset += m_tokenchains.at(i);
@@ -1654,18 +1994,90 @@ Event hal::daqEvent() {
   return current_Event;
 }
 
+void hal::daqPrefetchStart() {
+
+  if((m_daqflags & FLAG_PREFETCH_DATA) == 0) return;
+
+  // Put the read-ahead sources between the DTB channels and the splitters:
+  for(size_t ch = 0; ch < m_src.size(); ch++) {
+    if(!m_src.at(ch).isConnected()) continue;
+    m_src.at(ch).SetLock(&m_rpcmutex);
+    m_prefetch[ch].Connect(&m_src.at(ch));
+    m_prefetch[ch] >> m_splitter.at(ch);
+    m_splitter.at(ch).CacheProperties();
+  }
+}
+
+void hal::daqPrefetchStop() {
+
+  if((m_daqflags & FLAG_PREFETCH_DATA) == 0) return;
+
+  // Stop all reader threads and reconnect the plain DTB channel sources:
+  for(size_t ch = 0; ch < m_src.size(); ch++) {
+    if(!m_src.at(ch).isConnected()) continue;
+    m_prefetch[ch].Halt();
+    m_src.at(ch) >> m_splitter.at(ch);
+    m_splitter.at(ch).CacheProperties();
+    m_src.at(ch).SetLock(NULL);
+  }
+}
+
 std::vector<Event> hal::daqAllEvents() {
 
   std::vector<Event> evt;
+  daqReadEvents(evt);
+  return evt;
+}
+
+void hal::daqReadEvents(std::vector<Event> & evt) {
+
+  daqPrefetchStart();
+  try {
+    // Decode the channels in separate threads if requested and more than one is connected:
+    size_t connected = 0;
+    for(size_t ch = 0; ch < m_src.size(); ch++) { if(m_src.at(ch).isConnected()) connected++; }
+
+    if((m_daqflags & FLAG_PARALLEL_DECODING) != 0 && connected > 1) { daqAllEventsParallel(evt); }
+    else { daqAllEventsSerial(evt); }
+  }
+  catch(...) {
+    daqPrefetchStop();
+    throw;
+  }
+  daqPrefetchStop();
+}
+
+void hal::daqStoreEvent(std::vector<Event> & evt, Event & current) {
+
+  if(m_condenseTriggers == 0) {
+    evt.push_back(std::move(current));
+    return;
+  }
+
+  m_condenser.Add(current);
+  if(++m_condensedTriggers == m_condenseTriggers) {
+    evt.push_back(Event());
+    m_condenser.Fill(evt.back(), m_condenseEfficiency);
+    m_condensedTriggers = 0;
+  }
+}
+
+void hal::daqAllEventsSerial(std::vector<Event> & evt) {
+
+  size_t nevents = 0;
   uint16_t flags = 0;
 
   // Prepare channel flags:
   std::vector<bool> done_ch;
   for(size_t i = 0; i < m_src.size(); i++) { done_ch.push_back(false); }
 
+  // Merged event, reused for all triggers. The decoders reuse their Event storage
+  // as well, so the decoded data is copied and never moved out of them:
+  Event current_Event;
+
   while(1) {
     // Read the next Event from each of the pipes:
-    Event current_Event;
+    size_t merged = 0;
     for(size_t ch = 0; ch < m_src.size(); ch++) {
       if(m_src.at(ch).isConnected() && (!done_ch.at(ch))) {
 	dataSink<Event*> Eventpump;
@@ -1674,20 +2086,31 @@ std::vector<Event> hal::daqAllEvents() {
 	// Read the supplied DAQ flags:
       if(flags == 0 && ch == 0) { flags = Eventpump.GetFlags(); }
 
-	// Add all event data from this channel:
-	try { current_Event += *Eventpump.Get(); }
+	// Add all event data from this channel, replacing the previous trigger with the first one:
+	try {
+	  Event * decoded = Eventpump.Get();
+	  if(merged++ == 0) { current_Event = *decoded; }
+	  else { current_Event += *decoded; }
+	}
 	catch (dsBufferEmpty &) {
 	  LOG(logDEBUGHAL) << "Finished readout Channel " << ch << ".";
 	  // Reset the DTB memory to work around buffer issue:
-	  if (_do_Daq_MemReset) _testboard->Daq_MemReset(ch);
+	  if (_do_Daq_MemReset) {
+	    std::lock_guard<std::mutex> lock(m_rpcmutex);
+	    _testboard->Daq_MemReset(ch);
+	  }
 	  done_ch.at(ch) = true;
 	}
-	catch (dataPipeException &e) { LOG(logERROR) << e.what(); return evt; }
+	catch (dataPipeException &e) { LOG(logERROR) << e.what(); return; }
       }
       else { done_ch.at(ch) = true; }
     }
 
-    _testboard->Flush();
+    {
+      // Read-ahead threads might still access the testboard:
+      std::lock_guard<std::mutex> lock(m_rpcmutex);
+      _testboard->Flush();
+    }
 
     // If all readout is finished, return:
     std::vector<bool>::iterator fin = std::find(done_ch.begin(), done_ch.end(), false);
@@ -1702,12 +2125,200 @@ std::vector<Event> hal::daqAllEvents() {
 	throw DataEventNumberMismatch("Channels report mismatching event numbers: " + listVector(current_Event.triggerCounts()));
       }
       // Store the event
-      evt.push_back(current_Event);
+      daqStoreEvent(evt, current_Event);
+      nevents++;
     }
   }
 
-  if(evt.empty()) throw DataNoEvent("No event available");
-  return evt;
+  if(nevents == 0) throw DataNoEvent("No event available");
+}
+
+void hal::daqChannelEvents(size_t channel, channelQueue & queue) {
+
+  try {
+    dataSink<Event*> Eventpump;
+    m_splitter.at(channel) >> m_decoder.at(channel) >> Eventpump;
+
+    while(1) {
+      Event * current;
+      try { current = Eventpump.Get(); }
+      catch (dsBufferEmpty &) {
+	LOG(logDEBUGHAL) << "Finished readout Channel " << channel << ".";
+	// Reset the DTB memory to work around buffer issue:
+	if (_do_Daq_MemReset) {
+	  std::lock_guard<std::mutex> lock(m_rpcmutex);
+	  _testboard->Daq_MemReset(channel);
+	}
+	break;
+      }
+      catch (dataPipeException &e) { LOG(logERROR) << e.what(); break; }
+
+      // Wait for the merging thread to catch up:
+      std::unique_lock<std::mutex> lock(m_queuemutex);
+      m_queuecond.wait(lock, [&]{ return m_queueabort || queue.events.size() < HAL_PARALLEL_QUEUE_EVENTS; });
+      if(m_queueabort) continue;
+      // Copy, the decoder keeps reusing the storage of its Event:
+      queue.events.push_back(*current);
+      m_queuecond.notify_all();
+    }
+  }
+  catch(...) {
+    // Hand the exception over to the merging thread:
+    std::lock_guard<std::mutex> lock(m_queuemutex);
+    queue.error = std::current_exception();
+  }
+
+  std::lock_guard<std::mutex> lock(m_queuemutex);
+  queue.done = true;
+  m_queuecond.notify_all();
+}
+
+void hal::daqAllEventsParallel(std::vector<Event> & evt) {
+
+  std::vector<channelQueue> queues(m_src.size());
+  std::vector<std::thread> workers;
+  m_queueabort = false;
+
+  // Start one decoding thread per connected channel:
+  for(size_t ch = 0; ch < m_src.size(); ch++) {
+    if(!m_src.at(ch).isConnected()) { queues.at(ch).done = true; continue; }
+    m_src.at(ch).SetLock(&m_rpcmutex);
+    workers.push_back(std::thread(&hal::daqChannelEvents, this, ch, std::ref(queues.at(ch))));
+  }
+  LOG(logDEBUGHAL) << "Started " << workers.size() << " decoding threads.";
+
+  // Merge the channels trigger by trigger while they are decoded:
+  std::exception_ptr error;
+  size_t nevents = 0;
+  try {
+    while(1) {
+      std::vector<Event> trigger;
+      {
+	std::unique_lock<std::mutex> lock(m_queuemutex);
+	m_queuecond.wait(lock, [&]{
+	    for(size_t ch = 0; ch < queues.size(); ch++) {
+	      if(queues.at(ch).events.empty() && !queues.at(ch).done) return false;
+	    }
+	    return true; });
+
+	for(size_t ch = 0; ch < queues.size(); ch++) {
+	  if(queues.at(ch).error) { std::rethrow_exception(queues.at(ch).error); }
+	  if(queues.at(ch).events.empty()) continue;
+	  trigger.push_back(std::move(queues.at(ch).events.front()));
+	  queues.at(ch).events.pop_front();
+	}
+	m_queuecond.notify_all();
+      }
+      if(trigger.empty()) break;
+
+      Event current_Event = std::move(trigger.front());
+      for(size_t i = 1; i < trigger.size(); i++) { current_Event += trigger.at(i); }
+
+      // Check for the channels all reporting the same event number:
+      if((m_daqflags & FLAG_DISABLE_EVENTID_CHECK) == 0 && !equalElements(current_Event.triggerCounts())) {
+	LOG(logERROR) << "Channels report mismatching event numbers: " << listVector(current_Event.triggerCounts());
+	throw DataEventNumberMismatch("Channels report mismatching event numbers: " + listVector(current_Event.triggerCounts()));
+      }
+      daqStoreEvent(evt, current_Event);
+      nevents++;
+    }
+  }
+  catch(...) {
+    // Let the workers drain their channels without queueing:
+    error = std::current_exception();
+    std::lock_guard<std::mutex> lock(m_queuemutex);
+    m_queueabort = true;
+    m_queuecond.notify_all();
+  }
+
+  for(size_t i = 0; i < workers.size(); i++) { workers.at(i).join(); }
+  if((m_daqflags & FLAG_PREFETCH_DATA) == 0) {
+    for(size_t ch = 0; ch < m_src.size(); ch++) { m_src.at(ch).SetLock(NULL); }
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_rpcmutex);
+    _testboard->Flush();
+  }
+  LOG(logDEBUGHAL) << "Drained all DAQ channels.";
+
+  if(error) { std::rethrow_exception(error); }
+  if(nevents == 0) throw DataNoEvent("No event available");
+}
+
+void hal::daqAllEvents(eventBatch & batch) {
+
+  daqPrefetchStart();
+  try { daqAllEventsSerial(batch); }
+  catch(...) {
+    daqPrefetchStop();
+    throw;
+  }
+  daqPrefetchStop();
+}
+
+void hal::daqAllEventsSerial(eventBatch & batch) {
+
+  batch.Clear();
+  uint16_t flags = 0;
+
+  // Prepare channel flags:
+  std::vector<bool> done_ch(m_src.size(), false);
+
+  // Connect the pipes only once for the full readout:
+  std::vector<dataSink<Event*> > Eventpump(m_src.size());
+  for(size_t ch = 0; ch < m_src.size(); ch++) {
+    if(m_src.at(ch).isConnected()) { m_splitter.at(ch) >> m_decoder.at(ch) >> Eventpump.at(ch); }
+  }
+
+  while(1) {
+    // Read the next Event from each of the pipes and append it to the open batch event:
+    for(size_t ch = 0; ch < m_src.size(); ch++) {
+      if(m_src.at(ch).isConnected() && (!done_ch.at(ch))) {
+
+	// Read the supplied DAQ flags:
+	if(flags == 0 && ch == 0) { flags = Eventpump.at(ch).GetFlags(); }
+
+	// Add all event data from this channel, the decoder Event is not copied:
+	try { batch.addEvent(*Eventpump.at(ch).Get()); }
+	catch (dsBufferEmpty &) {
+	  LOG(logDEBUGHAL) << "Finished readout Channel " << ch << ".";
+	  // Reset the DTB memory to work around buffer issue:
+	  if (_do_Daq_MemReset) {
+	    std::lock_guard<std::mutex> lock(m_rpcmutex);
+	    _testboard->Daq_MemReset(ch);
+	  }
+	  done_ch.at(ch) = true;
+	}
+	catch (dataPipeException &e) { LOG(logERROR) << e.what(); batch.dropEvent(); return; }
+      }
+      else { done_ch.at(ch) = true; }
+    }
+
+    {
+      // Read-ahead threads might still access the testboard:
+      std::lock_guard<std::mutex> lock(m_rpcmutex);
+      _testboard->Flush();
+    }
+
+    // If all readout is finished, return:
+    std::vector<bool>::iterator fin = std::find(done_ch.begin(), done_ch.end(), false);
+    if(fin == done_ch.end()) {
+      LOG(logDEBUGHAL) << "Drained all DAQ channels.";
+      batch.dropEvent();
+      break;
+    }
+    else {
+      // Check for the channels all reporting the same event number:
+      if((flags & FLAG_DISABLE_EVENTID_CHECK) == 0 && !batch.openTriggerCountsEqual()) {
+	LOG(logERROR) << "Channels report mismatching event numbers: " << listVector(batch.openTriggerCounts());
+	throw DataEventNumberMismatch("Channels report mismatching event numbers: " + listVector(batch.openTriggerCounts()));
+      }
+      // Store the event
+      batch.closeEvent();
+    }
+  }
+
+  if(batch.size() == 0) throw DataNoEvent("No event available");
 }
 
 rawEvent hal::daqRawEvent() {
@@ -1967,8 +2578,15 @@ void hal::daqStop() {
 
 void hal::daqClear() {
 
-  // Disconnect the data pipes from the DTB:
-  for(size_t ch = 0; ch < m_src.size(); ch++) { m_src.at(ch) = dtbSource(); }
+  // Disconnect the data pipes from the DTB. The sources are replaced in place, so
+  // the properties cached from the old ones have to be dropped explicitly:
+  for(size_t ch = 0; ch < m_src.size(); ch++) {
+    dtbSource src;
+    src.TakeBuffer(m_src.at(ch));
+    m_src.at(ch) = std::move(src);
+    m_splitter.at(ch).ClearProperties();
+    m_decoder.at(ch).ClearProperties();
+  }
 
   // Running Daq_Close() to delete all data and free allocated RAM:
   LOG(logDEBUGHAL) << "Closing DAQ session, deleting data buffers.";
@@ -2034,56 +2652,12 @@ std::vector<Event> hal::condenseTriggers(std::vector<Event> &data, uint16_t nTri
     return packed;
   }
 
+  // Accumulate all hits of one trigger group and emit the condensed event in place:
+  packed.reserve(data.size()/nTriggers);
   for(std::vector<Event>::iterator Eventit = data.begin(); Eventit!= data.end(); Eventit += nTriggers) {
-
-    Event evt;
-    std::map<pixel,uint16_t> pxcount = std::map<pixel,uint16_t>();
-    std::map<pixel,double> pxmean = std::map<pixel,double>();
-    std::map<pixel,double> pxm2 = std::map<pixel,double>();
-
-    for(std::vector<Event>::iterator it = Eventit; it != Eventit+nTriggers; ++it) {
-
-      // Loop over all contained pixels:
-      for(std::vector<pixel>::iterator pixit = (it)->pixels.begin(); pixit != (it)->pixels.end(); ++pixit) {
-
-	// Check if we have that particular pixel already in:
-	std::vector<pixel>::iterator px = std::find_if(evt.pixels.begin(),
-						       evt.pixels.end(),
-						       findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
-	// Pixel is known:
-	if(px != evt.pixels.end()) {
-	  if(efficiency) { px->setValue(px->value()+1); }
-	  else {
-	    // Calculate the variance incrementally:
-	    double delta = pixit->value() - pxmean[*px];
-	    pxmean[*px] += delta/pxcount[*px];
-	    pxm2[*px] += delta*(pixit->value() - pxmean[*px]);
-	    pxcount[*px]++;
-	  }
-	}
-	// Pixel is new:
-	else {
-	  if(efficiency) { pixit->setValue(1); }
-	  else {
-	    // Initialize counters and temporary variables:
-	    pxcount.insert(std::make_pair(*pixit,1));
-	    pxmean.insert(std::make_pair(*pixit,pixit->value()));
-	    pxm2.insert(std::make_pair(*pixit,0));
-	  }
-	  evt.pixels.push_back(*pixit);
-	}
-      }
-    }
-
-    // Calculate mean and variance for the pulse height depending on the
-    // number of triggers received:
-    if(!efficiency) {
-      for(std::vector<pixel>::iterator px = evt.pixels.begin(); px != evt.pixels.end(); ++px) {
-	px->setValue(pxmean[*px]); // The mean
-	px->setVariance(pxm2[*px]/(pxcount[*px] - 1)); // The variance
-      }
-    }
-    packed.push_back(evt);
+    for(std::vector<Event>::iterator it = Eventit; it != Eventit+nTriggers; ++it) { m_condenser.Add(*it); }
+    packed.push_back(Event());
+    m_condenser.Fill(packed.back(), efficiency);
   }
 
   // Clean up the dangling pointers in the vector:
@@ -2093,18 +2667,87 @@ std::vector<Event> hal::condenseTriggers(std::vector<Event> &data, uint16_t nTri
 
 void hal::addCondensedData(std::vector<Event> &data, uint16_t nTriggers, bool efficiency, timer t) {
 
-  std::vector<Event> tmpdata = std::vector<Event>();
-  try {
-    tmpdata = daqAllEvents();
-    tmpdata = condenseTriggers(tmpdata, nTriggers, efficiency);
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
-    LOG(logDEBUGHAL) << (tmpdata.size()*nTriggers) << " events read and condensed (" << t << "ms), "
-		     << data.size() << " events buffered.";
-    LOG(logINFO) << (data.size()*nTriggers) << " events read in total (" << t << "ms).";
-  }
-  catch(DataNoEvent) {}
+  // Condense the trigger groups while reading, appending directly to the data:
+  size_t buffered = data.size();
+  m_condenseTriggers = nTriggers;
+  m_condenseEfficiency = efficiency;
+  m_condensedTriggers = 0;
+
+  try { daqReadEvents(data); }
+  catch(DataNoEvent) {
+    m_condenseTriggers = 0;
+    reportProgress((data.size() + m_handledEvents)*nTriggers);
+    return;
+  }
   catch(DataException &e) {
+    m_condenseTriggers = 0;
+    m_condenser.Reset();
+    data.resize(buffered);
     LOG(logCRITICAL) << "Error in DAQ: " << e.what() << " Aborting test.";
     throw e;
   }
+  catch(...) {
+    m_condenseTriggers = 0;
+    m_condenser.Reset();
+    data.resize(buffered);
+    throw;
+  }
+  m_condenseTriggers = 0;
+
+  // Incomplete trigger group left, discard this readout:
+  if(m_condensedTriggers != 0) {
+    LOG(logCRITICAL) << "Data size does not correspond to " << nTriggers << " triggers! Aborting data processing!";
+    m_condenser.Reset();
+    data.resize(buffered);
+    return;
+  }
+
+  LOG(logDEBUGHAL) << ((data.size() - buffered)*nTriggers) << " events read and condensed (" << t << "ms), "
+		   << data.size() << " events buffered.";
+  LOG(logINFO) << ((data.size() + m_handledEvents)*nTriggers) << " events read in total (" << t << "ms).";
+
+  // Hand the buffered Events over instead of collecting them for the caller:
+  if(m_eventHandler && !data.empty()) {
+    m_handledEvents += data.size();
+    m_eventHandler(data);
+    data.clear();
+  }
+
+  reportProgress((data.size() + m_handledEvents)*nTriggers);
+}
+
+void hal::reportProgress(size_t events) {
+
+  if(!m_progressHandler) return;
+
+  try { m_progressHandler(events, m_expectedEvents); }
+  catch(ScanCancelled &) {
+    // Leave the trigger loop and drop the data still buffered on the DTB:
+    LOG(logINFO) << "Test cancelled after " << events << " of " << m_expectedEvents << " events.";
+    _testboard->LoopInterruptReset();
+    daqStop();
+    daqClear();
+    throw;
+  }
+}
+
+void hal::setEventHandler(std::function<void(std::vector<Event>&)> handler) {
+  m_eventHandler = handler;
+}
+
+bool hal::hasEventHandler() {
+  return static_cast<bool>(m_eventHandler);
+}
+
+void hal::setProgressHandler(std::function<void(size_t, size_t)> handler) {
+  m_progressHandler = handler;
+}
+
+void hal::invalidateCache() {
+  LOG(logDEBUGHAL) << "Forgetting register values, ROC mask & trim states and NIOS I2C devices.";
+  m_rocTrims.clear();
+  m_niosI2Cs.clear();
+  m_niosI2CsValid = false;
+  m_rocDacs.clear();
+  m_tbmRegs.clear();
 }
@@ -1,10 +1,16 @@
 #ifndef PXAR_HAL_H
 #define PXAR_HAL_H
 
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <exception>
 #include "rpc_calls.h"
 #include "api.h"
 #include "datapipe.h"
 #include "datasource_dtb.h"
+#include "condenser.h"
 #include "constants.h"
 #include "timer.h"
 
@@ -109,20 +115,47 @@ namespace pxar {
      */
     void setHubId(uint8_t hub0, uint8_t hub1);
 
-    /** Set a DAC on a specific ROC with I2C address roci2c
+    /** Set a DAC on a specific ROC with I2C address roci2c. The write is
+     *  dropped if the DAC already has this value. Without "flush" the write
+     *  is queued until the next call to flushRegisters().
      */
-    bool rocSetDAC(uint8_t roci2c, uint8_t dacId, uint8_t dacValue);
+    bool rocSetDAC(uint8_t roci2c, uint8_t dacId, uint8_t dacValue, bool flush = true);
 
     /** Set all DACs on a specific ROC with I2C address roci2c
      *  DACs are provided as map of uint8_t,uint8_t pairs  with DAC Id and DAC value.
      */
     bool rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs);
 
+    /** Send all queued DAC and TBM register writes to the testboard in one
+     *  transfer, selecting every device only once.
+     */
+    void flushRegisters();
+
+    /** Open a batch of testboard calls: the calls are collected and sent to
+     *  the DTB in one transfer by batchEnd(). Batches can be nested.
+     */
+    void batchBegin();
+
+    /** Send the calls collected since batchBegin() to the DTB. With "abort"
+     *  set, transmission errors are ignored (when closing a batch after an error).
+     */
+    void batchEnd(bool abort = false);
+
+    /** Return the statistics of the register caches and reset them
+     */
+    registerStatistics registerStats();
+
+    /** Return the statistics of the RPC calls made to the DTB and reset them
+     */
+    rpcStatistics rpcStats();
+
     /** Select the RDA channel of a layer 1 module for tbm readback
     */
     void tbmSelectRDA(uint8_t rda_id);
 
-    /** Set a register on a specific TBM at hubid
+    /** Set a register on a specific TBM at hubid. The write is dropped if the
+     *  register already has this value. Without "flush" the write is queued
+     *  until the next call to flushRegisters().
      */
     bool tbmSetReg(uint8_t hubid, uint8_t regId, uint8_t regValue, bool flush = true);
 
@@ -371,6 +404,12 @@ namespace pxar {
      */
     std::vector<Event> daqAllEvents();
 
+    /** Read all remaining decoded Events from the FIFO buffer into the flat
+     *  pxar::eventBatch storage. The batch is cleared first but its memory is
+     *  kept, so no per-Event heap allocations are necessary.
+     */
+    void daqAllEvents(eventBatch & batch);
+
     /** Return the current decoding statistics for all channels:
      */
     statistics daqStatistics();
@@ -389,12 +428,40 @@ namespace pxar {
      */
     void daqClear();
 
+    /** Hand the condensed Events of the test functions to "handler" as soon as they
+     *  have been read out, in readout order, instead of collecting them for the return
+     *  value. The test functions then only return Events not yet handed over. An empty
+     *  handler restores the default behaviour.
+     */
+    void setEventHandler(std::function<void(std::vector<Event>&)> handler);
+
+    /** Check whether the condensed Events are currently handed to an event handler
+     */
+    bool hasEventHandler();
+
+    /** Report the progress of the test functions to "handler" after every readout,
+     *  passing the number of events read and the number of events expected for the
+     *  running test function. The handler may throw pxar::ScanCancelled to abort the
+     *  test: the trigger loop on the DTB is reset and the DAQ closed before the
+     *  exception is passed on. An empty handler disables the reporting.
+     */
+    void setProgressHandler(std::function<void(size_t, size_t)> handler);
+
+    /** Forget the DAC and TBM register values, the mask and trim state of the
+     *  ROCs and the I2C addresses stored in the NIOS, as needed when the DUT has
+     *  been power cycled or reprogrammed outside of the HAL. The next calls
+     *  program everything again.
+     */
+    void invalidateCache();
+
 
     // Functions to access NIOS storage of trim values:
 
-    /** Set the available I2C device addresses
+    /** Set the available I2C device addresses. The addresses are only
+     *  transmitted if they differ from the ones last written to the NIOS,
+     *  returns true if they have been transmitted.
      */
-    void SetupI2CValues(std::vector<uint8_t> roci2cs);
+    bool SetupI2CValues(std::vector<uint8_t> roci2cs);
 
     /** Set all trim bits for the ROC with specified I2C address
      */
@@ -403,7 +470,9 @@ namespace pxar {
 
     // Functions to set bits somewhere on the ROC:
 
-    /** Mask all pixels on a specific ROC I2C address
+    /** Mask all pixels on a specific ROC I2C address, or unmask and trim them
+     *  according to "pixels". Nothing is sent if the ROC is known to be in the
+     *  requested state already.
      */
     void RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels = std::vector<pixelConfig>());
 
@@ -465,6 +534,8 @@ namespace pxar {
     std::vector<uint8_t> m_tokenchains;
     // Store which channels are active:
     std::vector<bool> m_daqstatus;
+    // DAQ flags of the current session:
+    uint16_t m_daqflags;
 
     uint16_t _currentTrgSrc;
 
@@ -478,6 +549,14 @@ namespace pxar {
      */
     bool CheckCompatibility();
 
+    /** Resolve the ids of all RPC calls on the DTB. The id table is cached
+     *  on disk for the DTB firmware, in the file given by the environment
+     *  variable PXAR_RPC_CACHE (default: .pxar_rpccache in the home directory,
+     *  an empty value disables the cache). Without a matching cache entry all
+     *  ids are negotiated in one round trip.
+     */
+    void LinkRpcCalls();
+
     /** Find attached USB devices that match the DTB naming scheme.
      *
      *  If usbId = "*" check for all attached devices and list them,
@@ -486,8 +565,9 @@ namespace pxar {
     bool FindDTB(std::string &usbId);
 
     /** Internal helper function to calculate an estimate of the data volume to be
-     *  expected for the upcoming test. This function only supplies debug output
-     *  and has no further effect on the data transmission or similar.
+     *  expected for the upcoming test. This function only supplies debug output and
+     *  the expected number of events for the progress reporting, it has no further
+     *  effect on the data transmission or similar.
      */
     void estimateDataVolume(uint32_t events, uint8_t nROCs);
 
@@ -500,6 +580,11 @@ namespace pxar {
      */
     void addCondensedData(std::vector<Event> &data, uint16_t nTriggers, bool efficiency, timer t);
 
+    /** Helper function passing the number of events read to the progress handler,
+     *  stopping the trigger loop and DAQ if the test is cancelled
+     */
+    void reportProgress(size_t events);
+
     // TESTBOARD SET COMMANDS
     /** Set the testboard analog current limit
      */
@@ -525,6 +610,60 @@ namespace pxar {
      */
     uint32_t GetHashForString(const char* s);
 
+    /** Read all remaining decoded Events from the FIFO buffer, round-robin over
+     *  all DAQ channels in the calling thread.
+     */
+    void daqAllEventsSerial(std::vector<Event> & evt);
+    void daqAllEventsSerial(eventBatch & batch);
+
+    /** Insert the read-ahead sources into the channel pipes if requested via
+     *  FLAG_PREFETCH_DATA, and remove them again after the readout.
+     */
+    void daqPrefetchStart();
+    void daqPrefetchStop();
+
+    /** Read all remaining decoded Events from the FIFO buffer and append them to "evt",
+     *  using the serial or parallel readout as requested by the DAQ flags.
+     */
+    void daqReadEvents(std::vector<Event> & evt);
+
+    /** Store one merged Event read from all channels. While condensing, the Event is only
+     *  added to the running trigger group and a condensed Event is appended once the group
+     *  is complete.
+     */
+    void daqStoreEvent(std::vector<Event> & evt, Event & current);
+
+    /** Decoded Events of one DAQ channel waiting to be merged by the parallel readout
+     */
+    struct channelQueue {
+      channelQueue() : done(false) {}
+      std::deque<Event> events;
+      bool done;
+      std::exception_ptr error;
+    };
+
+    /** Read all remaining decoded Events from the FIFO buffer, decoding every DAQ
+     *  channel in its own thread and merging the Events by trigger as they arrive.
+     */
+    void daqAllEventsParallel(std::vector<Event> & evt);
+
+    /** Worker function for the parallel readout: decode all Events of one DAQ channel
+     *  into its queue, waiting while the queue holds HAL_PARALLEL_QUEUE_EVENTS Events.
+     *  Exceptions are stored in the queue to be rethrown by the calling thread.
+     */
+    void daqChannelEvents(size_t channel, channelQueue & queue);
+
+    /** Synchronization of the channel queues of the parallel readout. Once the merging
+     *  is aborted, the workers drain their channels without queueing the Events.
+     */
+    std::mutex m_queuemutex;
+    std::condition_variable m_queuecond;
+    bool m_queueabort;
+
+    /** Mutex to serialize the testboard access of the parallel readout threads
+     */
+    std::mutex m_rpcmutex;
+
     /** Read all data from one TBM channel data stream
      */
     std::vector<uint16_t> * daqReadChannel(uint8_t channel);
@@ -533,6 +672,63 @@ namespace pxar {
     std::vector<dtbSource> m_src;
     std::vector<dtbEventSplitter> m_splitter;
     std::vector<dtbEventDecoder> m_decoder;
+
+    // Read-ahead sources for the DAQ channels:
+    dtbPrefetchSource m_prefetch[DTB_DAQ_CHANNELS];
+
+    // Accumulator for condensing trigger groups, and the group size when condensing
+    // during the readout (zero otherwise):
+    eventCondenser m_condenser;
+    uint16_t m_condenseTriggers;
+    bool m_condenseEfficiency;
+    uint16_t m_condensedTriggers;
+
+    // Consumer of the condensed Events if streaming, and the number of Events handed
+    // over to it since daqStart:
+    std::function<void(std::vector<Event>&)> m_eventHandler;
+    size_t m_handledEvents;
+
+    // Receiver of the test progress, and the number of events expected for the
+    // running test function:
+    std::function<void(size_t, size_t)> m_progressHandler;
+    size_t m_expectedEvents;
+
+    // Mask and trim state of the ROC PUCs as last programmed, by I2C address. ROCs
+    // without entry are in an unknown state, an empty vector means fully masked:
+    std::map<uint8_t, std::vector<int16_t> > m_rocTrims;
+
+    // ROC I2C addresses last written to the NIOS storage, and whether they are known:
+    std::vector<uint8_t> m_niosI2Cs;
+    bool m_niosI2CsValid;
+
+    // DAC values of the ROCs by I2C address and TBM register values by hub id as
+    // written to the devices, and the writes queued until flushRegisters():
+    std::map<uint8_t, std::map<uint8_t,uint8_t> > m_rocDacs;
+    std::map<uint8_t, std::map<uint8_t,uint8_t> > m_tbmRegs;
+    std::map<uint8_t, std::map<uint8_t,uint8_t> > m_pendingDacs;
+    std::map<uint8_t, std::map<uint8_t,uint8_t> > m_pendingTbmRegs;
+
+    // Writes requested and saved by the register caches:
+    registerStatistics m_registerStats;
+
+    /** Forget the value of DAC "dacId" on the ROCs "roci2cs", which the
+     *  trigger loops of the DAC scans leave at an unknown value
+     */
+    void forgetDac(std::vector<uint8_t> roci2cs, uint8_t dacId);
+  };
+
+  /** Scope guard for a batch of testboard calls: send() transmits the batch,
+   *  leaving the scope without it (e.g. by an exception) closes the batch
+   *  without throwing.
+   */
+  class rpcBatch {
+  public:
+    rpcBatch(hal * h) : _hal(h), _open(true) { _hal->batchBegin(); }
+    ~rpcBatch() { if(_open) _hal->batchEnd(true); }
+    void send() { _open = false; _hal->batchEnd(); }
+  private:
+    hal * _hal;
+    bool _open;
   };
 }
 #endif
@@ -4,6 +4,56 @@
 
 CRpcIoNull RpcIoNull;
 
+thread_local CRpcTraffic rpc_traffic = { 0, 0 };
+
+
+// === call statistics ======================================================
+
+thread_local CRpcCallTimer *CRpcStats::m_timer = NULL;
+
+void CRpcStats::Add(unsigned int cmd, uint64_t time, uint64_t sent, uint64_t received)
+{
+	CCall &call = m_calls[cmd];
+	call.calls++;
+	call.bytes_sent += sent;
+	call.bytes_received += received;
+	call.time_total += time;
+	uint64_t max = call.time_max;
+	while (time > max && !call.time_max.compare_exchange_weak(max, time)) {}
+
+	unsigned int bin = 0;
+	for (uint64_t t = time; t > 0 && bin < RPC_LATENCY_BINS - 1; t >>= 1) bin++;
+	call.latency[bin]++;
+}
+
+CRpcCallTotals CRpcStats::Get(unsigned int cmd)
+{
+	CCall &call = m_calls[cmd];
+	CRpcCallTotals totals;
+	totals.calls = call.calls;
+	totals.bytes_sent = call.bytes_sent;
+	totals.bytes_received = call.bytes_received;
+	totals.time_total = call.time_total;
+	totals.time_max = call.time_max;
+	for (unsigned int i = 0; i < RPC_LATENCY_BINS; i++) totals.latency[i] = call.latency[i];
+	return totals;
+}
+
+void CRpcStats::Clear()
+{
+	for (unsigned int cmd = 0; cmd < m_size; cmd++)
+	{
+		CCall &call = m_calls[cmd];
+		call.calls = 0;
+		call.bytes_sent = 0;
+		call.bytes_received = 0;
+		call.time_total = 0;
+		call.time_max = 0;
+		for (unsigned int i = 0; i < RPC_LATENCY_BINS; i++) call.latency[i] = 0;
+	}
+}
+
+
 void rpcMessage::Create(uint16_t cmd)
 {
 	m_type = RPC_TYPE_DTB;
@@ -19,6 +69,7 @@ void rpcMessage::Send(CRpcIo &rpc_io)
 	rpc_io.Write(&m_cmd,  2);
 	rpc_io.Write(&m_size, 1);
 	if (m_size) rpc_io.Write(m_par, m_size);
+	rpc_traffic.sent += 4 + m_size;
 }
 
 
@@ -48,6 +99,22 @@ void rpcMessage::Receive(CRpcIo &rpc_io)
 	rpc_io.Read(&m_cmd, 2);
 	rpc_io.Read(&m_size, 1);
 	if (m_size) rpc_io.Read(m_par, m_size);
+	rpc_traffic.received += 4 + m_size;
+}
+
+
+// === batch ================================================================
+
+void CRpcIoBatch::Execute(CRpcIo &rpc_io)
+{
+	vector<CRpcDeferred*> deferred;
+	deferred.swap(m_deferred);
+	if (m_written)
+	{
+		m_written = false;
+		rpc_io.Flush();
+	}
+	for (size_t i=0; i<deferred.size(); i++) deferred[i]->Receive(rpc_io);
 }
 
 
@@ -79,6 +146,8 @@ void CDataHeader::RecvHeader(CRpcIo &rpc_io)
 
 	m_size = 0;
 	rpc_io.Read(&m_size, 3);
+	// the data block is read or dropped by the caller:
+	rpc_traffic.received += 4 + m_size;
 }
 
 
@@ -89,6 +158,7 @@ void rpc_SendRaw(CRpcIo &rpc_io, const void *x, uint32_t size)
 	rpc_io.Write(&value, 1);
 	rpc_io.Write(&size, 3);
 	if (size) rpc_io.Write(x, size);
+	rpc_traffic.sent += 4 + size;
 //	printf("Send Data [%i]\n", int(size));
 }
 
@@ -4,6 +4,8 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
+#include <chrono>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -14,10 +16,11 @@
 #include "rpc_error.h"
 #include "log.h"
 
+// Every call is timed and its bytes counted in the call statistics:
 #ifdef ENABLE_RPC_PROFILING
-#define RPC_PROFILING PROFILING LOG(pxar::logDEBUGRPC) << "called.";
+#define RPC_PROFILING PROFILING CRpcCallTimer rpc_callTimer(rpc_stats); LOG(pxar::logDEBUGRPC) << "called.";
 #else
-#define RPC_PROFILING LOG(pxar::logDEBUGRPC) << "called.";
+#define RPC_PROFILING CRpcCallTimer rpc_callTimer(rpc_stats); LOG(pxar::logDEBUGRPC) << "called.";
 #endif
 
 #ifdef ENABLE_MULTITHREADING
@@ -51,10 +54,12 @@ extern const char rpc_timestamp[];
 	static const unsigned int rpc_cmdListSize; \
 	static const char *rpc_cmdName[]; \
 	int *rpc_cmdId; \
+	CRpcStats rpc_stats; \
 	void rpc_Clear() { for ( unsigned int i=2; i<rpc_cmdListSize; i++) rpc_cmdId[i] = -1; rpc_cmdId[0] = 0; rpc_cmdId[1] = 1; } \
 	void rpc_Connect(CRpcIo &port) { rpc_io = &port; rpc_Clear(); } \
 	uint16_t rpc_GetCallId(uint16_t x) \
 	{ \
+		rpc_stats.Select(x); \
 		int id = rpc_cmdId[x]; \
 		if (id >= 0) return id; \
 		string name(rpc_cmdName[x]); \
@@ -64,7 +69,7 @@ extern const char rpc_timestamp[];
 	} \
 	friend class CRpcError;
 
-#define RPC_INIT rpc_io = &RpcIoNull; rpc_cmdId = new int[rpc_cmdListSize]; rpc_Clear();
+#define RPC_INIT rpc_io = &RpcIoNull; rpc_cmdId = new int[rpc_cmdListSize]; rpc_Clear(); rpc_stats.Init(rpc_cmdListSize + 1);
 
 #define RPC_EXIT delete[] rpc_cmdId;
 
@@ -84,6 +89,96 @@ public:
 };
 
 
+// === call statistics ======================================================
+
+// Bins of the latency histograms, powers of two in us:
+#define RPC_LATENCY_BINS 24
+
+// Totals of one call. Bin 0 of the latency histogram counts calls taking
+// less than 1us, bin i calls from 2^(i-1)us to 2^i us, and the last bin all
+// calls taking longer:
+struct CRpcCallTotals
+{
+	uint64_t calls;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	uint64_t time_total;
+	uint64_t time_max;
+	uint32_t latency[RPC_LATENCY_BINS];
+};
+
+
+// Bytes of all messages sent and received by the calling thread:
+struct CRpcTraffic
+{
+	uint64_t sent;
+	uint64_t received;
+};
+
+extern thread_local CRpcTraffic rpc_traffic;
+
+
+class CRpcCallTimer;
+
+// Statistics of each call, indexed like rpc_cmdName. Calls are made from
+// several threads, e.g. the DAQ readers, so the totals are atomic. The call
+// timed is selected when it looks up its call id:
+class CRpcStats
+{
+	struct CCall
+	{
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> bytes_sent;
+		std::atomic<uint64_t> bytes_received;
+		std::atomic<uint64_t> time_total;
+		std::atomic<uint64_t> time_max;
+		std::atomic<uint32_t> latency[RPC_LATENCY_BINS];
+	};
+	CCall *m_calls;
+	unsigned int m_size;
+	static thread_local CRpcCallTimer *m_timer;
+	friend class CRpcCallTimer;
+
+	CRpcStats(const CRpcStats&);
+	CRpcStats& operator=(const CRpcStats&);
+	void Add(unsigned int cmd, uint64_t time, uint64_t sent, uint64_t received);
+public:
+	CRpcStats() : m_calls(NULL), m_size(0) {}
+	~CRpcStats() { delete[] m_calls; }
+	void Init(unsigned int size) { delete[] m_calls; m_calls = new CCall[size]; m_size = size; Clear(); }
+	unsigned int Size() { return m_size; }
+	inline void Select(uint16_t cmd);
+	CRpcCallTotals Get(unsigned int cmd);
+	void Clear();
+};
+
+
+// Times a call from its start to the end of the scope. Calls made while
+// resolving the id of another call are timed separately, and included in
+// the outer call:
+class CRpcCallTimer
+{
+	CRpcStats &m_stats;
+	CRpcCallTimer *m_outer;
+	int m_cmd;
+	std::chrono::steady_clock::time_point m_start;
+	CRpcTraffic m_traffic;
+public:
+	CRpcCallTimer(CRpcStats &stats) : m_stats(stats), m_outer(stats.m_timer), m_cmd(-1),
+		m_start(std::chrono::steady_clock::now()), m_traffic(rpc_traffic) { stats.m_timer = this; }
+	~CRpcCallTimer()
+	{
+		m_stats.m_timer = m_outer;
+		if (m_cmd < 0 || m_cmd >= int(m_stats.m_size)) return;
+		uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+		m_stats.Add(m_cmd, time, rpc_traffic.sent - m_traffic.sent, rpc_traffic.received - m_traffic.received);
+	}
+	void Select(uint16_t cmd) { m_cmd = cmd; }
+};
+
+inline void CRpcStats::Select(uint16_t cmd) { if (m_timer) m_timer->Select(cmd); }
+
+
 // === message ==============================================================
 
 class rpcMessage
@@ -130,6 +225,83 @@ public:
 	uint32_t Get_UINT32() { uint32_t x = Get_UINT16(); x += static_cast<uint32_t>(Get_UINT16()) << 16; return x; }
  	int64_t Get_INT64() { int64_t x = Get_UINT32(); x += static_cast<uint64_t>(Get_UINT32()) << 32; return x; }
 	uint64_t Get_UINT64() { uint64_t x = Get_UINT32(); x = static_cast<uint64_t>(Get_UINT32()) << 32; return x; }
+
+	void Get(bool &x) { x = Get_BOOL(); }
+	void Get(int8_t &x) { x = Get_INT8(); }
+	void Get(uint8_t &x) { x = Get_UINT8(); }
+	void Get(int16_t &x) { x = Get_INT16(); }
+	void Get(uint16_t &x) { x = Get_UINT16(); }
+	void Get(int32_t &x) { x = Get_INT32(); }
+	void Get(uint32_t &x) { x = Get_UINT32(); }
+};
+
+
+// === batch ================================================================
+
+// Reply of a call queued in a batch, received when the batch is executed:
+class CRpcDeferred
+{
+public:
+	virtual ~CRpcDeferred() {}
+	virtual void Receive(CRpcIo &rpc_io) = 0;
+};
+
+
+// Deferred return value of type T. The object has to live until the batch
+// it has been queued in is executed:
+template <class T>
+class CRpcResult : public CRpcDeferred
+{
+	uint16_t m_cmd;
+	bool m_valid;
+	T m_value;
+public:
+	CRpcResult() : m_cmd(0), m_valid(false), m_value() {}
+	void Expect(uint16_t cmd) { m_cmd = cmd; m_valid = false; }
+	void Receive(CRpcIo &rpc_io)
+	{
+		rpcMessage msg;
+		msg.Receive(rpc_io);
+		msg.Check(m_cmd, sizeof(T));
+		msg.Get(m_value);
+		m_valid = true;
+	}
+	bool Valid() { return m_valid; }
+	T Get() { if (!m_valid) throw CRpcError(CRpcError::NO_CMD_MSG); return m_value; }
+};
+
+
+// Interface collecting the calls of a batch: Flush() requests are absorbed,
+// the collected calls are forwarded to the attached interface in a single
+// transfer when a reply has to be read or the batch is executed.
+class CRpcIoBatch : public CRpcIo
+{
+	CRpcIo *m_io;
+	bool m_written;
+	vector<CRpcDeferred*> m_deferred;
+public:
+	CRpcIoBatch() : m_io(&RpcIoNull), m_written(false) {}
+	void Attach(CRpcIo *io) { m_io = io; }
+	CRpcIo* Release() { CRpcIo *io = m_io; m_io = &RpcIoNull; return io; }
+	void Defer(CRpcDeferred &result) { m_deferred.push_back(&result); }
+	void Execute(CRpcIo &rpc_io);
+
+	void Write(const void *buffer, uint32_t size) { m_written = true; m_io->Write(buffer, size); }
+	void Flush() {}
+	void Clear() { m_io->Clear(); }
+	void Read(void *buffer, uint32_t size) { Execute(*m_io); m_io->Read(buffer, size); }
+	const char* Name() { return m_io->Name(); }
+	// Error processing
+	int32_t GetLastError() { return m_io->GetLastError(); }
+	const char* GetErrorMsg(int error) { return m_io->GetErrorMsg(error); }
+	// Connection
+	bool Open(char name[]) { return m_io->Open(name); }
+	void Close() { m_io->Close(); }
+	bool EnumFirst(uint32_t &nDevices) { return m_io->EnumFirst(nDevices); }
+	bool EnumNext(char name[]) { return m_io->EnumNext(name); }
+	bool Enum(char name[], uint32_t pos) { return m_io->Enum(name, pos); }
+	bool Connected() { return m_io->Connected(); }
+	void SetTimeout(unsigned int timeout) { m_io->SetTimeout(timeout); }
 };
 
 
@@ -173,11 +345,32 @@ void rpc_Receive(CRpcIo &rpc_io, vector<T> &x)
 		rpc_DataSink(rpc_io, msg.m_size);
 		throw CRpcError(CRpcError::WRONG_DATA_SIZE);
 	}
-	x.assign(msg.m_size/sizeof(T), 0);
+	// Elements kept by resize() are not initialized again, only the ones added:
+	x.resize(msg.m_size/sizeof(T));
 	if (x.size() != 0) rpc_io.Read(&(x[0]), msg.m_size);
 }
 
 
+// Receive into reusable storage, returns the number of elements received.
+// The storage is not shrunk and only grows if the data does not fit, so a
+// buffer used again is neither reallocated nor initialized:
+template <class T>
+uint32_t rpc_ReceiveInto(CRpcIo &rpc_io, vector<T> &x)
+{
+	CDataHeader msg;
+	msg.RecvHeader(rpc_io);
+	if ((msg.m_size % sizeof(T)) != 0)
+	{
+		rpc_DataSink(rpc_io, msg.m_size);
+		throw CRpcError(CRpcError::WRONG_DATA_SIZE);
+	}
+	uint32_t n = msg.m_size/sizeof(T);
+	if (x.size() < n) x.resize(n);
+	if (n != 0) rpc_io.Read(&(x[0]), msg.m_size);
+	return n;
+}
+
+
 inline void rpc_Send(CRpcIo &rpc_io, const string &x)
 {
 	rpc_SendRaw(rpc_io, x.c_str(), x.length());
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "rpc.h"
+#include "rpc_record.h"
 #include <vector>
+#include <map>
+#include <cstring>
 
 #ifdef INTERFACE_USB
 #include "USBInterface.h"
@@ -26,11 +29,51 @@ class CTestboard
 
   std::vector<CRpcIo*> interfaceList;
 
+  CRpcIoBatch rpc_batch;
+  unsigned int rpc_batchDepth;
+
+  CRpcIoRecord *rpc_recorder;
+  CRpcIoReplay *rpc_replay;
+
+  // Index in the host call list of a function given by its RPC name:
+  static uint16_t rpc_FindCmd(const char *name)
+  {
+	  for (unsigned int i = 0; i < rpc_cmdListSize; i++) {
+	    if (strcmp(rpc_cmdName[i], name) == 0) return i;
+	  }
+	  throw CRpcError(CRpcError::UNKNOWN_CMD);
+  }
+
+  // Send a call and queue its reply in the open batch, outside
+  // of a batch the reply is received immediately:
+  template <class T>
+  void rpc_Defer(rpcMessage &msg, CRpcResult<T> &result)
+  {
+	  RPC_THREAD_LOCK
+	  result.Expect(msg.GetCmd());
+	  msg.Send(*rpc_io);
+	  if (rpc_batchDepth > 0) { rpc_batch.Defer(result); return; }
+	  rpc_io->Flush();
+	  result.Receive(*rpc_io);
+  }
+
+  void rpc_Defer(uint16_t cmd, CRpcResult<uint16_t> &result)
+  {
+	  RPC_PROFILING
+	  rpcMessage msg;
+	  try { msg.Create(rpc_GetCallId(cmd)); }
+	  catch (CRpcError &e) { e.SetFunction(cmd); throw; }
+	  rpc_Defer(msg, result);
+  }
+
 public:
 	CRpcIo& GetIo() { return *rpc_io; }
 
 	CTestboard() { 
 	  RPC_INIT 
+	  rpc_batchDepth = 0;
+	  rpc_recorder = NULL;
+	  rpc_replay = NULL;
 
 #ifdef INTERFACE_USB
 	  usb = NULL;
@@ -40,7 +83,11 @@ public:
 	  ethernet = NULL;
 #endif /* INTERFACE_ETH */
 	}
-	~CTestboard() { RPC_EXIT }
+	~CTestboard() {
+	  RPC_EXIT
+	  delete rpc_recorder;
+	  delete rpc_replay;
+	}
 
 	int32_t GetHostRpcCallCount() { return rpc_cmdListSize; }
 	bool GetHostRpcCallName(int32_t id, stringR &callName) { callName = rpc_cmdName[id]; return true; }
@@ -64,24 +111,73 @@ public:
 	RPC_EXPORT bool    GetRpcCallName(int32_t id, stringR &callName);
 	RPC_EXPORT uint32_t GetRpcCallHash();
 
+	// Resolve the ids of all calls not known yet. The requests are sent in
+	// one transfer and their replies received in one go:
 	bool RpcLink() {
+	  RPC_PROFILING
 
-	  bool error = false;
+	  std::vector<unsigned short> calls;
 	  for (unsigned short i = 2; i < rpc_cmdListSize; i++) {
-	    try { rpc_GetCallId(i); }
-	    catch (CRpcError &e) {
-	      e.SetFunction(0);
-	      if (!error) { LOG(pxar::logERROR) << "Missing DTB functions:"; }
-	      std::string fname(rpc_cmdName[i]);
-	      std::string fname_pretty;
-	      rpc_TranslateCallName(fname, fname_pretty);
-	      LOG(pxar::logERROR) << fname_pretty.c_str();
-	      error = true;
+	    if (rpc_cmdId[i] < 0) calls.push_back(i);
+	  }
+
+	  std::vector<int32_t> ids(calls.size());
+	  try {
+	    uint16_t callId = rpc_GetCallId(1);
+	    RPC_THREAD_LOCK
+	    for (size_t i = 0; i < calls.size(); i++) {
+	      rpcMessage msg;
+	      msg.Create(callId);
+	      msg.Send(*rpc_io);
+	      rpc_Send(*rpc_io, string(rpc_cmdName[calls[i]]));
 	    }
+	    rpc_io->Flush();
+	    for (size_t i = 0; i < calls.size(); i++) {
+	      rpcMessage msg;
+	      msg.Receive(*rpc_io);
+	      msg.Check(callId, 4);
+	      ids[i] = msg.Get_INT32();
+	    }
+	  } catch (CRpcError &e) { e.SetFunction(1); throw; }
+
+	  bool error = false;
+	  for (size_t i = 0; i < calls.size(); i++) {
+	    rpc_cmdId[calls[i]] = ids[i];
+	    if (rpc_cmdId[calls[i]] >= 0) continue;
+	    if (!error) { LOG(pxar::logERROR) << "Missing DTB functions:"; }
+	    std::string fname(rpc_cmdName[calls[i]]);
+	    std::string fname_pretty;
+	    rpc_TranslateCallName(fname, fname_pretty);
+	    LOG(pxar::logERROR) << fname_pretty.c_str();
+	    error = true;
 	  }
 	  return !error;
 	}
 
+	// Table of the DTB call ids, indexed like GetHostRpcCallNames(). Calls
+	// not resolved yet have the id -1:
+	std::vector<int32_t> GetRpcCallIds() {
+	  return std::vector<int32_t>(rpc_cmdId, rpc_cmdId + rpc_cmdListSize);
+	}
+
+	void SetRpcCallIds(const std::vector<int32_t> &ids) {
+	  for (unsigned int i = 2; i < rpc_cmdListSize && i < ids.size(); i++) rpc_cmdId[i] = ids[i];
+	}
+
+	std::string GetHostRpcTimestamp() { return rpc_timestamp; }
+
+	// Statistics of all calls made since the last clear, keyed by their RPC
+	// names. The transfers at the end of batches are counted as "BatchEnd":
+	void GetRpcStatistics(std::map<std::string, CRpcCallTotals> &stats) {
+	  for (unsigned int i = 0; i < rpc_stats.Size(); i++) {
+	    CRpcCallTotals call = rpc_stats.Get(i);
+	    if (call.calls == 0) continue;
+	    stats[(i < rpc_cmdListSize) ? rpc_cmdName[i] : "BatchEnd"] = call;
+	  }
+	}
+
+	void ClearRpcStatistics() { rpc_stats.Clear(); }
+
 
 	// === DTB connection ====================================================
 
@@ -126,6 +222,37 @@ public:
 	  rpc_io = &RpcIoNull;
 	}
 
+
+	// === session recording =================================================
+	// All transfers of the selected interface can be recorded to a session
+	// file, which can later be replayed in place of the DTB (see rpc_record.h).
+
+	bool StartRecording(const std::string &filename) {
+	  if (Recording() || Replaying()) return false;
+	  if (rpc_recorder == NULL) rpc_recorder = new CRpcIoRecord();
+	  if (!rpc_recorder->Start(rpc_io, filename.c_str())) return false;
+	  rpc_io = rpc_recorder;
+	  return true;
+	}
+
+	void StopRecording() {
+	  if (Recording()) rpc_io = rpc_recorder->Stop();
+	}
+
+	bool Recording() { return rpc_recorder != NULL && rpc_recorder->Recording(); }
+
+	// Select the replay, it is opened with the name of the session file.
+	// With timing, replies are delayed like the recorded DTB answered:
+	bool SelectReplay(bool timing) {
+	  if (Recording()) return false;
+	  if (rpc_replay == NULL) rpc_replay = new CRpcIoReplay();
+	  rpc_replay->SetTiming(timing);
+	  rpc_io = rpc_replay;
+	  return true;
+	}
+
+	bool Replaying() { return rpc_replay != NULL && rpc_io == rpc_replay; }
+
 	bool EnumFirst(CRpcIo* io, unsigned int &nDevices) { return io->EnumFirst(nDevices); }
 	bool EnumNext(CRpcIo* io, string &name) {
 	  char s[64];
@@ -217,6 +344,53 @@ public:
 	void Clear() { rpc_io->Clear(); }
 
 
+	// === command batching ==================================================
+	// Calls issued between BatchBegin() and BatchEnd() are sent to the DTB in
+	// one transfer, Flush() requests in between are absorbed. Calls with a
+	// return value are either sent right away together with all calls queued
+	// before, or queued using their deferred variants below; deferred results
+	// are available after BatchEnd(). Batches can be nested.
+
+	void BatchBegin() {
+	  if (rpc_batchDepth++ > 0) return;
+	  rpc_batch.Attach(rpc_io);
+	  rpc_io = &rpc_batch;
+	}
+
+	void BatchEnd() {
+	  if (rpc_batchDepth == 0 || --rpc_batchDepth > 0) return;
+	  CRpcCallTimer rpc_callTimer(rpc_stats);
+	  rpc_callTimer.Select(rpc_cmdListSize);
+	  rpc_io = rpc_batch.Release();
+	  rpc_batch.Execute(*rpc_io);
+	}
+
+	// Close a batch without throwing, e.g. when leaving it after an error:
+	void BatchAbort() {
+	  try { BatchEnd(); }
+	  catch (CRpcError &e) {
+	    LOG(pxar::logDEBUGRPC) << "Closing RPC batch failed: " << e.GetMsg();
+	  }
+	}
+
+	bool InBatch() { return rpc_batchDepth > 0; }
+
+	// The call indices are looked up once, on first use:
+	void _GetVD(CRpcResult<uint16_t> &value) { static const uint16_t cmd = rpc_FindCmd("_GetVD$S"); rpc_Defer(cmd, value); }
+	void _GetVA(CRpcResult<uint16_t> &value) { static const uint16_t cmd = rpc_FindCmd("_GetVA$S"); rpc_Defer(cmd, value); }
+	void _GetID(CRpcResult<uint16_t> &value) { static const uint16_t cmd = rpc_FindCmd("_GetID$S"); rpc_Defer(cmd, value); }
+	void _GetIA(CRpcResult<uint16_t> &value) { static const uint16_t cmd = rpc_FindCmd("_GetIA$S"); rpc_Defer(cmd, value); }
+	void GetADC(uint8_t addr, CRpcResult<uint16_t> &value) {
+	  static const uint16_t cmd = rpc_FindCmd("GetADC$SC");
+	  RPC_PROFILING
+	  rpcMessage msg;
+	  try { msg.Create(rpc_GetCallId(cmd)); }
+	  catch (CRpcError &e) { e.SetFunction(cmd); throw; }
+	  msg.Put_UINT8(addr);
+	  rpc_Defer(msg, value);
+	}
+
+
 	// === DTB identification ================================================
 
 	RPC_EXPORT void GetInfo(stringR &info);
@@ -339,6 +513,32 @@ public:
 	RPC_EXPORT uint8_t Daq_FillLevel();
 	RPC_EXPORT uint8_t Daq_Read(HWvectorR<uint16_t> &data, uint32_t blocksize = 65536, uint8_t channel = 0);
 	RPC_EXPORT uint8_t Daq_Read(HWvectorR<uint16_t> &data, uint32_t blocksize, uint32_t &availsize, uint8_t channel = 0);
+
+	// Daq_Read into reusable storage: the data is received straight into
+	// "buffer", "size" is set to the number of words received. The buffer
+	// keeps its size and only grows when a block does not fit:
+	uint8_t Daq_ReadInto(vector<uint16_t> &buffer, uint32_t &size, uint32_t blocksize, uint32_t &availsize, uint8_t channel = 0) {
+	  RPC_PROFILING
+	  static const uint16_t cmd = rpc_FindCmd("Daq_Read$C5SI0IC");
+	  uint8_t state;
+	  try {
+	    uint16_t callId = rpc_GetCallId(cmd);
+	    RPC_THREAD_LOCK
+	    rpcMessage msg;
+	    msg.Create(callId);
+	    msg.Put_UINT32(blocksize);
+	    msg.Put_UINT32(availsize);
+	    msg.Put_UINT8(channel);
+	    msg.Send(*rpc_io);
+	    rpc_io->Flush();
+	    msg.Receive(*rpc_io);
+	    msg.Check(callId, 5);
+	    state = msg.Get_UINT8();
+	    availsize = msg.Get_UINT32();
+	    size = rpc_ReceiveInto(*rpc_io, buffer);
+	  } catch (CRpcError &e) { e.SetFunction(cmd); throw; }
+	  return state;
+	}
 	
 
 	RPC_EXPORT void Daq_Select_ADC(uint16_t blocksize, uint8_t source, uint8_t start, uint8_t stop = 0);
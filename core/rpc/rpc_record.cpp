@@ -0,0 +1,221 @@
+// rpc_record.cpp
+
+#include "rpc_record.h"
+#include "rpc_error.h"
+#include "log.h"
+#include <cstring>
+#include <thread>
+
+#define RPC_SESSION_HEADER 13
+
+
+// === recording ============================================================
+
+uint64_t CRpcIoRecord::Now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+
+void CRpcIoRecord::Store(char type, std::vector<unsigned char> &data, uint64_t time)
+{
+	if (data.empty()) return;
+	unsigned char header[RPC_SESSION_HEADER];
+	uint32_t size = data.size();
+	header[0] = type;
+	for (unsigned int i = 0; i < 4; i++) header[1+i] = size >> (8*i);
+	for (unsigned int i = 0; i < 8; i++) header[5+i] = time >> (8*i);
+	m_file.write(reinterpret_cast<char*>(header), RPC_SESSION_HEADER);
+	m_file.write(reinterpret_cast<char*>(&data[0]), size);
+	data.clear();
+}
+
+
+bool CRpcIoRecord::Start(CRpcIo *io, const char *filename)
+{
+	Stop();
+	m_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!m_file) return false;
+	m_file.write(RPC_SESSION_MAGIC, strlen(RPC_SESSION_MAGIC));
+	m_io = io;
+	m_start = std::chrono::steady_clock::now();
+	return true;
+}
+
+
+CRpcIo* CRpcIoRecord::Stop()
+{
+	CRpcIo *io = m_io;
+	if (m_io == NULL) return io;
+	Store('R', m_read, m_readTime);
+	m_written.clear();
+	m_file.close();
+	m_io = NULL;
+	return io;
+}
+
+
+void CRpcIoRecord::Write(const void *buffer, uint32_t size)
+{
+	m_io->Write(buffer, size);
+	Store('R', m_read, m_readTime);
+	const unsigned char *data = static_cast<const unsigned char*>(buffer);
+	m_written.insert(m_written.end(), data, data + size);
+}
+
+
+void CRpcIoRecord::Flush()
+{
+	Store('R', m_read, m_readTime);
+	Store('W', m_written, Now());
+	m_io->Flush();
+}
+
+
+void CRpcIoRecord::Clear()
+{
+	m_io->Clear();
+	Store('R', m_read, m_readTime);
+}
+
+
+void CRpcIoRecord::Read(void *buffer, uint32_t size)
+{
+	m_io->Read(buffer, size);
+	if (m_read.empty()) m_readTime = Now();
+	const unsigned char *data = static_cast<const unsigned char*>(buffer);
+	m_read.insert(m_read.end(), data, data + size);
+}
+
+
+void CRpcIoRecord::Close()
+{
+	Store('R', m_read, m_readTime);
+	m_file.flush();
+	m_io->Close();
+}
+
+
+// === replay ===============================================================
+
+// Next record of the given type, records of the other type are skipped.
+// Reading follows the requests it skips to time the replies:
+bool CRpcIoReplay::Next(std::ifstream &file, char type, std::vector<unsigned char> &data, uint64_t &time)
+{
+	unsigned char header[RPC_SESSION_HEADER];
+	while (file.read(reinterpret_cast<char*>(header), RPC_SESSION_HEADER)) {
+		uint32_t size = 0;
+		time = 0;
+		for (unsigned int i = 0; i < 4; i++) size |= static_cast<uint32_t>(header[1+i]) << (8*i);
+		for (unsigned int i = 0; i < 8; i++) time |= static_cast<uint64_t>(header[5+i]) << (8*i);
+
+		if (header[0] != type) {
+			file.seekg(size, std::ios::cur);
+			if (&file == &m_reads) { m_requests++; m_requestTime = time; }
+			continue;
+		}
+		data.resize(size);
+		if (size == 0 || file.read(reinterpret_cast<char*>(&data[0]), size)) return true;
+		break;
+	}
+	return false;
+}
+
+
+bool CRpcIoReplay::Open(char name[])
+{
+	Close();
+	m_writes.clear();
+	m_reads.clear();
+	m_writes.open(name, std::ios::binary);
+	m_reads.open(name, std::ios::binary);
+
+	char magic[8];
+	size_t length = strlen(RPC_SESSION_MAGIC);
+	for (unsigned int i = 0; i < 2; i++) {
+		std::ifstream &file = i ? m_reads : m_writes;
+		if (!file.read(magic, length) || strncmp(magic, RPC_SESSION_MAGIC, length) != 0) {
+			m_error = 1;
+			Close();
+			return false;
+		}
+	}
+
+	m_written.clear();
+	m_flushTime.clear();
+	m_mismatches = 0;
+	m_data.clear();
+	m_pos = 0;
+	m_requests = 0;
+	m_requestTime = 0;
+	m_error = 0;
+	m_open = true;
+	return true;
+}
+
+
+void CRpcIoReplay::Close()
+{
+	if (m_open && m_mismatches > 0) {
+		LOG(pxar::logWARNING) << "Replay diverged from the recorded session in " << m_mismatches << " of " << m_flushTime.size() << " transfers.";
+	}
+	m_writes.close();
+	m_reads.close();
+	m_open = false;
+}
+
+
+const char* CRpcIoReplay::GetErrorMsg(int error)
+{
+	return error ? "could not read session file" : "ok";
+}
+
+
+void CRpcIoReplay::Write(const void *buffer, uint32_t size)
+{
+	if (!m_open) throw CRpcError(CRpcError::WRITE_ERROR);
+	const unsigned char *data = static_cast<const unsigned char*>(buffer);
+	m_written.insert(m_written.end(), data, data + size);
+}
+
+
+void CRpcIoReplay::Flush()
+{
+	if (m_written.empty()) return;
+	m_flushTime.push_back(std::chrono::steady_clock::now());
+
+	uint64_t time;
+	if (!Next(m_writes, 'W', m_expected, time) || m_expected != m_written) {
+		if (m_mismatches++ == 0) {
+			LOG(pxar::logWARNING) << "Replay diverges from the recorded session at transfer " << m_flushTime.size()
+				<< ", the replies will not match the requests.";
+		}
+	}
+	m_written.clear();
+}
+
+
+void CRpcIoReplay::Read(void *buffer, uint32_t size)
+{
+	if (!m_open) throw CRpcError(CRpcError::READ_ERROR);
+
+	unsigned char *data = static_cast<unsigned char*>(buffer);
+	while (size > 0) {
+		if (m_pos == m_data.size()) {
+			uint64_t time;
+			if (!Next(m_reads, 'R', m_data, time)) throw CRpcError(CRpcError::READ_ERROR);
+			m_pos = 0;
+
+			// Wait for the time the DTB took to answer the last request sent:
+			if (m_timed && m_requests > 0 && m_requests <= m_flushTime.size() && time > m_requestTime) {
+				std::this_thread::sleep_until(m_flushTime[m_requests-1] + std::chrono::microseconds(time - m_requestTime));
+			}
+		}
+		uint32_t n = m_data.size() - m_pos;
+		if (n > size) n = size;
+		memcpy(data, &m_data[m_pos], n);
+		m_pos += n;
+		data += n;
+		size -= n;
+	}
+}
@@ -0,0 +1,105 @@
+// rpc_record.h
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "rpc_io.h"
+
+
+// Session files hold all transfers between the host and the DTB. After the
+// magic "PXARRPC1" follow records of
+//   type  1 byte, 'W' data written up to a Flush(), 'R' data read
+//   size  4 bytes
+//   time  8 bytes, us since the start of the session
+// and the data. Numbers are little endian. Consecutive reads are merged into
+// one record, stamped with the time the first of them returned.
+
+#define RPC_SESSION_MAGIC "PXARRPC1"
+
+
+// Passes all calls on to the interface it was started on and logs them:
+class CRpcIoRecord : public CRpcIo
+{
+	CRpcIo *m_io;
+	std::ofstream m_file;
+	std::chrono::steady_clock::time_point m_start;
+	std::vector<unsigned char> m_written, m_read;
+	uint64_t m_readTime;
+
+	uint64_t Now();
+	void Store(char type, std::vector<unsigned char> &data, uint64_t time);
+public:
+	CRpcIoRecord() : m_io(NULL), m_readTime(0) {}
+	~CRpcIoRecord() { Stop(); }
+	bool Start(CRpcIo *io, const char *filename);
+	// Closes the file and returns the interface recorded:
+	CRpcIo* Stop();
+	bool Recording() { return m_io != NULL; }
+
+	void Write(const void *buffer, uint32_t size);
+	void Flush();
+	void Clear();
+	void Read(void *buffer, uint32_t size);
+	const char* Name() { return m_io->Name(); }
+	// Error processing
+	int32_t GetLastError() { return m_io->GetLastError(); }
+	const char* GetErrorMsg(int error) { return m_io->GetErrorMsg(error); }
+	// Connection
+	bool Open(char name[]) { return m_io->Open(name); }
+	void Close();
+	bool EnumFirst(uint32_t &nDevices) { return m_io->EnumFirst(nDevices); }
+	bool EnumNext(char name[]) { return m_io->EnumNext(name); }
+	bool Enum(char name[], uint32_t pos) { return m_io->Enum(name, pos); }
+	bool Connected() { return m_io->Connected(); }
+	void SetTimeout(unsigned int timeout) { m_io->SetTimeout(timeout); }
+};
+
+
+// Serves a recorded session in place of the DTB, opened by the name of the
+// session file. The data written is compared to the recording, reads return
+// the data recorded. With timing, every reply is delayed after the request
+// preceding it by the time the DTB took in the recording.
+class CRpcIoReplay : public CRpcIo
+{
+	bool m_timed;
+	bool m_open;
+	int32_t m_error;
+
+	// Writes and reads are followed with separate cursors through the file:
+	std::ifstream m_writes, m_reads;
+	std::vector<unsigned char> m_written, m_expected;
+	std::vector<std::chrono::steady_clock::time_point> m_flushTime;
+	uint32_t m_mismatches;
+
+	std::vector<unsigned char> m_data;
+	size_t m_pos;
+	uint32_t m_requests;
+	uint64_t m_requestTime;
+
+	bool Next(std::ifstream &file, char type, std::vector<unsigned char> &data, uint64_t &time);
+public:
+	CRpcIoReplay() : m_timed(true), m_open(false), m_error(0), m_mismatches(0), m_pos(0), m_requests(0), m_requestTime(0) {}
+	void SetTiming(bool timed) { m_timed = timed; }
+
+	void Write(const void *buffer, uint32_t size);
+	void Flush();
+	void Clear() {}
+	void Read(void *buffer, uint32_t size);
+	const char* Name() { return "replay"; }
+	// Error processing
+	int32_t GetLastError() { return m_error; }
+	const char* GetErrorMsg(int error);
+	// Connection
+	bool Open(char name[]);
+	void Close();
+	bool EnumFirst(uint32_t &nDevices) { nDevices = 0; return false; }
+	bool EnumNext(char /*name*/[]) { return false; }
+	bool Enum(char /*name*/[], uint32_t /*pos*/) { return false; }
+	bool Connected() { return m_open; }
+	void SetTimeout(unsigned int /*timeout*/) {}
+};
@@ -1,5 +1,5 @@
 // Class provides basic functionalities to use the USB interface
-// IMPORTANT: there are two implementations for this class, each using a different USB library.
+// IMPORTANT: there are three implementations for this class, each using a different USB library.
 // What implementation is being used is determined by the arguments to the configure script
 // and then passed through the makefiles to the compiler.
 // Please implement and test your modifications for both versions.
@@ -19,7 +19,9 @@ typedef uint32_t DWORD;
 #endif //WIN32
 #endif //WIN32 && CINT
 
-#ifdef HAVE_LIBFTDI
+#if defined HAVE_LIBUSB
+#include <libusb.h>
+#elif defined HAVE_LIBFTDI
 #include <ftdi.h>
 #else
 #include <ftd2xx.h>
@@ -35,13 +37,23 @@ typedef uint32_t DWORD;
 
 #define ESC_EXTENDED 0x8f
 
+#ifdef HAVE_LIBUSB
+struct CUsbReadQueue;
+#endif
+
 class CUSB : public CRpcIo
 {
   bool isUSB_open;
 
   int ftdiStatus;
 
-#ifndef HAVE_LIBFTDI
+#if defined HAVE_LIBUSB
+  libusb_context *usbContext;
+  libusb_device_handle *usbHandle;
+  // bulk reads in flight and the data they received:
+  CUsbReadQueue *readQueue;
+  uint32_t m_readTransfers, m_readTransferSize;
+#elif !defined HAVE_LIBFTDI
   FT_HANDLE ftHandle;
 #endif
 
@@ -91,6 +103,10 @@ public:
 
   bool Show();
   void SetTimeout(unsigned int timeout);
+#ifdef HAVE_LIBUSB
+  // number and size in bytes of the bulk reads kept in flight, used from the next Open():
+  void SetReadTransfers(uint32_t count, uint32_t size);
+#endif
 
 
   // read methods
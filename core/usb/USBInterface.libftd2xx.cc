@@ -1,10 +1,10 @@
 #ifndef WIN32
 #include <libusb.h>
-#include <cstring>
 #include <unistd.h>
 #include <time.h> // needed for usleep function
 #endif
 
+#include <cstring>
 #include <cstdio>
 #include <stdlib.h>
 #include <stdio.h>
@@ -215,11 +215,17 @@ void CUSB::Close()
 void CUSB::Write(uint32_t bytesToWrite, const void *buffer)
 {
   if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
-	uint32_t k=0;
-	for (k=0; k < bytesToWrite; k++)
+	// copy in blocks of what fits into the write buffer, flushing it when full:
+	const unsigned char *data = reinterpret_cast<const unsigned char*>(buffer);
+	while (bytesToWrite > 0)
 	{
 		if (m_posW >= USBWRITEBUFFERSIZE) { Flush(); }
-		m_bufferW[m_posW++] = (reinterpret_cast<unsigned char*>(const_cast<void*>(buffer)))[k];
+		uint32_t n = USBWRITEBUFFERSIZE - m_posW;
+		if (n > bytesToWrite) n = bytesToWrite;
+		memcpy(m_bufferW + m_posW, data, n);
+		m_posW += n;
+		data += n;
+		bytesToWrite -= n;
 	}
 }
 
@@ -286,35 +292,32 @@ void CUSB::Read(uint32_t bytesToRead, void *buffer, uint32_t &bytesRead)
 	bool timeout = false;
 	bytesRead = 0;
 
-	uint32_t i;
-
-	for (i=0; i<bytesToRead; i++)
+	unsigned char *data = reinterpret_cast<unsigned char*>(buffer);
+	while (bytesRead < bytesToRead)
 	{
+		// copy what is left in the read buffer in one block:
 		if (m_posR<m_sizeR)
-		  (reinterpret_cast<unsigned char*>(const_cast<void*>(buffer)))[i] = m_bufferR[m_posR++];
+		{
+			uint32_t n = m_sizeR - m_posR;
+			if (n > bytesToRead-bytesRead) n = bytesToRead-bytesRead;
+			memcpy(data + bytesRead, m_bufferR + m_posR, n);
+			m_posR += n;
+			bytesRead += n;
+		}
 
 		else if (!timeout)
 		{
-			uint32_t n = bytesToRead-i;
+			uint32_t n = bytesToRead-bytesRead;
 			if (n>USBREADBUFFERSIZE) n = USBREADBUFFERSIZE;
 
 			if (!FillBuffer(n)) throw UsbConnectionError("Error writing to USB");
 			if (m_sizeR < n) timeout = true;
 
-			if (m_posR<m_sizeR)
-			  (reinterpret_cast<unsigned char*>(const_cast<void*>(buffer)))[i] = m_bufferR[m_posR++];
-			else
-			{   // timeout (bytesRead < bytesToRead)
-				bytesRead = i;
-				throw UsbConnectionTimeout("Read from USB timed out.");
-			}
+			// timeout (bytesRead < bytesToRead)
+			if (m_posR>=m_sizeR) throw UsbConnectionTimeout("Read from USB timed out.");
 		}
 
-		else
-		{
-			bytesRead = i;
-			throw UsbConnectionTimeout("Read from USB timed out.");
-		}
+		else throw UsbConnectionTimeout("Read from USB timed out.");
 	}
 
 	bytesRead = bytesToRead;
@@ -8,22 +8,21 @@
 #include <time.h> // needed for usleep function
 
 #include "log.h"
+#include "timer.h"
 #include "exceptions.h"
+#include "ringbuffer.h"
 
 #include "USBInterface.h"
 
 // needed for threaded readout of FTDI
 #include <pthread.h> 
-#include <semaphore.h>
 
 static struct ftdi_context ftdic;
 
 // the read buffer needs to be accessable outside of our USB class
 #define BUFSIZE 0x200000
 static pthread_t readerthread;
-static sem_t buf_data, buf_space;
-static unsigned char read_buffer[BUFSIZE];
-static int32_t head, tail; // read buffer is used as ring buffer
+static pxar::ringBuffer read_buffer(BUFSIZE); // filled by the reader thread only
 
 // cleanup is threaded to include a timeout on the calls to the device that sometimes hang
 pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -37,20 +36,22 @@ const int32_t vendorID = 0x0403; // Future Technology Devices International, Ltd
 using namespace std;
 using namespace pxar;
 
-static void add_to_buf (unsigned char c) {
-    int32_t nh;
-
-    sem_wait (&buf_space);
-    if (head == (BUFSIZE -1)) nh = 0;
-    else                      nh = head + 1;
-
-    if (nh == tail) {
-        fprintf (stderr, "USBInterface (libftdi) FATAL: overflow of circular buffer in threaded read routine. Sorry -- will exit now.\n");
-        exit (1);
+static void add_to_buf (const unsigned char *buf, int32_t size) {
+    // the ring buffer waits on a condition variable, which must not be
+    // a cancellation point: cancellation is only allowed in between
+    int oldstate;
+    int32_t written = 0;
+    pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &oldstate);
+    while (1) {
+      written += read_buffer.write (buf + written, size - written);
+      if (written == size) break;
+      // buffer full, wait for the consumer to make space:
+      pthread_setcancelstate (oldstate, NULL);
+      pthread_testcancel();
+      pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &oldstate);
+      read_buffer.waitSpace (10);
     }
-    read_buffer[head] = c;
-    head = nh;
-    sem_post (&buf_data);
+    pthread_setcancelstate (oldstate, NULL);
 }
 
 static void *reader (void *arg) {
@@ -59,10 +60,9 @@ static void *reader (void *arg) {
   // non-blocking calls
     struct ftdi_context *handle = reinterpret_cast<struct ftdi_context *>(arg);
     unsigned char buf[0x1000];
-    int32_t br, i;
+    int32_t br;
 
     while (1) {
-      usleep(100); // wait 0.1 ms
       pthread_testcancel();
       br = ftdi_read_data (handle, buf, sizeof(buf));
       pthread_testcancel();
@@ -70,11 +70,8 @@ static void *reader (void *arg) {
 	LOG(logCRITICAL)<< "ERROR during USB read polling: error code from libusb_bulk_transfer(): " << br;
 	throw UsbConnectionError("ERROR during USB read polling");
       }
-      if (br > 0){
-	for (i=0; i<br; i++){
-	  add_to_buf (buf[i]);
-	}
-      }
+      if (br > 0) add_to_buf (buf, br);
+      else usleep(100); // nothing received, wait 0.1 ms
     }
     return NULL;
 }
@@ -367,8 +364,7 @@ bool CUSB::Open(char serialNumber[])
 
 
   // init threads for client-side data buffering
-  sem_init (&buf_data, 0, 0);
-  sem_init (&buf_space, 0, BUFSIZE);
+  read_buffer.clear();
   pthread_create (&readerthread, NULL, reader, &ftdic);
 
   return true;
@@ -379,10 +375,8 @@ void CUSB::Close(){
   if( !isUSB_open) return;
   pthread_cancel(readerthread);
   usleep(10000);
-  // join reader thread and clean up semaphores
+  // join reader thread
   pthread_join(readerthread, NULL);
-  sem_destroy (&buf_data);
-  sem_destroy (&buf_space);
   usleep(10000);
   // set the flag (lock mutex first)
   pthread_mutex_lock(&cleanup_mutex); usbclose_done = false; pthread_mutex_unlock(&cleanup_mutex);
@@ -411,12 +405,17 @@ void CUSB::WriteCommand(unsigned char x){
 void CUSB::Write(uint32_t bytesToWrite, const void *buffer)
 { 
   if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
-  uint32_t k=0;
-  for( k=0; k < bytesToWrite; k++ ) {
+  // copy in blocks of what fits into the write buffer, flushing it when full:
+  const unsigned char *data = reinterpret_cast<const unsigned char*>(buffer);
+  while (bytesToWrite > 0) {
     if( m_posW >= USBWRITEBUFFERSIZE) {Flush();}
-    m_bufferW[m_posW++] = (reinterpret_cast<unsigned char*>(const_cast<void*>(buffer)))[k];
+    uint32_t n = USBWRITEBUFFERSIZE - m_posW;
+    if (n > bytesToWrite) n = bytesToWrite;
+    memcpy(m_bufferW + m_posW, data, n);
+    m_posW += n;
+    data += n;
+    bytesToWrite -= n;
   }
-  return;
 }
 
 
@@ -448,46 +447,32 @@ bool CUSB::FillBuffer(uint32_t /*minBytesToRead*/)
 void CUSB::Read(uint32_t bytesToRead, void *buffer, uint32_t &bytesRead)
 {
   if (!isUSB_open) throw UsbConnectionError("Attempt to read from USB without open connection.");
- 
-   // Copy over data from the circular buffer
-    uint32_t timewasted = 0; // time in ms wasted in this routine
-
-    uint32_t bytesReadSoFar = 0;
-      for (uint32_t i=0; i<bytesToRead; i++) {
-	bool bufferready = true;
-	if (tail == head) bufferready = false;
-	if (!bufferready){
-	  while (!bufferready && timewasted<m_timeout){
-	    if (timewasted==(m_timeout/10)) {
-	      LOG(logWARNING) << "USBInterface: Read(): data not ready (got " << bytesReadSoFar << "b of "<< bytesToRead <<"b) after " << timewasted << "ms yet! Will wait for up to " << m_timeout << "ms";
-	    }
-	    usleep(1000); //wait 1 ms
-	    timewasted++;
-	    if (tail != head) bufferready = true;	    
-	  }
-	}
-	if (bufferready){
-	  sem_wait (&buf_data);	
-	  (reinterpret_cast<unsigned char*>(const_cast<void*>(buffer)))[i] = read_buffer[tail];
-	  if (tail == (BUFSIZE -1)) tail = 0;
-	  else                      tail++;
-	  sem_post (&buf_space);
-	  bytesReadSoFar++;
-	} 
-	else // buffer was not ready and reading it timed out so we stop attempting it now
-	  {
-	    bytesRead = i;
-	    LOG(logCRITICAL) << " Timeout reading from USB buffer after " << m_timeout << " ms ";
-	    if (bytesRead < bytesToRead) {
-	      LOG(logCRITICAL) << "Requested to read " << bytesToRead 
-			       << "b, actually read  " << bytesRead 
-			       << "b - " << (bytesToRead-bytesRead) << "b missing!";
-	    }
-	    throw UsbConnectionTimeout("Timeout reading from USB");
-	    break;
-	  }
-      }
-      bytesRead = bytesReadSoFar;
+
+  // Copy over data from the ring buffer in bulk, waiting for the reader thread if it runs empty:
+  unsigned char *data = reinterpret_cast<unsigned char*>(buffer);
+  bytesRead = read_buffer.read(data, bytesToRead);
+  if (bytesRead == bytesToRead) return;
+
+  timer t;
+  bool warned = false;
+  while (bytesRead < bytesToRead) {
+    uint32_t timewasted = t.get(); // time in ms wasted in this routine
+    if (timewasted >= m_timeout) {
+      // buffer was not ready and reading it timed out so we stop attempting it now
+      LOG(logCRITICAL) << " Timeout reading from USB buffer after " << m_timeout << " ms ";
+      LOG(logCRITICAL) << "Requested to read " << bytesToRead 
+		       << "b, actually read  " << bytesRead 
+		       << "b - " << (bytesToRead-bytesRead) << "b missing!";
+      throw UsbConnectionTimeout("Timeout reading from USB");
+    }
+    if (!warned && timewasted >= m_timeout/10) {
+      LOG(logWARNING) << "USBInterface: Read(): data not ready (got " << bytesRead << "b of "<< bytesToRead <<"b) after " << timewasted << "ms yet! Will wait for up to " << m_timeout << "ms";
+      warned = true;
+    }
+    // sleep until the reader thread delivers, the warning is due or the timeout expires:
+    read_buffer.waitData((warned ? m_timeout : m_timeout/10) - timewasted);
+    bytesRead += read_buffer.read(data + bytesRead, bytesToRead - bytesRead);
+  }
 }
 
 //----------------------------------------------------------------------
@@ -498,11 +483,7 @@ void CUSB::Clear()
   ftdiStatus = ftdi_usb_purge_buffers(&ftdic);
 
   // drain our buffer.
-  while (head != tail) {
-    unsigned char t;
-    uint32_t n;
-    Read(1, &t, n);
-  }
+  read_buffer.clear();
 
   m_posR = m_sizeR = 0;
   m_posW = 0;
@@ -520,7 +501,7 @@ bool CUSB::Show()
 
   unsigned char latency;
   if (ftdi_get_latency_timer(&ftdic,&latency)==0){ LOG(logINFO) << "  - FTDI latency timer set to " << static_cast<int>(latency); }
-  LOG(logINFO) << "  - data waiting in local read buffer: " << !(tail == head);
+  LOG(logINFO) << "  - data waiting in local read buffer: " << !read_buffer.empty();
  
   return true;
 }
@@ -0,0 +1,538 @@
+#include <libusb.h>
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "log.h"
+#include "timer.h"
+#include "config.h"
+#include "exceptions.h"
+#include "ringbuffer.h"
+
+#include "USBInterface.h"
+
+// The FTDI chip is driven through libusb directly. Reads are asynchronous:
+// a number of bulk transfers is kept in flight by an event thread, so the
+// chip always has a request to send its data to. The received data is
+// queued in a ring buffer for CUSB::Read().
+
+const uint16_t productID_FT232H = 0x6014; // new testboard FTDI chip product id (FT232H)
+const uint16_t productID_OLD = 0x6001; //  single channel devices (R Chips) used in older test boards
+const uint16_t vendorID = 0x0403; // Future Technology Devices International, Ltd
+
+// FTDI vendor requests and endpoints (see libftdi):
+#define FTDI_REQTYPE_OUT (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT)
+#define FTDI_REQTYPE_IN (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN)
+#define FTDI_SIO_RESET 0x00
+#define FTDI_SIO_SET_LATENCY_TIMER 0x09
+#define FTDI_SIO_GET_LATENCY_TIMER 0x0A
+#define FTDI_SIO_SET_BITMODE 0x0B
+#define FTDI_SIO_RESET_SIO 0
+#define FTDI_SIO_PURGE_RX 1
+#define FTDI_SIO_PURGE_TX 2
+#define FTDI_INDEX 1 // interface A
+#define FTDI_EP_IN 0x81
+#define FTDI_EP_OUT 0x02
+#define FTDI_STATUS_BYTES 2 // modem status at the start of every packet read
+#define FTDI_BITMODE_SYNCFF 0x40
+#define FTDI_CONTROL_TIMEOUT 1000 // ms
+
+#define BUFSIZE 0x200000
+
+using namespace std;
+using namespace pxar;
+
+// Bulk reads in flight, filled in by the event thread. When the ring buffer
+// has no space for the data of a transfer, the transfer is parked and only
+// resubmitted once the consumer made space, the event thread never blocks.
+// All writes to the ring buffer are serialized by the mutex.
+struct CUsbReadQueue {
+  CUsbReadQueue(libusb_context *context, size_t ringsize, uint32_t packetsize)
+    : ctx(context), ring(ringsize), packetSize(packetsize), active(0), stop(false), error(0), nParked(0) {}
+
+  libusb_context *ctx;
+  ringBuffer ring;
+  uint32_t packetSize;
+
+  std::vector<libusb_transfer*> transfers;
+  std::atomic<int> active; // transfers submitted and not completed yet
+  std::atomic<bool> stop;
+  std::atomic<int> error; // status of the first failed transfer
+  std::thread events;
+
+  std::mutex mutex;
+  std::vector<libusb_transfer*> parked;
+  std::atomic<size_t> nParked;
+
+  // Data of a transfer without the status bytes of the packets:
+  size_t payload(libusb_transfer *transfer) const {
+    size_t size = 0;
+    for (int pos = 0; pos < transfer->actual_length; pos += packetSize) {
+      int n = std::min(static_cast<int>(packetSize), transfer->actual_length - pos);
+      if (n > FTDI_STATUS_BYTES) size += n - FTDI_STATUS_BYTES;
+    }
+    return size;
+  }
+
+  void copy(libusb_transfer *transfer) {
+    for (int pos = 0; pos < transfer->actual_length; pos += packetSize) {
+      int n = std::min(static_cast<int>(packetSize), transfer->actual_length - pos);
+      if (n > FTDI_STATUS_BYTES) ring.write(transfer->buffer + pos + FTDI_STATUS_BYTES, n - FTDI_STATUS_BYTES);
+    }
+  }
+
+  // Called with the mutex locked:
+  void submit(libusb_transfer *transfer) {
+    if (stop) return;
+    active++;
+    int status = libusb_submit_transfer(transfer);
+    if (status != 0) {
+      active--;
+      int none = 0;
+      error.compare_exchange_strong(none, status);
+    }
+  }
+
+  // Consumer: move the data of parked transfers into the ring buffer and resubmit them
+  void resume() {
+    if (nParked == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t done = 0;
+    for (; done < parked.size(); done++) {
+      if (ring.space() < payload(parked[done])) break;
+      copy(parked[done]);
+      submit(parked[done]);
+    }
+    parked.erase(parked.begin(), parked.begin() + done);
+    nParked = parked.size();
+  }
+
+  // Consumer: drop all data received
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < parked.size(); i++) submit(parked[i]);
+    parked.clear();
+    nParked = 0;
+    ring.clear();
+  }
+
+  static void LIBUSB_CALL done(libusb_transfer *transfer) {
+    CUsbReadQueue *queue = static_cast<CUsbReadQueue*>(transfer->user_data);
+    queue->active--;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+      if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+	int none = 0;
+	queue->error.compare_exchange_strong(none, LIBUSB_ERROR_IO);
+      }
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    // keep the order of the data, behind transfers already waiting for space:
+    if (queue->parked.empty() && queue->ring.space() >= queue->payload(transfer)) {
+      queue->copy(transfer);
+      queue->submit(transfer);
+    }
+    else {
+      queue->parked.push_back(transfer);
+      queue->nParked = queue->parked.size();
+    }
+  }
+
+  void handleEvents() {
+    while (!stop || active > 0) {
+      struct timeval tv = {0, 100000};
+      libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+    }
+  }
+};
+
+
+// Serial numbers of all attached testboards, with their devices if requested:
+static int FindAllUSB(libusb_context *ctx, vector<string> &serials, vector<libusb_device*> *devices = NULL) {
+  libusb_device **list;
+  ssize_t ndevices = libusb_get_device_list(ctx, &list);
+  if (ndevices < 0) return ndevices;
+
+  serials.clear();
+  for (ssize_t dev = 0; dev < ndevices; dev++) {
+    struct libusb_device_descriptor descriptor;
+    if (libusb_get_device_descriptor(list[dev], &descriptor) != 0) continue;
+    if (descriptor.idVendor != vendorID) continue;
+    if (descriptor.idProduct != productID_FT232H && descriptor.idProduct != productID_OLD) continue;
+
+    libusb_device_handle *handle;
+    if (libusb_open(list[dev], &handle) != 0) continue;
+    unsigned char serial[128];
+    int length = libusb_get_string_descriptor_ascii(handle, descriptor.iSerialNumber, serial, sizeof(serial));
+    libusb_close(handle);
+    if (length < 0) continue;
+
+    serials.push_back(string(reinterpret_cast<char*>(serial), length));
+    if (devices) devices->push_back(libusb_ref_device(list[dev]));
+  }
+  libusb_free_device_list(list, 1);
+  return serials.size();
+}
+
+
+CUSB::CUSB(){
+      m_posR = m_sizeR = m_posW = 0;
+      m_timeout = 150000; // maximum time to wait for read call in ms
+      isUSB_open = false;
+      ftdiStatus = 0;
+      enumPos = enumCount = 0;
+      usbHandle = NULL;
+      readQueue = NULL;
+      m_readTransfers = USB_READ_TRANSFERS;
+      m_readTransferSize = USB_READ_TRANSFER_SIZE;
+      ftdiStatus = libusb_init(&usbContext);
+      if ( ftdiStatus < 0)
+	{
+	  LOG(logCRITICAL) <<  "USBInterface constructor: libusb_init failed";
+	  throw UsbConnectionError("USBInterface constructor: libusb_init failed");
+	}
+}
+
+CUSB::~CUSB(){
+  if (isUSB_open) Close();
+  libusb_exit(usbContext);
+}
+
+const char* CUSB::GetErrorMsg(int error)
+{
+  return libusb_error_name(error);
+}
+
+
+bool CUSB::EnumFirst(uint32_t &nDevices)
+{
+  vector<string> serials;
+  ftdiStatus = FindAllUSB(usbContext, serials);
+  if( ftdiStatus <= 0) {
+    nDevices = enumCount = enumPos = 0;
+    return false;
+  }
+  enumCount = ftdiStatus;
+  nDevices = ftdiStatus;
+  enumPos = 0;
+  return true;
+}
+
+
+bool CUSB::EnumNext(char name[])
+{
+  if( isUSB_open) {
+    LOG(logWARNING) << " Warning: Trying to call USBInterface::EnumNext() while other USB device is still open";
+    return false;
+  }
+  if( !Enum(name, enumPos)) return false;
+  enumPos++;
+  return true;
+}
+
+
+bool CUSB::Enum(char name[], uint32_t pos)
+{
+  if( isUSB_open) {
+    LOG(logWARNING) << " Warning: Trying to call USBInterface::Enum() while other USB device still open";
+    return false;
+  }
+
+  vector<string> serials;
+  ftdiStatus = FindAllUSB(usbContext, serials);
+  if( ftdiStatus <= 0) {
+    enumCount = enumPos = 0;
+    return false;
+  }
+  enumCount = ftdiStatus;
+  if( pos >= enumCount) return false;
+
+  strcpy(name, serials[pos].c_str()); // return device string information for a single device
+  enumPos = pos;
+  return true;
+}
+
+
+bool CUSB::Open(char serialNumber[])
+{
+  if( isUSB_open) {
+    LOG(logWARNING) << " Warning: Trying to open new USB device while other device still open";
+    return false;
+  }
+
+  LOG(logINTERFACE) << " USBInterface::Open(): searching for device with serial number: '" << serialNumber << "'";
+
+  // reset buffer index positions
+  m_posR = m_sizeR = m_posW = 0;
+
+  vector<string> serials;
+  vector<libusb_device*> devices;
+  ftdiStatus = FindAllUSB(usbContext, serials, &devices);
+  if( ftdiStatus < 0) {
+    LOG(logCRITICAL) << " USBInterface::Open(): Error searching attached USB devices! libusb status: " << GetErrorMsg(ftdiStatus);
+    throw UsbConnectionError(" USBInterface::Open(): Error searching attached USB devices!");
+  }
+
+  libusb_device *device = NULL;
+  for (size_t i = 0; i < serials.size(); i++) {
+    if (device == NULL && (serials[i] == serialNumber || strcmp(serialNumber,"*") == 0)) {
+      LOG(logINTERFACE) << " USBInterface::Open(): found device with serial " << serials[i];
+      device = devices[i];
+      ftdiStatus = libusb_open(device, &usbHandle);
+    }
+    else {
+      LOG(logINTERFACE) << " USBInterface::Open(): found non-matching device with serial number: '" << serials[i] << "'";
+    }
+  }
+
+  uint32_t packetSize = device ? libusb_get_max_packet_size(device, FTDI_EP_IN) : 0;
+  for (size_t i = 0; i < devices.size(); i++) libusb_unref_device(devices[i]);
+
+  if (device == NULL) {
+    LOG(logWARNING) << "DTB with serial '" << serialNumber <<  "' not found! :-( ";
+    return false;
+  }
+  if (ftdiStatus != 0) {
+    LOG(logCRITICAL) << "libusb returned status code " << GetErrorMsg(ftdiStatus) << ", could not get USB device handle ";
+    throw UsbConnectionError("Could not get USB device handle, libusb returned error.");
+  }
+
+  // maybe the ftdi_sio and usbserial kernel modules are attached to the device:
+  if (libusb_kernel_driver_active(usbHandle, 0) == 1) {
+    if (libusb_detach_kernel_driver(usbHandle, 0) == 0) { LOG(logINTERFACE) << " Detached kernel driver from selected testboard. "; }
+    else { LOG(logINTERFACE) << "Unable to detach kernel driver from selected testboard."; }
+  }
+  ftdiStatus = libusb_claim_interface(usbHandle, 0);
+  if (ftdiStatus != 0) {
+    LOG(logCRITICAL) << "libusb returned status code " << GetErrorMsg(ftdiStatus) << ", could not claim the USB interface ";
+    libusb_close(usbHandle);
+    throw UsbConnectionError("Could not claim USB interface, libusb returned error.");
+  }
+
+  // reset the chip and set synchronous FIFO mode (see: http://www.ftdichip.com/Support/Documents/DataSheets/ICs/DS_FT232H.pdf page 34ff)
+  if (libusb_control_transfer(usbHandle, FTDI_REQTYPE_OUT, FTDI_SIO_RESET, FTDI_SIO_RESET_SIO, FTDI_INDEX, NULL, 0, FTDI_CONTROL_TIMEOUT) < 0
+      || libusb_control_transfer(usbHandle, FTDI_REQTYPE_OUT, FTDI_SIO_SET_BITMODE, (FTDI_BITMODE_SYNCFF << 8) | 0xFF, FTDI_INDEX, NULL, 0, FTDI_CONTROL_TIMEOUT) < 0) {
+    libusb_release_interface(usbHandle, 0);
+    libusb_close(usbHandle);
+    throw UsbConnectionError("Error setting FTDI synchronous FIFO mode.");
+  }
+
+  // the latency timer sends out short packets, i.e. small RPC replies, after this many ms (chip default: 16ms):
+  if (libusb_control_transfer(usbHandle, FTDI_REQTYPE_OUT, FTDI_SIO_SET_LATENCY_TIMER, USB_LATENCY_TIMER, FTDI_INDEX, NULL, 0, FTDI_CONTROL_TIMEOUT) < 0) {
+    libusb_release_interface(usbHandle, 0);
+    libusb_close(usbHandle);
+    throw UsbConnectionError("Error setting FTDI latency timer.");
+  }
+  isUSB_open = true;
+  Clear();
+
+  // start reading: the transfers are whole packets, each starting with the status bytes.
+  // They replace the read chunks of libftdi, writes are flushed in chunks of USBWRITEBUFFERSIZE.
+  if (packetSize <= FTDI_STATUS_BYTES) packetSize = 512;
+  uint32_t transferSize = (m_readTransferSize + packetSize - 1)/packetSize*packetSize;
+  size_t ringSize = std::max(static_cast<size_t>(BUFSIZE), static_cast<size_t>(2*m_readTransfers*transferSize));
+  readQueue = new CUsbReadQueue(usbContext, ringSize, packetSize);
+
+  LOG(logINTERFACE) << " Keeping " << m_readTransfers << " reads of " << transferSize << " bytes in flight";
+  std::lock_guard<std::mutex> lock(readQueue->mutex);
+  for (uint32_t i = 0; i < m_readTransfers; i++) {
+    libusb_transfer *transfer = libusb_alloc_transfer(0);
+    unsigned char *buffer = new unsigned char[transferSize];
+    libusb_fill_bulk_transfer(transfer, usbHandle, FTDI_EP_IN, buffer, transferSize, CUsbReadQueue::done, readQueue, 0);
+    readQueue->transfers.push_back(transfer);
+    readQueue->submit(transfer);
+  }
+  readQueue->events = std::thread(&CUsbReadQueue::handleEvents, readQueue);
+
+  LOG(logINTERFACE) << " libusb successfully opened connection to device ";
+  return true;
+}
+
+
+void CUSB::Close(){
+  if( !isUSB_open) return;
+
+  // stop resubmitting, cancel the reads in flight and wait for them to finish:
+  {
+    std::lock_guard<std::mutex> lock(readQueue->mutex);
+    readQueue->stop = true;
+  }
+  for (size_t i = 0; i < readQueue->transfers.size(); i++) libusb_cancel_transfer(readQueue->transfers[i]);
+  readQueue->events.join();
+
+  for (size_t i = 0; i < readQueue->transfers.size(); i++) {
+    delete[] readQueue->transfers[i]->buffer;
+    libusb_free_transfer(readQueue->transfers[i]);
+  }
+  delete readQueue;
+  readQueue = NULL;
+
+  libusb_release_interface(usbHandle, 0);
+  libusb_close(usbHandle);
+  usbHandle = NULL;
+  isUSB_open = false;
+}
+
+void CUSB::WriteCommand(unsigned char x){
+  const unsigned char CommandChar = ESC_EXTENDED;
+  Write(sizeof(char), &CommandChar); // ESC_EXTENDED
+  Write(sizeof(char),&x);
+}
+
+void CUSB::Write(uint32_t bytesToWrite, const void *buffer)
+{
+  if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
+  // copy in blocks of what fits into the write buffer, flushing it when full:
+  const unsigned char *data = reinterpret_cast<const unsigned char*>(buffer);
+  while (bytesToWrite > 0) {
+    if( m_posW >= USBWRITEBUFFERSIZE) {Flush();}
+    uint32_t n = USBWRITEBUFFERSIZE - m_posW;
+    if (n > bytesToWrite) n = bytesToWrite;
+    memcpy(m_bufferW + m_posW, data, n);
+    m_posW += n;
+    data += n;
+    bytesToWrite -= n;
+  }
+}
+
+
+void CUSB::Flush()
+{
+  int32_t bytesToWrite = m_posW;
+  m_posW = 0;
+
+  if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
+
+  int32_t bytesWritten = 0;
+  while (bytesWritten < bytesToWrite) {
+    int transferred = 0;
+    ftdiStatus = libusb_bulk_transfer(usbHandle, FTDI_EP_OUT, m_bufferW + bytesWritten, bytesToWrite - bytesWritten, &transferred, m_timeout);
+    bytesWritten += transferred;
+    if (ftdiStatus != 0) {
+      LOG(logCRITICAL) << " USB write failed after " << bytesWritten << "b of " << bytesToWrite << "b: " << GetErrorMsg(ftdiStatus);
+      throw UsbConnectionError("USB write failed");
+    }
+  }
+}
+
+bool CUSB::FillBuffer(uint32_t /*minBytesToRead*/)
+{
+  LOG(logWARNING) << " USBInterface: FillBuffer() called but this function is not implemented for libusb ";
+  return true;
+}
+
+
+void CUSB::Read(uint32_t bytesToRead, void *buffer, uint32_t &bytesRead)
+{
+  if (!isUSB_open) throw UsbConnectionError("Attempt to read from USB without open connection.");
+
+  // Copy over data from the ring buffer in bulk, waiting for the event thread if it runs empty:
+  unsigned char *data = reinterpret_cast<unsigned char*>(buffer);
+  bytesRead = readQueue->ring.read(data, bytesToRead);
+  readQueue->resume();
+  if (bytesRead == bytesToRead) return;
+
+  timer t;
+  bool warned = false;
+  while (bytesRead < bytesToRead) {
+    if (readQueue->error != 0 && readQueue->ring.empty()) {
+      ftdiStatus = readQueue->error;
+      LOG(logCRITICAL) << "ERROR during USB read: " << GetErrorMsg(ftdiStatus);
+      throw UsbConnectionError("ERROR during USB read");
+    }
+    uint32_t timewasted = t.get(); // time in ms wasted in this routine
+    if (timewasted >= m_timeout) {
+      // buffer was not ready and reading it timed out so we stop attempting it now
+      LOG(logCRITICAL) << " Timeout reading from USB buffer after " << m_timeout << " ms ";
+      LOG(logCRITICAL) << "Requested to read " << bytesToRead
+		       << "b, actually read  " << bytesRead
+		       << "b - " << (bytesToRead-bytesRead) << "b missing!";
+      throw UsbConnectionTimeout("Timeout reading from USB");
+    }
+    if (!warned && timewasted >= m_timeout/10) {
+      LOG(logWARNING) << "USBInterface: Read(): data not ready (got " << bytesRead << "b of "<< bytesToRead <<"b) after " << timewasted << "ms yet! Will wait for up to " << m_timeout << "ms";
+      warned = true;
+    }
+    // sleep until the event thread delivers, the warning is due or the timeout expires:
+    readQueue->ring.waitData((warned ? m_timeout : m_timeout/10) - timewasted);
+    bytesRead += readQueue->ring.read(data + bytesRead, bytesToRead - bytesRead);
+    readQueue->resume();
+  }
+}
+
+//----------------------------------------------------------------------
+void CUSB::Clear()
+{
+  if( !isUSB_open) return;
+
+  ftdiStatus = libusb_control_transfer(usbHandle, FTDI_REQTYPE_OUT, FTDI_SIO_RESET, FTDI_SIO_PURGE_RX, FTDI_INDEX, NULL, 0, FTDI_CONTROL_TIMEOUT);
+  if (ftdiStatus >= 0) ftdiStatus = libusb_control_transfer(usbHandle, FTDI_REQTYPE_OUT, FTDI_SIO_RESET, FTDI_SIO_PURGE_TX, FTDI_INDEX, NULL, 0, FTDI_CONTROL_TIMEOUT);
+
+  // drain our buffer.
+  if (readQueue) readQueue->clear();
+
+  m_posR = m_sizeR = 0;
+  m_posW = 0;
+}
+
+//----------------------------------------------------------------------
+bool CUSB::Show()
+{
+  LOG(logINFO) << " USB status: ";
+  if( !isUSB_open) {
+    LOG(logINFO) << "  - USB connection not open ";
+    return false;
+  }
+  LOG(logINFO) << "  - max timeout for read calls set to " << m_timeout << "ms";
+  unsigned char latency;
+  if (libusb_control_transfer(usbHandle, FTDI_REQTYPE_IN, FTDI_SIO_GET_LATENCY_TIMER, 0, FTDI_INDEX, &latency, 1, FTDI_CONTROL_TIMEOUT) == 1) {
+    LOG(logINFO) << "  - FTDI latency timer set to " << static_cast<int>(latency);
+  }
+  LOG(logINFO) << "  - reads in flight: " << readQueue->active << " of " << readQueue->transfers.size()
+	       << ", waiting for buffer space: " << readQueue->nParked;
+  LOG(logINFO) << "  - data waiting in local read buffer: " << readQueue->ring.available() << "b";
+
+  return true;
+}
+
+void CUSB::SetTimeout(unsigned int timeout)
+{
+  m_timeout = timeout;
+}
+
+void CUSB::SetReadTransfers(uint32_t count, uint32_t size)
+{
+  m_readTransfers = (count > 0) ? count : 1;
+  m_readTransferSize = size;
+}
+
+//----------------------------------------------------------------------
+void CUSB::Read_String(char *s, uint16_t maxlength)
+{
+  char ch = 0;
+  uint16_t i=0;
+  do {
+    Read_CHAR(ch);
+    if( i<maxlength) { s[i] = ch; i++; }
+  }
+  while (ch != 0);
+  if( i >= maxlength) s[maxlength-1] = 0;
+}
+
+
+void CUSB::Write_String(const char *s)
+{
+  do {
+    Write_CHAR(*s);
+    s++;
+  }
+  while (*s != 0);
+}
@@ -0,0 +1,136 @@
+#ifndef PXAR_RINGBUFFER_H
+#define PXAR_RINGBUFFER_H
+
+#include <stdint.h>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+namespace pxar {
+
+  /** Byte ring buffer between one producer and one consumer thread.
+   *  Data is copied in and out in bulk, the positions are only shared
+   *  through atomics. Waiting for data or space blocks on a condition
+   *  variable, which is only signalled when the other side is waiting.
+   */
+  class ringBuffer {
+  public:
+    /** Ring of "size" bytes, rounded up to the next power of two
+     */
+    ringBuffer(size_t size) : m_head(0), m_tail(0), m_waiting(0) {
+      m_size = 1;
+      while(m_size < size) m_size <<= 1;
+      m_data = new unsigned char[m_size];
+    }
+    ~ringBuffer() { delete[] m_data; }
+
+    size_t size() const { return m_size; }
+
+    /** Bytes ready to be read, valid on the consumer side
+     */
+    size_t available() const { return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed); }
+
+    /** Free space, valid on the producer side
+     */
+    size_t space() const { return m_size - (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire)); }
+
+    bool empty() const { return available() == 0; }
+
+    /** Producer: append up to "n" bytes, returns the number of bytes written
+     */
+    size_t write(const void * buffer, size_t n) {
+      size_t head = m_head.load(std::memory_order_relaxed);
+      size_t free = m_size - (head - m_tail.load(std::memory_order_acquire));
+      if(n > free) n = free;
+      if(n == 0) return 0;
+      copyIn(head, static_cast<const unsigned char*>(buffer), n);
+      m_head.store(head + n, std::memory_order_seq_cst);
+      wake();
+      return n;
+    }
+
+    /** Consumer: take up to "n" bytes, returns the number of bytes read
+     */
+    size_t read(void * buffer, size_t n) {
+      size_t tail = m_tail.load(std::memory_order_relaxed);
+      size_t ready = m_head.load(std::memory_order_acquire) - tail;
+      if(n > ready) n = ready;
+      if(n == 0) return 0;
+      copyOut(tail, static_cast<unsigned char*>(buffer), n);
+      m_tail.store(tail + n, std::memory_order_seq_cst);
+      wake();
+      return n;
+    }
+
+    /** Consumer: drop all data currently in the ring
+     */
+    void clear() {
+      m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_seq_cst);
+      wake();
+    }
+
+    /** Consumer: wait up to "ms" milliseconds for data,
+     *  returns false if the ring is still empty
+     */
+    bool waitData(uint32_t ms) { return wait(ms, true); }
+
+    /** Producer: wait up to "ms" milliseconds for free space,
+     *  returns false if the ring is still full
+     */
+    bool waitSpace(uint32_t ms) { return wait(ms, false); }
+
+  private:
+    unsigned char * m_data;
+    size_t m_size;
+
+    // Positions are running byte counters, the index into the ring is taken modulo its size:
+    std::atomic<size_t> m_head, m_tail;
+
+    // Number of threads blocked in wait():
+    std::atomic<int> m_waiting;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+    void copyIn(size_t pos, const unsigned char * src, size_t n) {
+      size_t offset = pos & (m_size - 1);
+      size_t first = (n < m_size - offset) ? n : m_size - offset;
+      memcpy(m_data + offset, src, first);
+      if(n > first) memcpy(m_data, src + first, n - first);
+    }
+
+    void copyOut(size_t pos, unsigned char * dst, size_t n) const {
+      size_t offset = pos & (m_size - 1);
+      size_t first = (n < m_size - offset) ? n : m_size - offset;
+      memcpy(dst, m_data + offset, first);
+      if(n > first) memcpy(dst + first, m_data, n - first);
+    }
+
+    // Only take the lock when the other side announced it is waiting. Both the
+    // position update and the announcement are sequentially consistent, so
+    // either the waiting side sees the new position or it is notified:
+    void wake() {
+      if(m_waiting.load(std::memory_order_seq_cst) == 0) return;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_cond.notify_all();
+    }
+
+    bool ready(bool data) const {
+      size_t used = m_head.load(std::memory_order_seq_cst) - m_tail.load(std::memory_order_seq_cst);
+      return data ? (used > 0) : (used < m_size);
+    }
+
+    bool wait(uint32_t ms, bool data) {
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_waiting.fetch_add(1, std::memory_order_seq_cst);
+      while(!ready(data) && m_cond.wait_until(lock, deadline) != std::cv_status::timeout) {}
+      m_waiting.fetch_sub(1, std::memory_order_seq_cst);
+      return ready(data);
+    }
+  };
+
+} // namespace pxar
+
+#endif
@@ -72,6 +72,7 @@ PixTest::PixTest(PixSetup *a, string name): fNDaqErrors(99999), fProblem(false),
 // ----------------------------------------------------------------------
 PixTest::PixTest() {
   //  LOG(logINFO) << "PixTest ctor()";
+  fApi = 0;
   fTree = 0;
 
 }
@@ -690,6 +691,9 @@ void PixTest::writeOutput() {
 PixTest::~PixTest() {
   //  LOG(logDEBUG) << "PixTestBase dtor(), writing out histograms";
   writeOutput();
+  // -- RPC calls made during the test, fetching them resets the counters for the next one.
+  //    The most expensive calls are listed, all of them when debugging:
+  if (fApi) fApi->getRpcStatistics().dump(Log::ReportingLevel() >= logDEBUG ? 0 : 5);
 }
 
 // ----------------------------------------------------------------------
@@ -0,0 +1,76 @@
+#include "rpc_calls.h"
+#include "log.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace pxar;
+
+// Sustained readout of one emulated DAQ channel: the channel is filled with
+// "nTriggers" events per round and read out block by block until it is empty.
+// Only the time spent in the read calls is counted.
+int main(int argc, char* argv[]) {
+
+  size_t nRounds = 200;
+  uint32_t nTriggers = 4000;
+  uint8_t nrocs = 8;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { nRounds = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-t")) { nTriggers = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-r")) { nrocs = atoi(argv[++i]); }
+  }
+  Log::ReportingLevel() = logCRITICAL;
+
+  CTestboard tb;
+  tb.Init();
+  tb.tbm_Enable(true);
+  tb.mod_Addr(31);
+  for(uint8_t roc = 0; roc < nrocs; roc++) { tb.roc_I2cAddr(roc); }
+  tb.Daq_Open(DTB_SOURCE_BUFFER_SIZE, 0);
+  tb.Daq_Start(0);
+
+  std::cout << "Reading " << nRounds << " rounds of " << nTriggers << " events with " << static_cast<int>(nrocs)
+	    << " ROCs in blocks of " << DTB_SOURCE_BLOCK_SIZE << " bytes:" << std::endl;
+  std::cout << std::setw(24) << "read" << std::setw(14) << "blocks" << std::setw(14) << "Mwords"
+	    << std::setw(14) << "time [ms]" << std::setw(14) << "Mwords/s" << std::endl;
+
+  const char * modes[3] = {"Daq_Read, new vector", "Daq_Read, reused", "Daq_ReadInto"};
+  for(size_t m = 0; m < 3; m++) {
+    std::vector<uint16_t> buffer;
+    size_t blocks = 0, words = 0;
+    std::chrono::steady_clock::duration time(0);
+
+    for(size_t round = 0; round < nRounds; round++) {
+      tb.Pg_Triggers(nTriggers, 0);
+      while(1) {
+	uint32_t available = 0, size = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(m == 0) {
+	  std::vector<uint16_t> data;
+	  tb.Daq_Read(data, DTB_SOURCE_BLOCK_SIZE, available, 0);
+	  size = data.size();
+	}
+	else if(m == 1) {
+	  tb.Daq_Read(buffer, DTB_SOURCE_BLOCK_SIZE, available, 0);
+	  size = buffer.size();
+	}
+	else { tb.Daq_ReadInto(buffer, size, DTB_SOURCE_BLOCK_SIZE, available, 0); }
+	time += std::chrono::steady_clock::now() - start;
+	if(size == 0) break;
+	blocks++;
+	words += size;
+      }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(time).count();
+    std::cout << std::setw(24) << modes[m] << std::setw(14) << blocks << std::setw(14) << std::fixed << std::setprecision(3) << words/1e6
+	      << std::setw(14) << ms << std::setw(14) << words/1e3/ms << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include "datatypes.h"
+#include "hitdecoder.h"
+#include "generator.h"
+#include "log.h"
+#include "timer.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+
+using namespace pxar;
+
+// Collect the runs of hit word pairs from emulator-generated TBM08b events,
+// as the DESER400 decoding loop sees them:
+void getEmulatorRuns(size_t nevents, uint8_t nrocs, std::vector<uint16_t> & words, std::vector<size_t> & runs) {
+
+  for(size_t ev = 0; ev < nevents; ev++) {
+    std::vector<uint16_t> data;
+    fillRawData(ev, data, TBM_08B, nrocs, false, false, rand()%ROC_NUMCOLS, rand()%ROC_NUMROWS, std::vector<uint16_t>(), FLAG_FORCE_UNMASKED);
+
+    for(size_t i = 0; i < data.size(); i++) {
+      if((data[i] & 0xe000) != 0x4000) continue;
+      size_t first = i + 1, last = i + 1;
+      while(data.size() - last >= 2 && (data[last] & 0xe000) <= 0x2000) { last += 2; }
+      if(last == first) continue;
+      runs.push_back((last - first)/2);
+      words.insert(words.end(), data.begin() + first, data.begin() + last);
+      i = last - 1;
+    }
+  }
+}
+
+// Reference: decode one hit at a time through pxar::pixel::decode():
+void decodeReference(const uint16_t * words, size_t npairs, bool invert, bool linear,
+		     uint8_t * column, uint8_t * row, int16_t * value, uint8_t * status) {
+  for(size_t i = 0; i < npairs; i++) {
+    uint32_t raw = ((words[2*i] & 0x0fff) << 12) + (words[2*i+1] & 0x0fff);
+    pixel pix;
+    status[i] = static_cast<uint8_t>(pix.decode(raw, 0, invert, linear));
+    column[i] = pix.column();
+    row[i] = pix.row();
+    value[i] = pix.value();
+  }
+}
+
+typedef void (*decodeFunction)(const uint16_t*, size_t, bool, bool, uint8_t*, uint8_t*, int16_t*, uint8_t*);
+
+struct hitBuffer {
+  std::vector<uint8_t> column, row, status;
+  std::vector<int16_t> value;
+  hitBuffer(size_t n) : column(n), row(n), status(n), value(n) {}
+};
+
+// Run the decoder over all runs, return the time in milliseconds:
+double runDecoder(decodeFunction f, const std::vector<uint16_t> & words, const std::vector<size_t> & runs,
+		  bool invert, bool linear, hitBuffer & out, size_t repeat) {
+  timer t;
+  for(size_t r = 0; r < repeat; r++) {
+    size_t offset = 0;
+    for(std::vector<size_t>::const_iterator run = runs.begin(); run != runs.end(); ++run) {
+      f(&words[2*offset], *run, invert, linear, &out.column[offset], &out.row[offset], &out.value[offset], &out.status[offset]);
+      offset += *run;
+    }
+  }
+  return static_cast<double>(t.get());
+}
+
+// Compare against the reference, addresses and pulse heights only for valid hits:
+size_t compare(const hitBuffer & ref, const hitBuffer & test, size_t n) {
+  size_t mismatches = 0;
+  for(size_t i = 0; i < n; i++) {
+    if(ref.status[i] != test.status[i]) { mismatches++; continue; }
+    if(ref.status[i] == PIXEL_INVALID_PULSEHEIGHT) continue;
+    if(ref.value[i] != test.value[i]) { mismatches++; continue; }
+    if(ref.status[i] == PIXEL_VALID && (ref.column[i] != test.column[i] || ref.row[i] != test.row[i])) { mismatches++; }
+  }
+  return mismatches;
+}
+
+// Check all 2^24 raw hit words in all address modes:
+bool checkExhaustive() {
+  const size_t nhits = 1 << 24;
+  std::vector<uint16_t> words(2*nhits);
+  for(size_t raw = 0; raw < nhits; raw++) {
+    words[2*raw] = static_cast<uint16_t>(raw >> 12);
+    words[2*raw+1] = static_cast<uint16_t>(0x2000 | (raw & 0x0fff));
+  }
+
+  hitBuffer ref(nhits), lut(nhits), simd(nhits);
+  bool modes[3][2] = {{false, false}, {true, false}, {false, true}};
+  bool ok = true;
+  for(size_t m = 0; m < 3; m++) {
+    decodeReference(&words[0], nhits, modes[m][0], modes[m][1], &ref.column[0], &ref.row[0], &ref.value[0], &ref.status[0]);
+    hitDecoder::decodePairsScalar(&words[0], nhits, modes[m][0], modes[m][1], &lut.column[0], &lut.row[0], &lut.value[0], &lut.status[0]);
+    hitDecoder::decodePairs(&words[0], nhits, modes[m][0], modes[m][1], &simd.column[0], &simd.row[0], &simd.value[0], &simd.status[0]);
+    size_t e1 = compare(ref, lut, nhits), e2 = compare(ref, simd, nhits);
+    std::cout << "Exhaustive check (invert " << modes[m][0] << ", linear " << modes[m][1] << "): "
+	      << e1 << " LUT and " << e2 << " vectorized mismatches" << std::endl;
+    if(e1 || e2) ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t nevents = 200000;
+  size_t repeat = 10;
+  bool exhaustive = true;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { nevents = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-r")) { repeat = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-q")) { exhaustive = false; }
+    if (!strcmp(argv[i],"-v")) { Log::ReportingLevel() = Log::FromString(argv[++i]); }
+  }
+
+  if(exhaustive && !checkExhaustive()) { return 1; }
+
+  srand(42);
+  std::vector<uint16_t> words;
+  std::vector<size_t> runs;
+  getEmulatorRuns(nevents, 8, words, runs);
+  size_t nhits = words.size()/2;
+
+  // The same hits as one long run, as seen with high occupancy:
+  std::vector<size_t> bulk(1, nhits);
+
+  std::cout << "Decoding " << nhits << " emulator hits in " << runs.size() << " runs, "
+	    << repeat << " times, vector extension: " << hitDecoder::vectorExtension() << std::endl;
+  std::cout << std::setw(12) << "runs" << std::setw(16) << "ref [Mhit/s]"
+	    << std::setw(16) << "LUT [Mhit/s]" << std::setw(16) << "SIMD [Mhit/s]" << std::endl;
+
+  const std::vector<size_t> * layouts[2] = {&runs, &bulk};
+  const char * names[2] = {"per ROC", "bulk"};
+  for(size_t l = 0; l < 2; l++) {
+    hitBuffer ref(nhits), lut(nhits), simd(nhits);
+    double ms[3];
+    ms[0] = runDecoder(decodeReference, words, *layouts[l], true, false, ref, repeat);
+    ms[1] = runDecoder(hitDecoder::decodePairsScalar, words, *layouts[l], true, false, lut, repeat);
+    ms[2] = runDecoder(hitDecoder::decodePairs, words, *layouts[l], true, false, simd, repeat);
+
+    if(compare(ref, lut, nhits) || compare(ref, simd, nhits)) {
+      std::cout << "Decoding mismatch on emulator data!" << std::endl;
+      return 1;
+    }
+
+    std::cout << std::setw(12) << names[l];
+    for(size_t k = 0; k < 3; k++) {
+      std::cout << std::setw(16) << std::setprecision(3) << (ms[k] > 0 ? nhits*repeat/ms[k]/1000 : 0);
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "api.h"
+#include "log.h"
+#include "timer.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace pxar;
+
+int main(int argc, char* argv[]) {
+
+  std::string verbosity = "CRITICAL";
+  uint8_t nrocs = 16;
+  size_t nRuns = 10;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-r")) { nrocs = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-n")) { nRuns = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-v")) { verbosity = argv[++i]; }
+  }
+
+  std::vector<std::pair<std::string,uint8_t> > sig_delays, pg_setup;
+  std::vector<std::pair<std::string,double> > power_settings;
+  sig_delays.push_back(std::make_pair("clk",2));
+  sig_delays.push_back(std::make_pair("ctr",2));
+  sig_delays.push_back(std::make_pair("sda",17));
+  sig_delays.push_back(std::make_pair("tin",7));
+  sig_delays.push_back(std::make_pair("deser160phase",4));
+  power_settings.push_back(std::make_pair("va",1.9));
+  power_settings.push_back(std::make_pair("vd",2.6));
+  power_settings.push_back(std::make_pair("ia",1.19));
+  power_settings.push_back(std::make_pair("id",1.10));
+  pg_setup.push_back(std::make_pair("resetroc",25));
+  pg_setup.push_back(std::make_pair("calibrate",106));
+  pg_setup.push_back(std::make_pair("trigger",16));
+  pg_setup.push_back(std::make_pair("token",0));
+
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > tbmDACs(2), rocDACs;
+  tbmDACs[0].push_back(std::make_pair("clear",0xf0));
+  tbmDACs[0].push_back(std::make_pair("counters",0x01));
+  tbmDACs[0].push_back(std::make_pair("mode",0xc0));
+  tbmDACs[0].push_back(std::make_pair("basee",0x20));
+  tbmDACs[1] = tbmDACs[0];
+
+  const char * names[] = {"Vdig", "Vana", "Vsf", "Vcomp", "VwllPr", "VwllSh", "VhldDel", "Vtrim", "VthrComp",
+			  "VIBias_Bus", "Vbias_sf", "VoffsetOp", "VOffsetRO", "VIon", "Vcomp_ADC", "VIref_ADC",
+			  "VIbias_roc", "VIColOr", "Vcal", "CalDel", "CtrlReg", "WBC", "rbreg"};
+  uint8_t values[] = {8, 78, 80, 12, 150, 150, 117, 152, 89, 30, 6, 60, 225, 45, 10, 70, 150, 99, 199, 140, 0, 200, 12};
+  std::vector<std::pair<std::string,uint8_t> > dacs;
+  for(size_t d = 0; d < sizeof(values); d++) { dacs.push_back(std::make_pair(names[d], values[d])); }
+
+  std::vector<std::vector<pixelConfig> > rocPixels;
+  std::vector<pixelConfig> pixels;
+  for(uint8_t col = 0; col < ROC_NUMCOLS; col++) {
+    for(uint8_t row = 0; row < ROC_NUMROWS; row++) { pixels.push_back(pixelConfig(col,row,15)); }
+  }
+  for(uint8_t roc = 0; roc < nrocs; roc++) { rocDACs.push_back(dacs); rocPixels.push_back(pixels); }
+
+  std::cout << "Initializing a module of " << static_cast<int>(nrocs) << " ROCs, " << nRuns << " runs:" << std::endl;
+  std::cout << std::setw(20) << "step" << std::setw(14) << "time [ms]" << std::endl;
+
+  uint64_t tCtor = 0, tTestboard = 0, tDut = 0, tProgram = 0;
+  for(size_t run = 0; run < nRuns; run++) {
+    timer t;
+    pxarCore * api = new pxarCore("*", verbosity);
+    tCtor += t.get();
+
+    timer tb;
+    api->initTestboard(sig_delays, power_settings, pg_setup);
+    tTestboard += tb.get();
+
+    timer dut;
+    if(!api->initDUT(0, "tbm08b", tbmDACs, "psi46digv21respin", rocDACs, rocPixels)) {
+      std::cout << "Could not initialize the emulated module." << std::endl;
+      delete api;
+      return 1;
+    }
+    tDut += dut.get();
+
+    // Programming the configured DUT again:
+    timer prog;
+    api->programDUT();
+    tProgram += prog.get();
+
+    delete api;
+  }
+
+  const char * steps[4] = {"pxarCore()", "initTestboard()", "initDUT()", "programDUT()"};
+  uint64_t times[4] = {tCtor, tTestboard, tDut, tProgram};
+  for(size_t s = 0; s < 4; s++) {
+    std::cout << std::setw(20) << steps[s] << std::setw(14) << std::setprecision(3)
+	      << static_cast<double>(times[s])/nRuns << std::endl;
+  }
+  std::cout << "initDUT() and programDUT() include the 300 ms power-up wait of Pon()." << std::endl;
+  return 0;
+}
@@ -0,0 +1,39 @@
+// Stand-in for the parts of libftdi used by the USB interface, compiled into
+// the transport benchmark in place of the library. The functions are
+// implemented by the benchmark as a loopback DTB.
+
+#ifndef PXAR_LOOPBACK_FTDI_H
+#define PXAR_LOOPBACK_FTDI_H
+
+#include "libusb.h"
+
+#define BITMODE_SYNCFF 0x40
+
+struct ftdi_context {
+  int open;
+};
+
+struct ftdi_device_list {
+  struct ftdi_device_list * next;
+  struct libusb_device * dev;
+};
+
+int ftdi_init(struct ftdi_context * ftdi);
+void ftdi_deinit(struct ftdi_context * ftdi);
+const char * ftdi_get_error_string(struct ftdi_context * ftdi);
+int ftdi_usb_find_all(struct ftdi_context * ftdi, struct ftdi_device_list ** devlist, int vendor, int product);
+void ftdi_list_free(struct ftdi_device_list ** devlist);
+int ftdi_usb_get_strings(struct ftdi_context * ftdi, struct libusb_device * dev, char * manufacturer, int mnf_len,
+			 char * description, int desc_len, char * serial, int serial_len);
+int ftdi_usb_open_dev(struct ftdi_context * ftdi, struct libusb_device * dev);
+int ftdi_usb_close(struct ftdi_context * ftdi);
+int ftdi_usb_purge_buffers(struct ftdi_context * ftdi);
+int ftdi_set_bitmode(struct ftdi_context * ftdi, unsigned char bitmask, unsigned char mode);
+int ftdi_set_baudrate(struct ftdi_context * ftdi, int baudrate);
+int ftdi_read_data_set_chunksize(struct ftdi_context * ftdi, unsigned int chunksize);
+int ftdi_write_data_set_chunksize(struct ftdi_context * ftdi, unsigned int chunksize);
+int ftdi_get_latency_timer(struct ftdi_context * ftdi, unsigned char * latency);
+int ftdi_read_data(struct ftdi_context * ftdi, unsigned char * buf, int size);
+int ftdi_write_data(struct ftdi_context * ftdi, const unsigned char * buf, int size);
+
+#endif
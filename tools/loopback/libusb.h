@@ -0,0 +1,15 @@
+// Stand-in for the parts of libusb used by the libftdi USB interface, see ftdi.h.
+
+#ifndef PXAR_LOOPBACK_LIBUSB_H
+#define PXAR_LOOPBACK_LIBUSB_H
+
+#include <stdint.h>
+
+struct libusb_device;
+struct libusb_device_handle;
+
+int libusb_open(struct libusb_device * dev, struct libusb_device_handle ** handle);
+int libusb_detach_kernel_driver(struct libusb_device_handle * handle, int interface);
+void libusb_close(struct libusb_device_handle * handle);
+
+#endif
@@ -0,0 +1,25 @@
+// Stand-in for the parts of libpcap used by the Ethernet interface, compiled
+// into the transport benchmark in place of the library. The functions are
+// implemented by the benchmark as a loopback DTB.
+
+#ifndef PXAR_LOOPBACK_PCAP_H
+#define PXAR_LOOPBACK_PCAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PCAP_ERRBUF_SIZE 256
+
+typedef struct pcap pcap_t;
+
+struct pcap_pkthdr {
+  uint32_t caplen;
+  uint32_t len;
+};
+
+pcap_t * pcap_open_live(const char * device, int snaplen, int promisc, int timeout, char * errbuf);
+const unsigned char * pcap_next(pcap_t * p, struct pcap_pkthdr * header);
+int pcap_sendpacket(pcap_t * p, const unsigned char * buffer, int size);
+void pcap_close(pcap_t * p);
+
+#endif
@@ -0,0 +1,242 @@
+#include "api.h"
+#include "log.h"
+#include "timer.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace pxar;
+
+// Heap accounting: every allocation carries its size in front of the block so the
+// bytes currently allocated and their peak can be followed, also inside libpxar.
+// The replacements must not be inlined into their callers:
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+static std::atomic<size_t> heap_current(0), heap_peak(0);
+static const size_t heap_header = 16;
+
+NOINLINE void * operator new(size_t size) {
+  char * block = static_cast<char*>(malloc(size + heap_header));
+  if(block == NULL) throw std::bad_alloc();
+  *reinterpret_cast<size_t*>(block) = size;
+  size_t now = (heap_current += size);
+  size_t peak = heap_peak;
+  while(now > peak && !heap_peak.compare_exchange_weak(peak, now)) {}
+  return block + heap_header;
+}
+
+NOINLINE void operator delete(void * ptr) noexcept {
+  if(ptr == NULL) return;
+  char * block = static_cast<char*>(ptr) - heap_header;
+  heap_current -= *reinterpret_cast<size_t*>(block);
+  free(block);
+}
+
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete[](void * ptr) noexcept { operator delete(ptr); }
+void operator delete(void * ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void * ptr, size_t) noexcept { operator delete(ptr); }
+
+// Reset the peak to the current heap usage, return the current usage:
+size_t resetPeak() {
+  size_t now = heap_current;
+  heap_peak = now;
+  return now;
+}
+
+// Results of the HAL calls of one loop expansion, as returned for an efficiency
+// map: "calls" calls returning "events" condensed Events with "hits" pixels each.
+std::vector<std::vector<Event> > getBuffers(size_t calls, size_t events, size_t hits) {
+  std::vector<std::vector<Event> > buffers(calls);
+  for(size_t c = 0; c < calls; c++) {
+    buffers[c].resize(events);
+    for(size_t e = 0; e < events; e++) {
+      for(size_t h = 0; h < hits; h++) {
+	buffers[c][e].pixels.push_back(pixel(static_cast<uint8_t>(h), static_cast<uint8_t>(e%ROC_NUMCOLS), static_cast<uint8_t>(e%ROC_NUMROWS), 10));
+      }
+      buffers[c][e].addHeader(0xa000); buffers[c][e].addTrailer(0xc000);
+    }
+  }
+  return buffers;
+}
+
+// Accumulation as done by expandLoop before: copy into per-ROC and main vectors:
+void accumulateCopy(std::vector<std::vector<Event> > & buffers, std::vector<Event> & data) {
+  std::vector<Event> rocdata;
+  for(size_t c = 0; c < buffers.size(); c++) {
+    std::vector<Event> buffer = buffers[c];
+    buffers[c].clear();
+    if(rocdata.empty()) { rocdata = buffer; }
+    else {
+      rocdata.reserve(rocdata.size() + buffer.size());
+      rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
+    }
+  }
+  if(data.empty()) data = rocdata;
+  else {
+    data.reserve(data.size() + rocdata.size());
+    data.insert(data.end(), rocdata.begin(), rocdata.end());
+  }
+}
+
+// Accumulation as done by pxarCore::appendEvents:
+void accumulateMove(std::vector<std::vector<Event> > & buffers, std::vector<Event> & data) {
+  for(size_t c = 0; c < buffers.size(); c++) {
+    std::vector<Event> buffer;
+    buffer.swap(buffers[c]);
+    if(data.empty()) {
+      data.swap(buffer);
+      data.reserve(data.size()*buffers.size());
+    }
+    else { data.insert(data.end(), std::make_move_iterator(buffer.begin()), std::make_move_iterator(buffer.end())); }
+  }
+}
+
+typedef void (*accumulateFunction)(std::vector<std::vector<Event> > &, std::vector<Event> &);
+
+// Run one accumulation, report time in milliseconds and peak heap growth in MB:
+void runAccumulate(accumulateFunction f, size_t calls, size_t events, size_t hits, double & ms, double & mb) {
+  std::vector<std::vector<Event> > buffers = getBuffers(calls, events, hits);
+  std::vector<Event> data;
+  size_t before = resetPeak();
+  timer t;
+  f(buffers, data);
+  ms = static_cast<double>(t.get());
+  mb = static_cast<double>(heap_peak - before)/(1 << 20);
+}
+
+pxarCore * getModule(std::string verbosity, uint8_t nrocs) {
+
+  std::vector<std::pair<std::string,uint8_t> > sig_delays, pg_setup;
+  std::vector<std::pair<std::string,double> > power_settings;
+  sig_delays.push_back(std::make_pair("clk",2));
+  power_settings.push_back(std::make_pair("va",1.9));
+  power_settings.push_back(std::make_pair("vd",2.6));
+  power_settings.push_back(std::make_pair("ia",1.19));
+  power_settings.push_back(std::make_pair("id",1.10));
+  pg_setup.push_back(std::make_pair("resetroc",25));
+  pg_setup.push_back(std::make_pair("calibrate",106));
+  pg_setup.push_back(std::make_pair("trigger",16));
+  pg_setup.push_back(std::make_pair("token",0));
+
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > tbmDACs(2), rocDACs;
+  tbmDACs[0].push_back(std::make_pair("clear",0xf0));
+  tbmDACs[1].push_back(std::make_pair("clear",0xf0));
+
+  std::vector<std::pair<std::string,uint8_t> > dacs;
+  dacs.push_back(std::make_pair("Vdig",8));
+  dacs.push_back(std::make_pair("Vana",78));
+  dacs.push_back(std::make_pair("Vsf",80));
+  dacs.push_back(std::make_pair("Vcomp",12));
+  dacs.push_back(std::make_pair("VwllPr",150));
+  dacs.push_back(std::make_pair("VwllSh",150));
+  dacs.push_back(std::make_pair("VhldDel",117));
+  dacs.push_back(std::make_pair("Vtrim",152));
+  dacs.push_back(std::make_pair("VthrComp",89));
+  dacs.push_back(std::make_pair("VIBias_Bus",30));
+  dacs.push_back(std::make_pair("Vbias_sf",6));
+  dacs.push_back(std::make_pair("VoffsetOp",60));
+  dacs.push_back(std::make_pair("VOffsetRO",225));
+  dacs.push_back(std::make_pair("VIon",45));
+  dacs.push_back(std::make_pair("Vcomp_ADC",10));
+  dacs.push_back(std::make_pair("VIref_ADC",70));
+  dacs.push_back(std::make_pair("VIbias_roc",150));
+  dacs.push_back(std::make_pair("VIColOr",99));
+  dacs.push_back(std::make_pair("Vcal",199));
+  dacs.push_back(std::make_pair("CalDel",140));
+  dacs.push_back(std::make_pair("CtrlReg",0));
+  dacs.push_back(std::make_pair("WBC",200));
+  dacs.push_back(std::make_pair("rbreg",12));
+
+  std::vector<std::vector<pixelConfig> > rocPixels;
+  std::vector<pixelConfig> pixels;
+  for(uint8_t col = 0; col < ROC_NUMCOLS; col++) {
+    for(uint8_t row = 0; row < ROC_NUMROWS; row++) { pixels.push_back(pixelConfig(col,row,15)); }
+  }
+  for(uint8_t roc = 0; roc < nrocs; roc++) { rocDACs.push_back(dacs); rocPixels.push_back(pixels); }
+
+  pxarCore * api = new pxarCore("*", verbosity);
+  api->initTestboard(sig_delays, power_settings, pg_setup);
+  if(!api->initDUT(0, "tbm08b", tbmDACs, "psi46digv21respin", rocDACs, rocPixels)) {
+    delete api;
+    return NULL;
+  }
+  return api;
+}
+
+int main(int argc, char* argv[]) {
+
+  std::string verbosity = "CRITICAL";
+  uint16_t nTriggers = 10;
+  uint8_t nrocs = 16;
+  bool emulator = true;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { nTriggers = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-r")) { nrocs = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-q")) { emulator = false; }
+    if (!strcmp(argv[i],"-v")) { verbosity = argv[++i]; }
+  }
+  Log::ReportingLevel() = Log::FromString(verbosity);
+
+  // Accumulation of the HAL results alone, shapes of a full module efficiency map:
+  size_t npixels = ROC_NUMCOLS*ROC_NUMROWS;
+  std::cout << "Accumulating HAL results of a " << static_cast<int>(nrocs) << " ROC efficiency map:" << std::endl;
+  std::cout << std::setw(20) << "loop" << std::setw(14) << "copy [ms]" << std::setw(14) << "copy [MB]"
+	    << std::setw(14) << "move [ms]" << std::setw(14) << "move [MB]" << std::endl;
+
+  const char * names[2] = {"pixel parallel", "ROC serial"};
+  size_t shapes[2][3] = {{npixels, 1, nrocs}, {nrocs, npixels, 1}};
+  for(size_t s = 0; s < 2; s++) {
+    double ms[2], mb[2];
+    runAccumulate(accumulateCopy, shapes[s][0], shapes[s][1], shapes[s][2], ms[0], mb[0]);
+    runAccumulate(accumulateMove, shapes[s][0], shapes[s][1], shapes[s][2], ms[1], mb[1]);
+    std::cout << std::setw(20) << names[s] << std::setprecision(3)
+	      << std::setw(14) << ms[0] << std::setw(14) << mb[0]
+	      << std::setw(14) << ms[1] << std::setw(14) << mb[1] << std::endl;
+  }
+  if(!emulator) { return 0; }
+
+  // The full API call path on the emulated module:
+  pxarCore * api = getModule(verbosity, nrocs);
+  if(api == NULL) {
+    std::cout << "Could not initialize the emulated module." << std::endl;
+    return 1;
+  }
+
+  std::cout << "getEfficiencyMap() on the emulated module, " << nTriggers << " triggers:" << std::endl;
+  std::cout << std::setw(20) << "loop" << std::setw(14) << "time [ms]" << std::setw(14) << "peak [MB]"
+	    << std::setw(14) << "pixels" << std::endl;
+
+  const char * modes[3] = {"module parallel", "pixel parallel", "ROC serial"};
+  for(size_t m = 0; m < 3; m++) {
+    // A partially tested ROC forces the pixel-by-pixel loop. One HAL call per pixel is
+    // slow in the emulator, so only the first column (without pixel 0,0) is tested there:
+    api->_dut->testAllPixels(m != 1);
+    if(m == 1) {
+      for(uint8_t row = 1; row < ROC_NUMROWS; row++) { api->_dut->testPixel(0, row, true); }
+    }
+    uint16_t flags = (m == 2 ? FLAG_FORCE_SERIAL : 0);
+
+    size_t before = resetPeak();
+    timer t;
+    std::vector<pixel> map = api->getEfficiencyMap(flags, nTriggers);
+    double ms = static_cast<double>(t.get());
+    double mb = static_cast<double>(heap_peak - before)/(1 << 20);
+    std::cout << std::setw(20) << modes[m] << std::setprecision(3)
+	      << std::setw(14) << ms << std::setw(14) << mb << std::setw(14) << map.size() << std::endl;
+  }
+
+  delete api;
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include "datatypes.h"
+#include "exceptions.h"
+#include "log.h"
+#include "timer.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+
+using namespace pxar;
+
+// Generate raw pixel words, a fraction of them corrupted in one of the ways
+// the decoder encounters with noisy modules or a marginal DESER400 phase:
+std::vector<uint32_t> getRawHits(size_t nhits, double corrupt) {
+
+  std::vector<uint32_t> raw;
+  raw.reserve(nhits);
+  for(size_t i = 0; i < nhits; i++) {
+    pixel px(0, static_cast<uint8_t>(rand()%ROC_NUMCOLS), static_cast<uint8_t>(rand()%ROC_NUMROWS), static_cast<double>(rand()%256));
+    uint32_t word = px.encode();
+
+    if(static_cast<double>(rand())/RAND_MAX < corrupt) {
+      switch(rand()%3) {
+      // Pulse height fill bit set:
+      case 0: word |= 0x10; break;
+      // Invalid double column address:
+      case 1: word |= (7 << 21); break;
+      // Row 80, corrupt buffer:
+      default: word &= ~0x3fe00u; break;
+      }
+    }
+    raw.push_back(word);
+  }
+  return raw;
+}
+
+// Decode all hits through the throwing pixel constructor, as done before:
+size_t decodeThrowing(const std::vector<uint32_t> & raw, std::vector<pixel> & pixels) {
+  size_t errors = 0;
+  for(std::vector<uint32_t>::const_iterator it = raw.begin(); it != raw.end(); ++it) {
+    try {
+      pixel pix(*it,0);
+      pixels.push_back(pix);
+    }
+    catch(DataDecodingError &) { errors++; }
+  }
+  return errors;
+}
+
+// Decode all hits using the status code API:
+size_t decodeStatus(const std::vector<uint32_t> & raw, std::vector<pixel> & pixels) {
+  size_t errors = 0;
+  for(std::vector<uint32_t>::const_iterator it = raw.begin(); it != raw.end(); ++it) {
+    pixel pix;
+    if(pix.decode(*it,0) == PIXEL_VALID) { pixels.push_back(pix); }
+    else { errors++; }
+  }
+  return errors;
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t nhits = 2000000;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { nhits = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-v")) { Log::ReportingLevel() = Log::FromString(argv[++i]); }
+  }
+
+  double fractions[] = {0, 0.001, 0.01, 0.05, 0.1, 0.25, 0.5};
+
+  std::cout << "Decoding " << nhits << " pixel hits per run" << std::endl;
+  std::cout << std::setw(10) << "corrupt" << std::setw(16) << "throw [Mhit/s]"
+	    << std::setw(16) << "status [Mhit/s]" << std::setw(10) << "speedup" << std::endl;
+
+  for(size_t f = 0; f < sizeof(fractions)/sizeof(fractions[0]); f++) {
+    srand(42);
+    std::vector<uint32_t> raw = getRawHits(nhits, fractions[f]);
+    std::vector<pixel> pixels;
+    pixels.reserve(nhits);
+
+    timer t1;
+    size_t err1 = decodeThrowing(raw, pixels);
+    double ms1 = t1.get();
+    pixels.clear();
+
+    timer t2;
+    size_t err2 = decodeStatus(raw, pixels);
+    double ms2 = t2.get();
+
+    if(err1 != err2) { std::cout << "Error count mismatch: " << err1 << " vs " << err2 << std::endl; return 1; }
+
+    double rate1 = (ms1 > 0 ? nhits/ms1/1000 : 0);
+    double rate2 = (ms2 > 0 ? nhits/ms2/1000 : 0);
+    std::cout << std::setw(10) << fractions[f]
+	      << std::setw(16) << std::setprecision(3) << rate1
+	      << std::setw(16) << std::setprecision(3) << rate2
+	      << std::setw(10) << std::setprecision(3) << (rate1 > 0 ? rate2/rate1 : 0) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,274 @@
+#include "rpc_calls.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pxar;
+
+// Loopback interface answering the calls of a CTestboard like a DTB on which
+// every function does nothing: call ids are the host call ids, return values
+// are the call id of the function. Every transfer to the "DTB" costs a fixed
+// latency, standing in for the USB round trip.
+class CRpcIoLoopback : public CRpcIo {
+public:
+  CRpcIoLoopback(std::vector<std::string> names, unsigned int latency)
+    : transfers(0), bytes(0), m_names(names), m_latency(latency), m_rxpos(0) {}
+
+  void Write(const void *buffer, uint32_t size) {
+    const uint8_t * data = static_cast<const uint8_t*>(buffer);
+    m_tx.insert(m_tx.end(), data, data + size);
+  }
+
+  void Flush() {
+    if(m_tx.empty()) return;
+    transfers++;
+    bytes += m_tx.size();
+    if(m_latency > 0) { std::this_thread::sleep_for(std::chrono::microseconds(m_latency)); }
+    Execute();
+    m_tx.clear();
+  }
+
+  void Clear() { m_tx.clear(); m_rx.clear(); m_rxpos = 0; }
+
+  void Read(void *buffer, uint32_t size) {
+    if(m_rx.size() - m_rxpos < size) throw CRpcError(CRpcError::READ_TIMEOUT);
+    memcpy(buffer, &m_rx[m_rxpos], size);
+    m_rxpos += size;
+    if(m_rxpos == m_rx.size()) { m_rx.clear(); m_rxpos = 0; }
+  }
+
+  const char* Name() { return "loopback"; }
+  int32_t GetLastError() { return 0; }
+  const char* GetErrorMsg(int /*error*/) { return "none"; }
+  bool Open(char /*name*/[]) { return true; }
+  void Close() {}
+  bool EnumFirst(uint32_t &nDevices) { nDevices = 0; return true; }
+  bool EnumNext(char /*name*/[]) { return false; }
+  bool Enum(char /*name*/[], uint32_t /*pos*/) { return false; }
+  bool Connected() { return true; }
+  void SetTimeout(unsigned int /*timeout*/) {}
+
+  // Transfers to the DTB and bytes sent:
+  size_t transfers, bytes;
+
+private:
+  std::vector<std::string> m_names;
+  unsigned int m_latency;
+  std::vector<uint8_t> m_tx, m_rx;
+  size_t m_rxpos;
+
+  // Size of a return value or parameter type in the RPC signature:
+  static size_t typeSize(char type) {
+    switch(type) {
+    case 'b': case 'c': case 'C': return 1;
+    case 's': case 'S': return 2;
+    case 'i': case 'I': return 4;
+    case 'l': case 'L': return 8;
+    default: return 0;
+    }
+  }
+
+  void putData(const std::string & data) {
+    uint32_t size = data.size();
+    m_rx.push_back(RPC_TYPE_DTB_DATA);
+    for(size_t i = 0; i < 3; i++) { m_rx.push_back(static_cast<uint8_t>(size >> (8*i))); }
+    m_rx.insert(m_rx.end(), data.begin(), data.end());
+  }
+
+  // Answer all calls of the transfer, in order:
+  void Execute() {
+    size_t pos = 0;
+    while(pos < m_tx.size()) {
+      if(m_tx[pos] != RPC_TYPE_DTB) throw CRpcError(CRpcError::WRONG_MSG_TYPE);
+      uint16_t cmd = m_tx[pos+1] | (m_tx[pos+2] << 8);
+      pos += 4 + m_tx[pos+3];
+      if(cmd >= m_names.size()) throw CRpcError(CRpcError::UNKNOWN_CMD);
+
+      // Data messages following the call, the last one is kept as parameter:
+      std::string data;
+      while(pos < m_tx.size() && m_tx[pos] == RPC_TYPE_DTB_DATA) {
+	uint32_t size = m_tx[pos+1] | (m_tx[pos+2] << 8) | (m_tx[pos+3] << 16);
+	data.assign(m_tx.begin() + pos + 4, m_tx.begin() + pos + 4 + size);
+	pos += 4 + size;
+      }
+
+      // Return value and reference parameters from the signature:
+      const std::string & name = m_names[cmd];
+      size_t sig = name.rfind('$') + 1;
+      bool reply = (name[sig] != 'v');
+      size_t size = typeSize(name[sig]), nData = 0;
+      for(size_t i = sig + 1; i < name.size(); i++) {
+	if(name[i] == '0') { reply = true; size += typeSize(name[++i]); }
+	else if(name[i] == '2' || name[i] == '4' || name[i] == '5') { reply = true; nData++; i++; }
+	else if(name[i] >= '1' && name[i] <= '3') { i++; }
+      }
+      if(!reply) continue;
+
+      // GetRpcCallId: look up the requested name
+      uint32_t value = cmd;
+      if(cmd == 1) {
+	value = static_cast<uint32_t>(-1);
+	for(size_t i = 0; i < m_names.size(); i++) { if(m_names[i] == data) value = i; }
+      }
+
+      m_rx.push_back(RPC_TYPE_DTB);
+      m_rx.push_back(static_cast<uint8_t>(cmd));
+      m_rx.push_back(static_cast<uint8_t>(cmd >> 8));
+      m_rx.push_back(static_cast<uint8_t>(size));
+      for(size_t i = 0; i < size; i++) { m_rx.push_back(i < 4 ? static_cast<uint8_t>(value >> (8*i)) : 0); }
+      for(size_t i = 0; i < nData; i++) { putData(""); }
+    }
+  }
+};
+
+// Host call id of a function by its RPC name:
+uint16_t getCallId(CTestboard & tb, std::string name) {
+  std::vector<std::string> names = tb.GetHostRpcCallNames();
+  for(size_t i = 0; i < names.size(); i++) { if(names[i] == name) return i; }
+  return 0;
+}
+
+// The calls of a DUT programming as issued by the HAL, for a module of nrocs ROCs:
+// TBM registers, DACs, masking, column enables and clearing the calibrate signals,
+// followed by reading back the analog currents:
+void programModule(CTestboard & tb, uint8_t nrocs, bool deferred, uint16_t & ia, uint16_t & id) {
+
+  tb.tbm_Enable(true);
+  for(uint8_t core = 0; core < 2; core++) {
+    tb.mod_Addr(31);
+    for(uint8_t reg = 0; reg < 8; reg++) { tb.tbm_Set((core ? 0xf0 : 0xe0) | (reg << 1), 0x80); }
+    tb.Flush();
+  }
+
+  for(uint8_t roc = 0; roc < nrocs; roc++) {
+    tb.roc_I2cAddr(roc);
+    for(uint8_t dac = 1; dac <= 23; dac++) { tb.roc_SetDAC(dac, 100); }
+    tb.Flush();
+  }
+  for(uint8_t roc = 0; roc < nrocs; roc++) {
+    tb.roc_I2cAddr(roc);
+    tb.roc_Chip_Mask();
+    tb.Flush();
+  }
+  for(uint8_t roc = 0; roc < nrocs; roc++) {
+    tb.roc_I2cAddr(roc);
+    for(uint8_t col = 0; col < 26; col++) { tb.roc_Col_Enable(col, true); }
+    tb.Flush();
+  }
+  for(uint8_t roc = 0; roc < nrocs; roc++) {
+    tb.roc_I2cAddr(roc);
+    tb.roc_ClrCal();
+  }
+  tb.Flush();
+
+  if(deferred) {
+    CRpcResult<uint16_t> rIa, rId;
+    tb._GetIA(rIa);
+    tb._GetID(rId);
+    tb.BatchEnd();
+    ia = rIa.Get();
+    id = rId.Get();
+  }
+  else {
+    ia = tb._GetIA();
+    id = tb._GetID();
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  unsigned int latency = 125;
+  uint8_t nrocs = 16;
+  size_t nRuns = 10;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-l")) { latency = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-r")) { nrocs = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-n")) { nRuns = atoi(argv[++i]); }
+  }
+  Log::ReportingLevel() = logCRITICAL;
+
+  CTestboard tb;
+  CRpcIoLoopback io(tb.GetHostRpcCallNames(), latency);
+  tb.SelectInterface(&io);
+
+  // Connecting and programming the module for the first time, with the call ids
+  // resolved at first use, negotiated in bulk, or taken from the cache:
+  std::cout << "Connecting and programming a module of " << static_cast<int>(nrocs) << " ROCs over a loopback interface, "
+	    << latency << " us per transfer:" << std::endl;
+  std::cout << std::setw(20) << "call ids" << std::setw(14) << "transfers" << std::setw(14) << "bytes"
+	    << std::setw(14) << "time [ms]" << std::endl;
+
+  std::vector<int32_t> ids;
+  const char * links[3] = {"at first use", "bulk", "cached"};
+  for(size_t l = 0; l < 3; l++) {
+    tb.Close();
+    io.transfers = 0;
+    io.bytes = 0;
+    timer t;
+    if(l == 1 && !tb.RpcLink()) {
+      std::cout << "Could not link the RPC calls on the loopback interface." << std::endl;
+      return 1;
+    }
+    if(l == 2) { tb.SetRpcCallIds(ids); }
+    uint16_t ia = 0, id = 0;
+    programModule(tb, nrocs, false, ia, id);
+    double ms = static_cast<double>(t.get());
+    std::cout << std::setw(20) << links[l] << std::setw(14) << io.transfers << std::setw(14) << io.bytes
+	      << std::setw(14) << std::setprecision(3) << ms << std::endl;
+    if(l == 1) { ids = tb.GetRpcCallIds(); }
+  }
+
+  // All call ids are known from here on:
+  tb.RpcLink();
+  for(size_t i = 0; i < ids.size(); i++) {
+    if(ids[i] != static_cast<int32_t>(i)) {
+      std::cout << "Wrong call id for " << tb.GetHostRpcCallNames()[i] << "." << std::endl;
+      return 1;
+    }
+  }
+  uint16_t expectIa = getCallId(tb, "_GetIA$S"), expectId = getCallId(tb, "_GetID$S");
+
+  std::cout << "Programming the module, " << nRuns << " runs:" << std::endl;
+  std::cout << std::setw(20) << "mode" << std::setw(14) << "transfers" << std::setw(14) << "bytes"
+	    << std::setw(14) << "time [ms]" << std::endl;
+
+  tb.ClearRpcStatistics();
+  const char * modes[3] = {"unbatched", "batched", "batched, deferred"};
+  for(size_t m = 0; m < 3; m++) {
+    io.transfers = 0;
+    io.bytes = 0;
+    timer t;
+    for(size_t run = 0; run < nRuns; run++) {
+      uint16_t ia = 0, id = 0;
+      if(m > 0) { tb.BatchBegin(); }
+      programModule(tb, nrocs, m == 2, ia, id);
+      if(m == 1) { tb.BatchEnd(); }
+      if(ia != expectIa || id != expectId) {
+	std::cout << "Wrong reply in mode \"" << modes[m] << "\"." << std::endl;
+	return 1;
+      }
+    }
+    double ms = static_cast<double>(t.get())/nRuns;
+    std::cout << std::setw(20) << modes[m] << std::setw(14) << io.transfers/nRuns << std::setw(14) << io.bytes/nRuns
+	      << std::setw(14) << std::setprecision(3) << ms << std::endl;
+  }
+
+  // Where the time of the programming runs went, as collected by the RPC layer:
+  std::map<std::string, CRpcCallTotals> stats;
+  tb.GetRpcStatistics(stats);
+  std::cout << "RPC calls of all runs:" << std::endl;
+  std::cout << std::setw(24) << "call" << std::setw(10) << "calls" << std::setw(14) << "bytes sent"
+	    << std::setw(14) << "bytes recv" << std::setw(14) << "time [ms]" << std::endl;
+  for(std::map<std::string, CRpcCallTotals>::iterator call = stats.begin(); call != stats.end(); ++call) {
+    std::cout << std::setw(24) << call->first << std::setw(10) << call->second.calls << std::setw(14) << call->second.bytes_sent
+	      << std::setw(14) << call->second.bytes_received << std::setw(14) << call->second.time_total/1000. << std::endl;
+  }
+
+  return 0;
+}
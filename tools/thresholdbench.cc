@@ -0,0 +1,188 @@
+#include "datatypes.h"
+#include "thresholdfinder.h"
+#include "helper.h"
+#include "log.h"
+#include "timer.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <cmath>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <thread>
+
+using namespace pxar;
+
+typedef std::vector<std::pair<uint8_t,std::vector<pixel> > > dacScan;
+
+// Generate an efficiency scan over "nrocs" fully enabled ROCs: every pixel follows
+// an S-curve around a random threshold, with binomial fluctuations. As in the
+// readout, pixels without hits do not appear at the respective DAC value:
+dacScan getScan(uint8_t nrocs, uint8_t dacStep, uint16_t nTriggers) {
+
+  std::vector<double> thr(nrocs*ROC_NUMCOLS*ROC_NUMROWS);
+  for(size_t i = 0; i < thr.size(); i++) { thr[i] = 20 + rand()%200; }
+
+  dacScan scan;
+  for(size_t dac = 0; dac < 256; dac += dacStep) {
+    scan.push_back(std::make_pair(static_cast<uint8_t>(dac), std::vector<pixel>()));
+    for(uint8_t roc = 0; roc < nrocs; roc++) {
+      for(uint8_t col = 0; col < ROC_NUMCOLS; col++) {
+	for(uint8_t row = 0; row < ROC_NUMROWS; row++) {
+	  double p = 1/(1 + exp((thr[(roc*ROC_NUMCOLS + col)*ROC_NUMROWS + row] - dac)/4.));
+	  uint16_t hits = 0;
+	  for(uint16_t t = 0; t < nTriggers; t++) { if(static_cast<double>(rand())/RAND_MAX < p) hits++; }
+	  if(hits > 0) { scan.back().second.push_back(pixel(roc, col, row, hits)); }
+	}
+      }
+    }
+  }
+  return scan;
+}
+
+// Reference: the threshold extraction searching the found and result vectors for
+// every pixel at every DAC value, as done before:
+std::vector<pixel> extractReference(dacScan scan, uint16_t threshold, uint8_t fallback) {
+
+  std::vector<pixel> result;
+  std::vector<pixel> found;
+  std::map<pixel,uint8_t> oldvalue;
+
+  for(dacScan::iterator it = scan.begin(); it != scan.end(); ++it) {
+    for(std::vector<pixel>::iterator pixit = it->second.begin(); pixit != it->second.end(); ++pixit) {
+      std::vector<pixel>::iterator px_found = std::find_if(found.begin(), found.end(), findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
+      if(px_found != found.end()) continue;
+
+      std::vector<pixel>::iterator px = std::find_if(result.begin(), result.end(), findPixelXY(pixit->column(), pixit->row(), pixit->roc()));
+      if(px != result.end()) {
+	uint8_t delta_old = abs(oldvalue[*px] - threshold);
+	uint8_t delta_new = abs(static_cast<uint8_t>(pixit->value()) - threshold);
+	bool positive_slope = (static_cast<uint8_t>(pixit->value()) - oldvalue[*px] > 0 ? true : false);
+	if(positive_slope && !(delta_new < delta_old)) {
+	  found.push_back(*pixit);
+	  continue;
+	}
+	px->setValue(it->first);
+	oldvalue[*px] = static_cast<uint8_t>(pixit->value());
+      }
+      else {
+	if(pixit->value() >= threshold) { found.push_back(*pixit); }
+	oldvalue.insert(std::make_pair(*pixit,pixit->value()));
+	pixit->setValue(it->first);
+	result.push_back(*pixit);
+      }
+    }
+  }
+
+  for(std::vector<pixel>::iterator px = result.begin(); px != result.end(); ++px) {
+    std::vector<pixel>::iterator px_found = std::find_if(found.begin(), found.end(), findPixelXY(px->column(), px->row(), px->roc()));
+    if(px_found == found.end()) { px->setValue(fallback); }
+  }
+  return result;
+}
+
+// Threshold extraction using the dense per-pixel state:
+std::vector<pixel> extractDense(const dacScan & scan, uint16_t threshold, uint8_t fallback) {
+
+  thresholdFinder finder(threshold);
+  for(dacScan::const_iterator it = scan.begin(); it != scan.end(); ++it) { finder.Add(it->first, it->second); }
+
+  std::vector<pixel> result, missing;
+  finder.Fill(result, fallback, missing);
+  return result;
+}
+
+// Threshold extraction distributing the ROCs over "nthreads" threads:
+std::vector<pixel> extractParallel(const dacScan & scan, uint16_t threshold, uint8_t fallback, size_t nthreads) {
+
+  std::vector<thresholdScan> scans(1);
+  for(dacScan::const_iterator it = scan.begin(); it != scan.end(); ++it) { scans.front().push_back(std::make_pair(it->first, &it->second)); }
+
+  std::vector<std::vector<pixel> > results, missing;
+  thresholdFinder::Find(scans, threshold, fallback, nthreads, results, missing);
+  return results.front();
+}
+
+bool identical(const std::vector<pixel> & a, const std::vector<pixel> & b) {
+  if(a.size() != b.size()) return false;
+  for(size_t i = 0; i < a.size(); i++) {
+    if(a[i].roc() != b[i].roc() || a[i].column() != b[i].column() || a[i].row() != b[i].row() || a[i].value() != b[i].value()) return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+
+  uint8_t maxrocs = 16;
+  uint8_t maxref = 4;
+  uint8_t dacStep = 4;
+  uint16_t nTriggers = 10;
+  size_t nthreads = std::thread::hardware_concurrency();
+  bool reference = true;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { maxrocs = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-r")) { maxref = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-j")) { nthreads = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-s")) { dacStep = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-t")) { nTriggers = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-q")) { reference = false; }
+    if (!strcmp(argv[i],"-v")) { Log::ReportingLevel() = Log::FromString(argv[++i]); }
+  }
+  if(dacStep == 0) { dacStep = 1; }
+  if(nthreads == 0) { nthreads = 1; }
+
+  // 50% efficiency level, rising edge:
+  uint16_t threshold = static_cast<uint16_t>(ceil(static_cast<float>(nTriggers)*50/100));
+
+  std::cout << "Threshold extraction, DAC step " << static_cast<int>(dacStep) << ", "
+	    << nTriggers << " triggers, " << nthreads << " threads" << (reference ? "" : ", skipping reference") << std::endl;
+  std::cout << std::setw(8) << "ROCs" << std::setw(12) << "hits"
+	    << std::setw(12) << "ref [ms]" << std::setw(12) << "dense [ms]" << std::setw(12) << "par. [ms]"
+	    << std::setw(12) << "speedup" << std::endl;
+
+  srand(42);
+  for(uint8_t nrocs = 1; nrocs <= maxrocs; nrocs *= 2) {
+    dacScan scan = getScan(nrocs, dacStep, nTriggers);
+    size_t nhits = 0;
+    for(dacScan::iterator it = scan.begin(); it != scan.end(); ++it) { nhits += it->second.size(); }
+
+    timer t_dense;
+    std::vector<pixel> dense = extractDense(scan, threshold, 255);
+    double ms_dense = static_cast<double>(t_dense.get());
+
+    timer t_par;
+    std::vector<pixel> parallel = extractParallel(scan, threshold, 255, nthreads);
+    double ms_par = static_cast<double>(t_par.get());
+    if(!identical(dense, parallel)) {
+      std::cout << "Parallel threshold mismatch for " << static_cast<int>(nrocs) << " ROCs!" << std::endl;
+      return 1;
+    }
+
+    double ms_ref = 0;
+    bool run_ref = reference && nrocs <= maxref;
+    if(run_ref) {
+      timer t_ref;
+      std::vector<pixel> ref = extractReference(scan, threshold, 255);
+      ms_ref = static_cast<double>(t_ref.get());
+      if(!identical(ref, dense)) {
+	std::cout << "Threshold mismatch for " << static_cast<int>(nrocs) << " ROCs!" << std::endl;
+	return 1;
+      }
+    }
+
+    std::cout << std::setw(8) << static_cast<int>(nrocs) << std::setw(12) << nhits << std::setw(12);
+    if(run_ref) { std::cout << ms_ref; }
+    else { std::cout << "-"; }
+    std::cout << std::setw(12) << ms_dense << std::setw(12) << ms_par << std::setw(12);
+    if(run_ref && ms_par > 0) { std::cout << std::setprecision(4) << ms_ref/ms_par; }
+    else { std::cout << "-"; }
+    std::cout << std::endl;
+
+    if(nrocs >= 128) break;
+  }
+  return 0;
+}
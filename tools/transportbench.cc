@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include "USBInterface.h"
+#include "EthernetInterface.h"
+#include "log.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace pxar;
+
+// Loopback DTB standing in for libftdi and pcap: everything the host sends is
+// counted and dropped, the data for the host is queued by the benchmark.
+namespace loopback {
+  std::mutex usbMutex;
+  std::vector<unsigned char> usbOut;
+  size_t usbPos = 0;
+  size_t sent = 0;
+
+  std::deque<std::vector<unsigned char> > ethOut;
+  std::vector<unsigned char> ethFrame;
+  unsigned char hostMac[6], hostPid[2];
+  const unsigned char dtbMac[6] = {0x00, 0x50, 0xc2, 0x00, 0x00, 0x01};
+
+  // Queue "size" bytes of data for the host:
+  void queueUsb(size_t size) {
+    std::lock_guard<std::mutex> lock(usbMutex);
+    usbOut.assign(size, 0xa5);
+    usbPos = 0;
+  }
+
+  void queueEthFrame(const unsigned char * payload, size_t size, unsigned char type) {
+    std::vector<unsigned char> frame(ETH_HEADER_SIZE + size);
+    memcpy(&frame[0], hostMac, 6);
+    memcpy(&frame[6], dtbMac, 6);
+    frame[12] = 0x08;
+    frame[13] = 0x09;
+    frame[14] = hostPid[0];
+    frame[15] = hostPid[1];
+    frame[16] = type;
+    frame[17] = size >> 8;
+    frame[18] = size;
+    if(size > 0) memcpy(&frame[ETH_HEADER_SIZE], payload, size);
+    ethOut.push_back(frame);
+  }
+
+  void queueEth(size_t size) {
+    std::vector<unsigned char> payload(MAX_TX_DATA, 0xa5);
+    for(size_t pos = 0; pos < size; pos += MAX_TX_DATA) {
+      queueEthFrame(&payload[0], std::min(static_cast<size_t>(MAX_TX_DATA), size - pos), 0);
+    }
+  }
+}
+
+// --- libftdi stand-in
+int ftdi_init(struct ftdi_context * ftdi) { ftdi->open = 0; return 0; }
+void ftdi_deinit(struct ftdi_context *) {}
+const char * ftdi_get_error_string(struct ftdi_context *) { return "loopback"; }
+int ftdi_usb_find_all(struct ftdi_context *, struct ftdi_device_list ** devlist, int, int product) {
+  static struct ftdi_device_list dev = {NULL, NULL};
+  *devlist = &dev;
+  return (product == 0x6014) ? 1 : 0;
+}
+void ftdi_list_free(struct ftdi_device_list **) {}
+int ftdi_usb_get_strings(struct ftdi_context *, struct libusb_device *, char * manufacturer, int,
+			 char * description, int, char * serial, int) {
+  strcpy(manufacturer, "loopback");
+  strcpy(description, "loopback");
+  strcpy(serial, "DTB_LOOPBACK");
+  return 0;
+}
+int ftdi_usb_open_dev(struct ftdi_context * ftdi, struct libusb_device *) { ftdi->open = 1; return 0; }
+int ftdi_usb_close(struct ftdi_context * ftdi) { ftdi->open = 0; return 0; }
+int ftdi_usb_purge_buffers(struct ftdi_context *) { return 0; }
+int ftdi_set_bitmode(struct ftdi_context *, unsigned char, unsigned char) { return 0; }
+int ftdi_set_baudrate(struct ftdi_context *, int) { return 0; }
+int ftdi_read_data_set_chunksize(struct ftdi_context *, unsigned int) { return 0; }
+int ftdi_write_data_set_chunksize(struct ftdi_context *, unsigned int) { return 0; }
+int ftdi_get_latency_timer(struct ftdi_context *, unsigned char * latency) { *latency = 1; return 0; }
+int ftdi_read_data(struct ftdi_context *, unsigned char * buf, int size) {
+  std::lock_guard<std::mutex> lock(loopback::usbMutex);
+  size_t n = std::min(static_cast<size_t>(size), loopback::usbOut.size() - loopback::usbPos);
+  if(n > 0) memcpy(buf, &loopback::usbOut[loopback::usbPos], n);
+  loopback::usbPos += n;
+  return n;
+}
+int ftdi_write_data(struct ftdi_context *, const unsigned char *, int size) {
+  loopback::sent += size;
+  return size;
+}
+int libusb_open(struct libusb_device *, struct libusb_device_handle **) { return 0; }
+int libusb_detach_kernel_driver(struct libusb_device_handle *, int) { return 0; }
+void libusb_close(struct libusb_device_handle *) {}
+
+// --- pcap stand-in
+pcap_t * pcap_open_live(const char *, int, int, int, char *) {
+  static char device;
+  return reinterpret_cast<pcap_t*>(&device);
+}
+const unsigned char * pcap_next(pcap_t *, struct pcap_pkthdr * header) {
+  if(loopback::ethOut.empty()) return NULL;
+  loopback::ethFrame.swap(loopback::ethOut.front());
+  loopback::ethOut.pop_front();
+  header->caplen = header->len = loopback::ethFrame.size();
+  return &loopback::ethFrame[0];
+}
+int pcap_sendpacket(pcap_t *, const unsigned char * buffer, int size) {
+  if(size < 17 || buffer[12] != 0x08 || buffer[13] != 0x09) return 0;
+  // Claim and release are acknowledged, data is counted:
+  if(buffer[16] == 0x0) { loopback::sent += size - ETH_HEADER_SIZE; }
+  else {
+    memcpy(loopback::hostMac, buffer + 6, 6);
+    memcpy(loopback::hostPid, buffer + 14, 2);
+    loopback::queueEthFrame(NULL, 0, 0x1);
+  }
+  return 0;
+}
+void pcap_close(pcap_t *) {}
+
+// Upload: "blocks" RPC calls with a parameter block of "blocksize" bytes each,
+// as SetTrimValues sends them. Returns MB/s.
+double upload(CRpcIo & io, size_t blocks, size_t blocksize) {
+  std::vector<unsigned char> header(4, 0x5a), block(blocksize, 0x5a);
+  loopback::sent = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t b = 0; b < blocks; b++) {
+    io.Write(&header[0], header.size());
+    io.Write(&block[0], block.size());
+    io.Flush();
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(loopback::sent != blocks*(blocksize + 4)) { std::cout << "Data lost in upload." << std::endl; exit(1); }
+  return loopback::sent/1e6/s;
+}
+
+// Readback: "blocks" replies of "blocksize" bytes, as Daq_Read receives them.
+// Returns MB/s.
+double readback(CRpcIo & io, size_t blocks, size_t blocksize) {
+  std::vector<unsigned char> header(4), block(blocksize);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t b = 0; b < blocks; b++) {
+    io.Read(&header[0], header.size());
+    io.Read(&block[0], block.size());
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return blocks*(blocksize + 4)/1e6/s;
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t nBlocks = 200;
+  size_t uploadsize = 4160;
+  size_t readsize = 131072;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { nBlocks = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-u")) { uploadsize = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-b")) { readsize = atoi(argv[++i]); }
+  }
+  Log::ReportingLevel() = logCRITICAL;
+
+  std::cout << "Transport over a loopback DTB, " << nBlocks << " uploads of " << uploadsize
+	    << " bytes and readbacks of " << readsize << " bytes:" << std::endl;
+  std::cout << std::setw(16) << "interface" << std::setw(16) << "upload MB/s" << std::setw(16) << "readback MB/s" << std::endl;
+
+  CUSB usb;
+  char serial[] = "*";
+  usb.Open(serial);
+  double usbUp = upload(usb, nBlocks, uploadsize);
+  loopback::queueUsb(nBlocks*(readsize + 4));
+  double usbDown = readback(usb, nBlocks, readsize);
+  usb.Close();
+  std::cout << std::setw(16) << "USB (libftdi)" << std::fixed << std::setprecision(1)
+	    << std::setw(16) << usbUp << std::setw(16) << usbDown << std::endl;
+
+  CEthernet eth;
+  char mac[14] = "DTB_ETH";
+  memcpy(mac + 7, loopback::dtbMac, 6);
+  eth.Open(mac);
+  double ethUp = upload(eth, nBlocks, uploadsize);
+  loopback::queueEth(nBlocks*(readsize + 4));
+  double ethDown = readback(eth, nBlocks, readsize);
+  eth.Close();
+  std::cout << std::setw(16) << "Ethernet" << std::setw(16) << ethUp << std::setw(16) << ethDown << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "ringbuffer.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pxar;
+
+#define BUFSIZE 0x200000
+#define CHUNKSIZE 0x1000
+
+// Read buffer of the libftdi USB interface before: every byte is handed over
+// with a semaphore pair, the consumer polls every millisecond if it is empty.
+class semaphoreBuffer {
+public:
+  semaphoreBuffer() : head(0), tail(0) {
+    sem_init(&buf_data, 0, 0);
+    sem_init(&buf_space, 0, BUFSIZE);
+  }
+  ~semaphoreBuffer() { sem_destroy(&buf_data); sem_destroy(&buf_space); }
+
+  void put(const unsigned char * data, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+      sem_wait(&buf_space);
+      int32_t nh = (head == (BUFSIZE - 1)) ? 0 : head + 1;
+      read_buffer[head] = data[i];
+      head = nh;
+      sem_post(&buf_data);
+    }
+  }
+
+  void get(unsigned char * data, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+      while(tail == head) { usleep(1000); }
+      sem_wait(&buf_data);
+      data[i] = read_buffer[tail];
+      tail = (tail == (BUFSIZE - 1)) ? 0 : tail + 1;
+      sem_post(&buf_space);
+    }
+  }
+
+private:
+  sem_t buf_data, buf_space;
+  unsigned char read_buffer[BUFSIZE];
+  volatile int32_t head, tail;
+};
+
+// Read buffer of the libftdi USB interface now, as used by CUSB::Read():
+class ringBufferFtdi {
+public:
+  ringBufferFtdi() : ring(BUFSIZE) {}
+
+  void put(const unsigned char * data, size_t size) {
+    size_t written = 0;
+    while((written += ring.write(data + written, size - written)) < size) { ring.waitSpace(10); }
+  }
+
+  void get(unsigned char * data, size_t size) {
+    size_t read = 0;
+    while((read += ring.read(data + read, size - read)) < size) { ring.waitData(10); }
+  }
+
+private:
+  ringBuffer ring;
+};
+
+// Sustained transfer: the reader thread delivers the DAQ data in chunks as
+// returned by ftdi_read_data(), the host reads it back as Daq_Read replies,
+// a header of four bytes followed by one block.
+template <class T> double throughput(size_t blocks, size_t blocksize) {
+  T * buffer = new T();
+  std::thread device([&]() {
+      std::vector<unsigned char> chunk(CHUNKSIZE, 0xa5);
+      size_t total = blocks*(blocksize + 4);
+      for(size_t sent = 0; sent < total; sent += CHUNKSIZE) {
+	buffer->put(&chunk[0], std::min(static_cast<size_t>(CHUNKSIZE), total - sent));
+      }
+    });
+
+  std::vector<unsigned char> header(4), block(blocksize);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t b = 0; b < blocks; b++) {
+    buffer->get(&header[0], header.size());
+    buffer->get(&block[0], block.size());
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  device.join();
+  delete buffer;
+  return blocks*(blocksize + 4)/1e6/s;
+}
+
+// Round trip: the host sends a request, the device answers with a reply
+// of "size" bytes as soon as it sees it. Returns the mean time in us.
+template <class T> double roundtrip(size_t calls, size_t size) {
+  T * buffer = new T();
+  ringBuffer request(16);
+  std::thread device([&]() {
+      std::vector<unsigned char> reply(size, 0x5a);
+      for(size_t c = 0; c < calls; c++) {
+	unsigned char cmd;
+	while(request.read(&cmd, 1) == 0) { request.waitData(10); }
+	buffer->put(&reply[0], reply.size());
+      }
+    });
+
+  std::vector<unsigned char> reply(size);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t c = 0; c < calls; c++) {
+    unsigned char cmd = 1;
+    request.write(&cmd, 1);
+    buffer->get(&reply[0], reply.size());
+  }
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  device.join();
+  delete buffer;
+  return us/calls;
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t nBlocks = 100;
+  size_t blocksize = 131072;
+  size_t nCalls = 1000;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-n")) { nBlocks = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-b")) { blocksize = atoi(argv[++i]); }
+    if (!strcmp(argv[i],"-c")) { nCalls = atoi(argv[++i]); }
+  }
+
+  std::cout << "Host side of the libftdi USB read buffer, reader thread delivering "
+	    << CHUNKSIZE << " byte chunks:" << std::endl;
+  std::cout << std::setw(16) << "buffer" << std::setw(16) << "MB/s"
+	    << std::setw(16) << "rtt 8b [us]" << std::setw(16) << "rtt 1kb [us]" << std::endl;
+
+  const char * names[2] = {"semaphores", "ring buffer"};
+  for(size_t m = 0; m < 2; m++) {
+    double mbs = (m == 0) ? throughput<semaphoreBuffer>(nBlocks, blocksize) : throughput<ringBufferFtdi>(nBlocks, blocksize);
+    double rttShort = (m == 0) ? roundtrip<semaphoreBuffer>(nCalls, 8) : roundtrip<ringBufferFtdi>(nCalls, 8);
+    double rttLong = (m == 0) ? roundtrip<semaphoreBuffer>(nCalls, 1024) : roundtrip<ringBufferFtdi>(nCalls, 1024);
+    std::cout << std::setw(16) << names[m] << std::fixed << std::setprecision(1) << std::setw(16) << mbs
+	      << std::setw(16) << rttShort << std::setw(16) << rttLong << std::endl;
+  }
+
+  return 0;
+}